@@ -33,6 +33,12 @@ class aabb
 
     bool hit(const ray& r, double tmin, double tmax) const;
 
+    double surface_area() const
+    {
+        const vec3 d = _max - _min;
+        return 2.0 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+    }
+
     point3 _min;
     point3 _max;
 };
@@ -74,4 +80,13 @@ inline aabb surrounding_box(aabb box0, aabb box1)
     return aabb(small, big);
 }
 
+// Box at s in [0, 1] between box0 and box1. For objects moving linearly,
+// interpolating their boxes at the two ends of an interval bounds them at
+// every time in between.
+inline aabb interpolate_box(const aabb& box0, const aabb& box1, double s)
+{
+    return aabb(box0.min() + s * (box1.min() - box0.min()),
+                box0.max() + s * (box1.max() - box0.max()));
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,267 @@
+// Copyright (c) 2020 Chris Ohk
+
+// I am making my contributions/submissions to this project solely in my
+// personal capacity and are not conveying any rights to any intellectual
+// property of any third parties.
+
+// It is based on Ray Tracing: The Rest of Your Life book.
+// References: https://raytracing.github.io
+
+#ifndef RAY_TRACING_ACCUMULATION_BUFFER_HPP
+#define RAY_TRACING_ACCUMULATION_BUFFER_HPP
+
+#include "common.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Un-normalized radiance sums and sample counts per pixel, for rendering a
+// frame in pieces: each piece renders its own range of sample indices, with
+// the samples seeded by index, and the pieces are merged in any order and
+// at any time. Merging refuses pieces of another frame and overlapping
+// sample ranges, which would count the same samples twice.
+//
+// File layout, little-endian: "RTACCUM1", width and height (u32), the frame
+// description (u32 length and bytes), the sample ranges (u32 count, then
+// seed, first and count as u64 each), the sums (3 f64 per pixel) and the
+// counts (u32 per pixel). Pixels are stored by rows from the bottom up.
+class accumulation_buffer
+{
+ public:
+    struct sample_range
+    {
+        std::uint64_t seed = 0;
+        std::uint64_t first = 0;
+        std::uint64_t count = 0;
+    };
+
+    accumulation_buffer() = default;
+    // frame: what the image shows (render_job::describe_frame()).
+    accumulation_buffer(int w, int h, std::string frame_description)
+        : width(w),
+          height(h),
+          frame(std::move(frame_description)),
+          sums(static_cast<std::size_t>(w) * h * 3, 0.0),
+          counts(static_cast<std::size_t>(w) * h, 0)
+    {
+        // Do nothing
+    }
+
+    void add(int i, int j, const color& sum, std::uint32_t samples)
+    {
+        const auto pixel = static_cast<std::size_t>(j) * width + i;
+        for (int c = 0; c < 3; ++c)
+        {
+            sums[pixel * 3 + c] += sum[c];
+        }
+        counts[pixel] += samples;
+    }
+
+    // Adds the samples of other. Returns why it cannot, or an empty string.
+    std::string merge(const accumulation_buffer& other);
+
+    // Mean radiance per pixel, 3 floats each; black where no sample landed.
+    std::vector<float> resolve() const;
+
+    bool save(const std::string& path) const;
+    bool load(const std::string& path);
+
+    int width = 0;
+    int height = 0;
+    std::string frame;
+    std::vector<sample_range> ranges;
+    std::vector<double> sums;
+    std::vector<std::uint32_t> counts;
+
+ private:
+    // Little-endian integers of the given number of bytes.
+    static void put(std::ostream& out, std::uint64_t value, int bytes);
+    static std::uint64_t get(std::istream& in, int bytes);
+};
+
+inline std::string accumulation_buffer::merge(const accumulation_buffer& other)
+{
+    if (other.width != width || other.height != height ||
+        other.frame != frame)
+    {
+        return "different frames: '" + frame + "' and '" + other.frame + "'";
+    }
+
+    for (const auto& a : ranges)
+    {
+        for (const auto& b : other.ranges)
+        {
+            if (a.seed == b.seed && a.first < b.first + b.count &&
+                b.first < a.first + a.count)
+            {
+                return "sample ranges overlap: [" + std::to_string(a.first) +
+                       ", " + std::to_string(a.first + a.count) + ") and [" +
+                       std::to_string(b.first) + ", " +
+                       std::to_string(b.first + b.count) + ") with seed " +
+                       std::to_string(a.seed);
+            }
+        }
+    }
+
+    ranges.insert(ranges.end(), other.ranges.begin(), other.ranges.end());
+    for (std::size_t k = 0; k < sums.size(); ++k)
+    {
+        sums[k] += other.sums[k];
+    }
+    for (std::size_t k = 0; k < counts.size(); ++k)
+    {
+        counts[k] += other.counts[k];
+    }
+
+    return {};
+}
+
+inline std::vector<float> accumulation_buffer::resolve() const
+{
+    std::vector<float> pixels(sums.size(), 0.0f);
+
+    for (std::size_t p = 0; p < counts.size(); ++p)
+    {
+        if (counts[p] == 0)
+        {
+            continue;
+        }
+
+        for (int c = 0; c < 3; ++c)
+        {
+            pixels[p * 3 + c] = static_cast<float>(sums[p * 3 + c] / counts[p]);
+        }
+    }
+
+    return pixels;
+}
+
+inline void accumulation_buffer::put(std::ostream& out, std::uint64_t value,
+                                     int bytes)
+{
+    for (int b = 0; b < bytes; ++b)
+    {
+        out.put(static_cast<char>((value >> (8 * b)) & 0xff));
+    }
+}
+
+inline std::uint64_t accumulation_buffer::get(std::istream& in, int bytes)
+{
+    std::uint64_t value = 0;
+    for (int b = 0; b < bytes; ++b)
+    {
+        value |= static_cast<std::uint64_t>(
+                     static_cast<unsigned char>(in.get()))
+                 << (8 * b);
+    }
+
+    return value;
+}
+
+inline bool accumulation_buffer::save(const std::string& path) const
+{
+    std::ofstream out(path, std::ios::binary);
+
+    out.write("RTACCUM1", 8);
+    put(out, static_cast<std::uint32_t>(width), 4);
+    put(out, static_cast<std::uint32_t>(height), 4);
+    put(out, frame.size(), 4);
+    out.write(frame.data(), static_cast<std::streamsize>(frame.size()));
+
+    put(out, ranges.size(), 4);
+    for (const auto& r : ranges)
+    {
+        put(out, r.seed, 8);
+        put(out, r.first, 8);
+        put(out, r.count, 8);
+    }
+
+    for (const double sum : sums)
+    {
+        std::uint64_t bits;
+        std::memcpy(&bits, &sum, sizeof(bits));
+        put(out, bits, 8);
+    }
+    for (const auto count : counts)
+    {
+        put(out, count, 4);
+    }
+
+    return static_cast<bool>(out);
+}
+
+inline bool accumulation_buffer::load(const std::string& path)
+{
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    const auto file_size = static_cast<std::uint64_t>(in.tellg());
+    in.seekg(0);
+
+    // The counts in the header are checked against what is left of the
+    // file before anything is sized from them.
+    const auto remaining = [&]() -> std::uint64_t {
+        const auto position = in.tellg();
+        return in && position >= 0 &&
+                       static_cast<std::uint64_t>(position) <= file_size
+                   ? file_size - static_cast<std::uint64_t>(position)
+                   : 0;
+    };
+
+    char magic[8] = {};
+    in.read(magic, 8);
+    if (!in || std::memcmp(magic, "RTACCUM1", 8) != 0)
+    {
+        return false;
+    }
+
+    width = static_cast<int>(get(in, 4));
+    height = static_cast<int>(get(in, 4));
+    const auto frame_length = get(in, 4);
+    if (!in || width <= 0 || height <= 0 || frame_length > 4096)
+    {
+        return false;
+    }
+
+    frame.resize(frame_length);
+    in.read(&frame[0], static_cast<std::streamsize>(frame.size()));
+
+    const auto range_count = get(in, 4);
+    if (!in || range_count > remaining() / 24)
+    {
+        return false;
+    }
+
+    ranges.resize(range_count);
+    for (auto& r : ranges)
+    {
+        r.seed = get(in, 8);
+        r.first = get(in, 8);
+        r.count = get(in, 8);
+    }
+
+    // Three sums of 8 bytes and a count of 4 bytes per pixel.
+    const auto pixels = static_cast<std::size_t>(width) * height;
+    if (!in || pixels > remaining() / 28)
+    {
+        return false;
+    }
+
+    sums.resize(pixels * 3);
+    counts.resize(pixels);
+    for (auto& sum : sums)
+    {
+        const std::uint64_t bits = get(in, 8);
+        std::memcpy(&sum, &bits, sizeof(sum));
+    }
+    for (auto& count : counts)
+    {
+        count = static_cast<std::uint32_t>(get(in, 4));
+    }
+
+    return static_cast<bool>(in);
+}
+
+#endif
@@ -10,19 +10,92 @@
 #ifndef RAY_TRACING_BOX_HPP
 #define RAY_TRACING_BOX_HPP
 
-#include "flip_face.hpp"
 #include "hittable.hpp"
-#include "hittable_list.hpp"
-#include "xy_rect.hpp"
-#include "xz_rect.hpp"
-#include "yz_rect.hpp"
+
+#include <utility>
+
+// Intersects the ray with the slabs of the axis-aligned box [lo, hi]. On
+// success t is the closest crossing of the box surface in (t_min, t_max),
+// entering or leaving, axis is the axis of the crossed face and side the
+// sign of its outward normal along that axis.
+inline bool box_slab_hit(const point3& origin, const vec3& direction,
+                         const point3& lo, const point3& hi, double t_min,
+                         double t_max, double& t, int& axis, double& side)
+{
+    auto t_near = -infinity, t_far = infinity;
+    int near_axis = 0, far_axis = 0;
+
+    for (int a = 0; a < 3; ++a)
+    {
+        const auto inv_d = 1.0 / direction[a];
+        auto t0 = (lo[a] - origin[a]) * inv_d;
+        auto t1 = (hi[a] - origin[a]) * inv_d;
+
+        if (inv_d < 0.0)
+        {
+            std::swap(t0, t1);
+        }
+
+        if (t0 > t_near)
+        {
+            t_near = t0;
+            near_axis = a;
+        }
+        if (t1 < t_far)
+        {
+            t_far = t1;
+            far_axis = a;
+        }
+    }
+
+    if (t_near > t_far)
+    {
+        return false;
+    }
+
+    if (t_near > t_min && t_near < t_max)
+    {
+        // Entering: the face looks against the ray.
+        t = t_near;
+        axis = near_axis;
+        side = direction[axis] < 0.0 ? 1.0 : -1.0;
+        return true;
+    }
+
+    if (t_far > t_min && t_far < t_max)
+    {
+        // Leaving from inside (media boundaries, glass).
+        t = t_far;
+        axis = far_axis;
+        side = direction[axis] > 0.0 ? 1.0 : -1.0;
+        return true;
+    }
+
+    return false;
+}
+
+// Texture coordinates of a point on a face of the box [lo, hi], laid out
+// like the rect of the same orientation: xy and xz faces use (x, y) and
+// (x, z), yz faces use (y, z).
+inline void box_face_uv(const point3& p, const point3& lo, const point3& hi,
+                        int axis, double& u, double& v, int& u_axis,
+                        int& v_axis)
+{
+    u_axis = axis == 0 ? 1 : 0;
+    v_axis = axis == 2 ? 1 : 2;
+    u = (p[u_axis] - lo[u_axis]) / (hi[u_axis] - lo[u_axis]);
+    v = (p[v_axis] - lo[v_axis]) / (hi[v_axis] - lo[v_axis]);
+}
 
 class box final : public hittable
 {
  public:
     box() = default;
-    box(const point3& p0, const point3& p1,
-        const std::shared_ptr<material>& ptr);
+    box(const point3& p0, const point3& p1, material_handle ptr)
+        : box_min(p0), box_max(p1), mp(ptr)
+    {
+        // Do nothing
+    }
 
     bool hit(const ray& r, double t0, double t1,
              hit_record& rec) const override;
@@ -35,32 +108,36 @@ class box final : public hittable
 
     point3 box_min;
     point3 box_max;
-    hittable_list sides;
+    material_handle mp{0};
 };
 
-inline box::box(const point3& p0, const point3& p1,
-                const std::shared_ptr<material>& ptr)
-    : box_min(p0), box_max(p1)
-{
-    sides.add(
-        std::make_shared<xy_rect>(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), ptr));
-    sides.add(std::make_shared<flip_face>(std::make_shared<xy_rect>(
-        p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), ptr)));
-
-    sides.add(
-        std::make_shared<xz_rect>(p0.x(), p1.x(), p0.z(), p1.z(), p1.y(), ptr));
-    sides.add(std::make_shared<flip_face>(std::make_shared<xz_rect>(
-        p0.x(), p1.x(), p0.z(), p1.z(), p0.y(), ptr)));
-
-    sides.add(
-        std::make_shared<yz_rect>(p0.y(), p1.y(), p0.z(), p1.z(), p1.x(), ptr));
-    sides.add(std::make_shared<flip_face>(std::make_shared<yz_rect>(
-        p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), ptr)));
-}
-
 inline bool box::hit(const ray& r, double t0, double t1, hit_record& rec) const
 {
-    return sides.hit(r, t0, t1, rec);
+    double t, side;
+    int axis;
+
+    if (!box_slab_hit(r.origin(), r.direction(), box_min, box_max, t0, t1, t,
+                      axis, side))
+    {
+        return false;
+    }
+
+    rec.t = t;
+    rec.p = r.at(t);
+
+    int u_axis, v_axis;
+    box_face_uv(rec.p, box_min, box_max, axis, rec.u, rec.v, u_axis, v_axis);
+    rec.dpdu = vec3{};
+    rec.dpdv = vec3{};
+    rec.dpdu[u_axis] = box_max[u_axis] - box_min[u_axis];
+    rec.dpdv[v_axis] = box_max[v_axis] - box_min[v_axis];
+
+    vec3 outward_normal;
+    outward_normal[axis] = side;
+    rec.set_face_normal(r, outward_normal);
+    rec.mat = mp;
+
+    return true;
 }
 
-#endif
\ No newline at end of file
+#endif
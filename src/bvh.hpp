@@ -11,130 +11,489 @@
 #define RAY_TRACING_BVH_HPP
 
 #include "aabb.hpp"
+#include "box.hpp"
 #include "hittable.hpp"
 #include "hittable_list.hpp"
+#include "instance.hpp"
+#include "moving_sphere.hpp"
+#include "oriented_box.hpp"
+#include "scene_arena.hpp"
+#include "sphere.hpp"
+#include "thread_pool.hpp"
+#include "xy_rect.hpp"
+#include "xz_rect.hpp"
+#include "yz_rect.hpp"
 
 #include <algorithm>
+#include <utility>
+#include <variant>
 
 class bvh_node final : public hittable
 {
+    // What the nodes of a tree share while it is built.
+    struct build_context;
+
  public:
+    // Non-owning view of a child. The built-in primitives and inner nodes
+    // are a closed set, so they are dispatched statically and their hit()
+    // can be inlined into the traversal. Any other hittable (lists, user
+    // types) goes through its virtual interface.
+    using child = std::variant<const bvh_node*, const sphere*,
+                               const moving_sphere*, const xy_rect*,
+                               const xz_rect*, const yz_rect*,
+                               const ::box*, const oriented_box*,
+                               const instance*, const hittable*>;
+
+    // Relative costs of visiting a node and intersecting an object, for the
+    // surface area heuristic.
+    static constexpr double traversal_cost = 1.2;
+    static constexpr double intersection_cost = 1.0;
+
+    // Subtrees at least this large are built as parallel tasks, and the
+    // median of spans at least parallel_split_threshold large is found by
+    // all the threads together.
+    static const std::size_t parallel_build_threshold = 4096;
+    static const std::size_t parallel_split_threshold = 64 * 1024;
+
     bvh_node() = default;
-    bvh_node(hittable_list& list, double time0, double time1)
-        : bvh_node(list.objects, 0, list.objects.size(), time0, time1)
+    // Inner nodes are allocated from arena if one is given. Large subtrees
+    // are built in parallel on pool, if it has workers; pass nullptr to
+    // build on the calling thread only.
+    bvh_node(const hittable_list& list, double time0, double time1,
+             scene_arena* arena = nullptr,
+             thread_pool* pool = &thread_pool::shared())
+        : bvh_node(list.objects, 0, list.objects.size(), time0, time1, arena,
+                   pool)
     {
         // Do nothing
     }
-    bvh_node(std::vector<std::shared_ptr<hittable>>& objects, std::size_t start,
-             std::size_t end, double time0, double time1);
+    bvh_node(const std::vector<std::shared_ptr<hittable>>& objects,
+             std::size_t start, std::size_t end, double time0, double time1,
+             scene_arena* arena = nullptr,
+             thread_pool* pool = &thread_pool::shared());
+    // The subtree over context.refs[start, end), for the constructors above.
+    bvh_node(build_context& context, std::size_t start, std::size_t end)
+    {
+        build(context, start, end);
+    }
+    // An inner node over two subtrees built elsewhere (see lbvh_builder).
+    bvh_node(std::shared_ptr<hittable> l, std::shared_ptr<hittable> r,
+             double time0, double time1);
 
     bool hit(const ray& r, double t_min, double t_max,
              hit_record& rec) const override;
     bool bounding_box(double t0, double t1, aabb& output_box) const override;
 
+    // Recomputes the bounds of the tree over [time0, time1] after objects
+    // moved, bottom-up, in time linear in its size. The topology is kept.
+    // Objects other than bvh_nodes are asked for their bounds as is, so
+    // wrappers that cache them (rotate_y) must not have moved inside.
+    void refit(double time0, double time1);
+    // Surface area heuristic cost of the tree relative to the area of its
+    // root, the expected cost of a ray that hits the root.
+    double sah_cost() const;
+    // Number of bvh_nodes in the tree, this one included.
+    std::size_t node_count() const;
+
+    static child make_child(const hittable* object);
+    static bool hit_child(const child& c, const ray& r, double t_min,
+                          double t_max, hit_record& rec);
+
+    // Bounds at start_time and end_time. Moving nodes are tested against
+    // their bounds interpolated at the time of the ray, which is much
+    // tighter than the union over the whole interval.
+    aabb box0;
+    child left_child;
+    child right_child;
+    aabb box1;
+    bool moving = false;
+    double start_time = 0.0, end_time = 0.0;
+    // Owners of the children; left_child and right_child point into them.
     std::shared_ptr<hittable> left;
     std::shared_ptr<hittable> right;
-    aabb box;
+
+ private:
+    // An object's bounds over the build interval, computed once per build.
+    struct primitive_ref
+    {
+        aabb box;
+        point3 centroid;
+        std::size_t index = 0;
+    };
+
+    struct build_context
+    {
+        const std::vector<std::shared_ptr<hittable>>& objects;
+        std::vector<primitive_ref> refs;
+        double time0, time1;
+        scene_arena* arena;
+        thread_pool* pool;
+    };
+
+    void build(build_context& context, std::size_t start, std::size_t end);
+
+    // Points left_child and right_child at left and right and bounds them
+    // over [time0, time1].
+    void link(double time0, double time1);
+    void fit(double time0, double time1);
+    // The area-weighted cost of the subtree, in absolute terms.
+    double subtree_cost() const;
+
+    double key_fraction(double time) const
+    {
+        return std::clamp((time - start_time) / (end_time - start_time), 0.0,
+                          1.0);
+    }
+
+    bool hit_box(const ray& r, double s, double t_min, double t_max) const
+    {
+        return moving ? interpolate_box(box0, box1, s).hit(r, t_min, t_max)
+                      : box0.hit(r, t_min, t_max);
+    }
 };
 
-inline bool box_compare(const std::shared_ptr<hittable> a,
-                        const std::shared_ptr<hittable> b, int axis)
+inline bvh_node::bvh_node(
+    const std::vector<std::shared_ptr<hittable>>& objects, std::size_t start,
+    std::size_t end, double time0, double time1, scene_arena* arena,
+    thread_pool* pool)
 {
-    aabb box_a;
-    aabb box_b;
+    // Bounds are asked for once per object, over the whole interval, rather
+    // than at every comparison of a sort.
+    build_context context{objects, {}, time0, time1, arena, pool};
+    context.refs.resize(end - start);
 
-    if (!a->bounding_box(0, 0, box_a) || !b->bounding_box(0, 0, box_b))
+    for (std::size_t i = start; i < end; ++i)
     {
-        std::cerr << "No bounding box in bvh_node constructor.\n";
+        primitive_ref& ref = context.refs[i - start];
+        if (!objects[i]->bounding_box(time0, time1, ref.box))
+        {
+            std::cerr << "No bounding box in bvh_node constructor.\n";
+        }
+
+        ref.centroid = 0.5 * (ref.box.min() + ref.box.max());
+        ref.index = i;
     }
 
-    return box_a.min().e[axis] < box_b.min().e[axis];
+    build(context, 0, context.refs.size());
 }
 
-inline bool box_x_compare(const std::shared_ptr<hittable> a,
-                          const std::shared_ptr<hittable> b)
+inline void bvh_node::build(build_context& context, std::size_t start,
+                            std::size_t end)
 {
-    return box_compare(a, b, 0);
+    const auto& objects = context.objects;
+    primitive_ref* const refs = context.refs.data();
+    const size_t object_span = end - start;
+
+    // Split along the axis where the centroids spread most.
+    point3 low = refs[start].centroid, high = low;
+    for (std::size_t i = start + 1; i < end; ++i)
+    {
+        for (int a = 0; a < 3; ++a)
+        {
+            low[a] = std::min(low[a], refs[i].centroid[a]);
+            high[a] = std::max(high[a], refs[i].centroid[a]);
+        }
+    }
+
+    const vec3 extent = high - low;
+    const int axis = extent.x() >= extent.y()
+                         ? (extent.x() >= extent.z() ? 0 : 2)
+                         : (extent.y() >= extent.z() ? 1 : 2);
+    const auto comparator = [axis](const primitive_ref& a,
+                                   const primitive_ref& b) {
+        return a.centroid[axis] < b.centroid[axis];
+    };
+
+    if (object_span == 1)
+    {
+        left = right = objects[refs[start].index];
+    }
+    else if (object_span == 2)
+    {
+        const bool ordered = !comparator(refs[start + 1], refs[start]);
+        left = objects[refs[ordered ? start : start + 1].index];
+        right = objects[refs[ordered ? start + 1 : start].index];
+    }
+    else
+    {
+        // A median split only needs the halves apart, not sorted. Near the
+        // root there are fewer subtrees than threads, so the split itself
+        // is what keeps them busy.
+        auto mid = start + object_span / 2;
+        if (context.pool && object_span >= parallel_split_threshold)
+        {
+            parallel_nth_element(refs + start, refs + mid, refs + end,
+                                 comparator, *context.pool);
+        }
+        else
+        {
+            std::nth_element(refs + start, refs + mid, refs + end,
+                             comparator);
+        }
+
+        const auto build_child =
+            [&](std::size_t from, std::size_t to) -> std::shared_ptr<hittable> {
+            if (context.arena)
+            {
+                return context.arena->make<bvh_node>(context, from, to);
+            }
+
+            return std::make_shared<bvh_node>(context, from, to);
+        };
+
+        // The halves are disjoint ranges of refs, so they are built
+        // independently: the left one as a task, the right one here.
+        if (context.pool && context.pool->workers() > 0 &&
+            object_span >= parallel_build_threshold)
+        {
+            task_group subtrees(*context.pool);
+            subtrees.run([&] { left = build_child(start, mid); });
+            right = build_child(mid, end);
+            subtrees.wait();
+        }
+        else
+        {
+            left = build_child(start, mid);
+            right = build_child(mid, end);
+        }
+    }
+
+    link(context.time0, context.time1);
 }
 
-inline bool box_y_compare(const std::shared_ptr<hittable> a,
-                          const std::shared_ptr<hittable> b)
+inline bvh_node::bvh_node(std::shared_ptr<hittable> l,
+                          std::shared_ptr<hittable> r, double time0,
+                          double time1)
+    : left(std::move(l)), right(std::move(r))
 {
-    return box_compare(a, b, 1);
+    link(time0, time1);
 }
 
-inline bool box_z_compare(const std::shared_ptr<hittable> a,
-                          const std::shared_ptr<hittable> b)
+inline void bvh_node::link(double time0, double time1)
 {
-    return box_compare(a, b, 2);
+    left_child = make_child(left.get());
+    right_child = make_child(right.get());
+    fit(time0, time1);
 }
 
-inline bvh_node::bvh_node(std::vector<std::shared_ptr<hittable>>& objects,
-                          std::size_t start, std::size_t end, double time0,
-                          double time1)
+inline void bvh_node::refit(double time0, double time1)
 {
-    const int axis = random_int(0, 2);
-    const auto comparator = (axis == 0)
-                                ? box_x_compare
-                                : (axis == 1) ? box_y_compare : box_z_compare;
-    const size_t object_span = end - start;
+    // Inner nodes are always bvh_nodes, which this node owns.
+    if (left_child.index() == 0)
+    {
+        static_cast<bvh_node*>(left.get())->refit(time0, time1);
+    }
+    if (right_child.index() == 0 && right != left)
+    {
+        static_cast<bvh_node*>(right.get())->refit(time0, time1);
+    }
 
-    if (object_span == 1)
+    fit(time0, time1);
+}
+
+inline double bvh_node::sah_cost() const
+{
+    aabb box;
+    bounding_box(start_time, end_time, box);
+    const auto area = box.surface_area();
+
+    return area > 0.0 ? subtree_cost() / area : 0.0;
+}
+
+inline std::size_t bvh_node::node_count() const
+{
+    std::size_t count = 1;
+
+    if (const auto inner = std::get_if<const bvh_node*>(&left_child))
     {
-        left = right = objects[start];
+        count += (*inner)->node_count();
     }
-    else if (object_span == 2)
+    if (const auto inner = std::get_if<const bvh_node*>(&right_child);
+        inner && right != left)
+    {
+        count += (*inner)->node_count();
+    }
+
+    return count;
+}
+
+inline double bvh_node::subtree_cost() const
+{
+    // A node's box is tested whenever its parent is visited, and so are the
+    // objects among its children: hit() tests them without a box of their
+    // own.
+    aabb box;
+    bounding_box(start_time, end_time, box);
+    const auto area = box.surface_area();
+    double cost = 0.0;
+
+    for (const child* c : {&left_child, &right_child})
     {
-        if (comparator(objects[start], objects[start + 1]))
+        if (const auto inner = std::get_if<const bvh_node*>(c))
         {
-            left = objects[start];
-            right = objects[start + 1];
+            cost += (*inner)->subtree_cost();
         }
         else
         {
-            left = objects[start + 1];
-            right = objects[start];
+            cost += intersection_cost * area;
         }
     }
-    else
-    {
-        std::sort(objects.begin() + start, objects.begin() + end, comparator);
 
-        auto mid = start + object_span / 2;
-        left = std::make_shared<bvh_node>(objects, start, mid, time0, time1);
-        right = std::make_shared<bvh_node>(objects, mid, end, time0, time1);
-    }
+    return traversal_cost * area + cost;
+}
+
+inline void bvh_node::fit(double time0, double time1)
+{
+    start_time = time0;
+    end_time = time1;
 
-    aabb box_left, box_right;
+    aabb left0, right0, left1, right1;
 
-    if (!left->bounding_box(time0, time1, box_left) ||
-        !right->bounding_box(time0, time1, box_right))
+    if (!left->bounding_box(time0, time0, left0) ||
+        !right->bounding_box(time0, time0, right0) ||
+        !left->bounding_box(time1, time1, left1) ||
+        !right->bounding_box(time1, time1, right1))
     {
         std::cerr << "No bounding box in bvh_node constructor.\n";
     }
 
-    box = surrounding_box(box_left, box_right);
+    box0 = surrounding_box(left0, right0);
+    box1 = surrounding_box(left1, right1);
+    moving = time1 > time0 &&
+             (box0.min() - box1.min()).length_squared() +
+                     (box0.max() - box1.max()).length_squared() >
+                 0.0;
 }
 
 inline bool bvh_node::hit(const ray& r, double t_min, double t_max,
                           hit_record& rec) const
 {
-    if (!box.hit(r, t_min, t_max))
+    // Descendants may move even if this node's bounds do not.
+    const auto s = end_time > start_time ? key_fraction(r.time()) : 0.0;
+
+    if (!hit_box(r, s, t_min, t_max))
     {
         return false;
     }
 
-    const bool hit_left = left->hit(r, t_min, t_max, rec);
-    const bool hit_right = right->hit(r, t_min, hit_left ? rec.t : t_max, rec);
+    // Depth-first, left before right. Inner nodes are expanded here instead
+    // of recursing through hit(), only the leaves are dispatched. The stack
+    // never holds more than depth + 2 entries; median splits keep the tree
+    // balanced, and lbvh_builder bounds the depth of its trees.
+    const child* stack[128];
+    int top = 0;
+    stack[top++] = &right_child;
+    stack[top++] = &left_child;
+    bool hit_anything = false;
+
+    while (top > 0)
+    {
+        const child& c = *stack[--top];
+
+        if (const auto inner = std::get_if<const bvh_node*>(&c))
+        {
+            const bvh_node* node = *inner;
+            if (node->hit_box(r, s, t_min, t_max))
+            {
+                stack[top++] = &node->right_child;
+                stack[top++] = &node->left_child;
+            }
+        }
+        else if (hit_child(c, r, t_min, t_max, rec))
+        {
+            hit_anything = true;
+            t_max = rec.t;
+        }
+    }
+
+    return hit_anything;
+}
+
+inline bool bvh_node::hit_child(const child& c, const ray& r, double t_min,
+                                double t_max, hit_record& rec)
+{
+    // A plain switch rather than std::visit: GCC turns the latter into a
+    // table of function pointers, which is the indirect call we are trying
+    // to get rid of.
+    switch (c.index())
+    {
+        case 0:
+            return std::get<0>(c)->hit(r, t_min, t_max, rec);
+        case 1:
+            return std::get<1>(c)->hit(r, t_min, t_max, rec);
+        case 2:
+            return std::get<2>(c)->hit(r, t_min, t_max, rec);
+        case 3:
+            return std::get<3>(c)->hit(r, t_min, t_max, rec);
+        case 4:
+            return std::get<4>(c)->hit(r, t_min, t_max, rec);
+        case 5:
+            return std::get<5>(c)->hit(r, t_min, t_max, rec);
+        case 6:
+            return std::get<6>(c)->hit(r, t_min, t_max, rec);
+        case 7:
+            return std::get<7>(c)->hit(r, t_min, t_max, rec);
+        case 8:
+            return std::get<8>(c)->hit(r, t_min, t_max, rec);
+        default:
+            return std::get<9>(c)->hit(r, t_min, t_max, rec);
+    }
+}
+
+inline bvh_node::child bvh_node::make_child(const hittable* object)
+{
+    // All the candidates are final, so an exact type match is all it takes.
+    if (const auto node = dynamic_cast<const bvh_node*>(object))
+    {
+        return node;
+    }
+    if (const auto s = dynamic_cast<const sphere*>(object))
+    {
+        return s;
+    }
+    if (const auto s = dynamic_cast<const moving_sphere*>(object))
+    {
+        return s;
+    }
+    if (const auto rect = dynamic_cast<const xy_rect*>(object))
+    {
+        return rect;
+    }
+    if (const auto rect = dynamic_cast<const xz_rect*>(object))
+    {
+        return rect;
+    }
+    if (const auto rect = dynamic_cast<const yz_rect*>(object))
+    {
+        return rect;
+    }
+    if (const auto b = dynamic_cast<const ::box*>(object))
+    {
+        return b;
+    }
+    if (const auto b = dynamic_cast<const oriented_box*>(object))
+    {
+        return b;
+    }
+    if (const auto inst = dynamic_cast<const instance*>(object))
+    {
+        return inst;
+    }
 
-    return hit_left || hit_right;
+    return object;
 }
 
-inline bool bvh_node::bounding_box([[maybe_unused]] double t0,
-                                   [[maybe_unused]] double t1,
+inline bool bvh_node::bounding_box(double t0, double t1,
                                    aabb& output_box) const
 {
-    output_box = box;
+    if (!moving)
+    {
+        output_box = box0;
+        return true;
+    }
+
+    output_box = surrounding_box(interpolate_box(box0, box1, key_fraction(t0)),
+                                 interpolate_box(box0, box1, key_fraction(t1)));
 
     return true;
 }
@@ -50,6 +50,25 @@ class camera
             random_double(time0, time1));
     }
 
+    // Same as get_ray(s, t), but also attaches the ray differentials for
+    // a one pixel step of (ds, dt) in image space.
+    ray get_ray(double s, double t, double ds, double dt) const
+    {
+        const vec3 rd = lens_radius * random_in_unit_disk();
+        const vec3 offset = u * rd.x() + v * rd.y();
+        const vec3 ray_origin = origin + offset;
+        const vec3 corner = lower_left_corner - origin - offset;
+
+        ray r{ray_origin, corner + s * horizontal + t * vertical,
+              random_double(time0, time1)};
+        r.set_differentials(ray_origin,
+                            corner + (s + ds) * horizontal + t * vertical,
+                            ray_origin,
+                            corner + s * horizontal + (t + dt) * vertical);
+
+        return r;
+    }
+
     vec3 origin;
     vec3 lower_left_corner;
     vec3 horizontal;
@@ -38,6 +38,21 @@ class checker_texture final : public texture
         }
     }
 
+    color filtered_value(double u, double v, const point3& p, double du,
+                         double dv) const override
+    {
+        const auto sines = sin(10 * p.x()) * sin(10 * p.y()) * sin(10 * p.z());
+
+        if (sines < 0)
+        {
+            return odd->filtered_value(u, v, p, du, dv);
+        }
+        else
+        {
+            return even->filtered_value(u, v, p, du, dv);
+        }
+    }
+
     std::shared_ptr<texture> odd;
     std::shared_ptr<texture> even;
 };
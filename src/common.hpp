@@ -10,9 +10,11 @@
 #ifndef RAY_TRACING_COMMON_HPP
 #define RAY_TRACING_COMMON_HPP
 
-#include <functional>
+#include "pcg32.hpp"
+
+#include <cmath>
+#include <cstdint>
 #include <limits>
-#include <random>
 
 // Constants
 const double infinity = std::numeric_limits<double>::infinity();
@@ -34,15 +36,26 @@ inline double ffmax(double a, double b)
     return a >= b ? a : b;
 }
 
+// The generator behind random_double. Each thread has its own, seeded the
+// same way, so single-threaded runs are reproducible.
+inline pcg32& random_generator()
+{
+    thread_local pcg32 generator;
+    return generator;
+}
+
+// Restarts the random sequence of the calling thread. Renderers seed it for
+// each sample of each pixel, so that a sample comes out the same whichever
+// process or thread renders it.
+inline void seed_random(std::uint64_t seed, std::uint64_t stream = 0)
+{
+    random_generator().seed(seed, stream);
+}
+
 inline double random_double()
 {
     // Returns a random real in [0, 1).
-    static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-    static std::mt19937 generator;
-    static std::function<double()> rand_generator =
-        std::bind(distribution, generator);
-
-    return rand_generator();
+    return random_generator().next_double();
 }
 
 inline double random_double(double min, double max)
@@ -11,19 +11,30 @@
 #define RAY_TRACING_CONSTANT_MEDIUM_HPP
 
 #include "hittable.hpp"
-#include "isotropic.hpp"
-#include "texture.hpp"
 
+#include <algorithm>
+#include <cmath>
 #include <utility>
 
+// A participating medium of uniform density filling a convex boundary.
+//
+// If lights is set, scattering distances are drawn from a one-sample MIS of
+// the usual exponential free-flight distance and of an equiangular
+// distribution around a point on the lights, which concentrates samples
+// where the light reaching the ray is strongest. The hit_record weight
+// carries the correction; it must survive a closer hit overtaking this one,
+// which hittable_list::hit sees to but a BVH does not, so scene_compiler
+// keeps such media out of the BVH. Without lights, the free-flight distance
+// is sampled as is.
 class constant_medium final : public hittable
 {
  public:
+    // phase: the scattering material of the medium, usually an isotropic.
     constant_medium(std::shared_ptr<hittable> b, double d,
-                    const std::shared_ptr<texture>& a)
-        : boundary(std::move(b)), neg_inv_density(-1 / d)
+                    material_handle phase)
+        : boundary(std::move(b)), phase_function(phase), neg_inv_density(-1 / d)
     {
-        phase_function = std::make_shared<isotropic>(a);
+        // Do nothing
     }
 
     bool hit(const ray& r, double t_min, double t_max,
@@ -34,8 +45,18 @@ class constant_medium final : public hittable
     }
 
     std::shared_ptr<hittable> boundary;
-    std::shared_ptr<material> phase_function;
+    material_handle phase_function{0};
     double neg_inv_density;
+    // The emitters to aim scattering distances at, optional.
+    std::shared_ptr<hittable> lights;
+
+ private:
+    // Picks the distance along a segment of the given length inside the
+    // medium, starting at start and going in the unit direction dir, given
+    // that the ray scatters on it. Returns the sample weight.
+    double sample_distance(const point3& start, const vec3& dir,
+                           double length, double scatter_probability,
+                           double time, double& distance) const;
 };
 
 inline bool constant_medium::hit(const ray& r, double t_min, double t_max,
@@ -83,14 +104,27 @@ inline bool constant_medium::hit(const ray& r, double t_min, double t_max,
 
     const auto ray_length = r.direction().length();
     const auto distance_inside_boundary = (rec2.t - rec1.t) * ray_length;
-    const auto hit_distance = neg_inv_density * log(random_double());
+    // 1 - random_double() is in (0, 1], so the log is finite.
+    const auto hit_distance = neg_inv_density * log(1 - random_double());
 
     if (hit_distance > distance_inside_boundary)
     {
         return false;
     }
 
-    rec.t = rec1.t + hit_distance / ray_length;
+    // The ray scatters on the segment with the probability just drawn. Only
+    // where it does is up to the sampling strategy.
+    rec.weight = 1.0;
+    double distance = hit_distance;
+    if (lights)
+    {
+        rec.weight = sample_distance(
+            r.at(rec1.t), r.direction() / ray_length, distance_inside_boundary,
+            -expm1(distance_inside_boundary / neg_inv_density), r.time(),
+            distance);
+    }
+
+    rec.t = rec1.t + distance / ray_length;
     rec.p = r.at(rec.t);
 
     if (debugging)
@@ -102,9 +136,69 @@ inline bool constant_medium::hit(const ray& r, double t_min, double t_max,
 
     rec.normal = vec3(1, 0, 0);  // arbitrary
     rec.front_face = true;       // also arbitrary
-    rec.mat_ptr = phase_function;
+    rec.medium = nullptr;
+    rec.mat = phase_function;
 
     return true;
 }
 
+inline double constant_medium::sample_distance(const point3& start,
+                                               const vec3& dir, double length,
+                                               double scatter_probability,
+                                               double time,
+                                               double& distance) const
+{
+    const auto density = -1 / neg_inv_density;
+
+    // Exponential distance truncated to the segment.
+    const auto exponential_pdf = [&](double s) {
+        return density * exp(-density * s) / scatter_probability;
+    };
+
+    // A point on the lights, seen from the middle of the segment.
+    const point3 middle = start + 0.5 * length * dir;
+    const ray to_light{middle, lights->random(middle), time};
+    hit_record light_rec;
+    if (!lights->hit(to_light, 0.001, infinity, light_rec))
+    {
+        return 1.0;
+    }
+
+    // Equiangular distribution: uniform in the angle subtended at that point
+    // by the segment. delta is the distance to the foot of the perpendicular
+    // from the light point, h the distance to the ray.
+    const vec3 offset = light_rec.p - start;
+    const auto delta = dot(offset, dir);
+    const auto h = (offset - delta * dir).length();
+    if (h < 1e-6)
+    {
+        return 1.0;
+    }
+
+    const auto theta_a = atan(-delta / h);
+    const auto theta_b = atan((length - delta) / h);
+    const auto equiangular_pdf = [&](double s) {
+        const auto x = s - delta;
+        return h / ((theta_b - theta_a) * (h * h + x * x));
+    };
+
+    if (random_double() < 0.5)
+    {
+        distance = delta + h * tan(theta_a + random_double() *
+                                                 (theta_b - theta_a));
+    }
+    else
+    {
+        distance = -log1p(-random_double() * scatter_probability) / density;
+    }
+
+    distance = std::clamp(distance, 0.0, length);
+
+    // One-sample MIS (balance heuristic) over the two strategies, relative to
+    // the exponential distance the caller assumes.
+    const auto p = exponential_pdf(distance);
+
+    return p / (0.5 * p + 0.5 * equiangular_pdf(distance));
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,149 @@
+// Copyright (c) 2020 Chris Ohk
+
+// I am making my contributions/submissions to this project solely in my
+// personal capacity and are not conveying any rights to any intellectual
+// property of any third parties.
+
+// It is based on Ray Tracing: The Rest of Your Life book.
+// References: https://raytracing.github.io
+
+#ifndef RAY_TRACING_GBUFFER_HPP
+#define RAY_TRACING_GBUFFER_HPP
+
+#include "camera.hpp"
+#include "hittable.hpp"
+
+#include <cstddef>
+#include <vector>
+
+// What shading needs to know about the first hit of a camera sample: the
+// primary ray (its origin is p - t * direction) and the hit_record fields
+// the materials read, with the texture footprint already computed.
+struct gbuffer_sample
+{
+    vec3 direction;
+    double time{0.0};
+    point3 p;
+    vec3 normal;
+    double t{0.0};
+    double u{0.0};
+    double v{0.0};
+    double dudx{0.0}, dvdx{0.0};
+    double dudy{0.0}, dvdy{0.0};
+    double weight{1.0};
+    material_handle mat{0};
+    bool front_face{false};
+    // False if the primary ray escaped the scene.
+    bool hit{false};
+
+    ray incoming() const
+    {
+        return ray{p - t * direction, direction, time};
+    }
+
+    hit_record record() const;
+};
+
+inline hit_record gbuffer_sample::record() const
+{
+    hit_record rec;
+
+    rec.p = p;
+    rec.normal = normal;
+    rec.mat = mat;
+    rec.t = t;
+    rec.u = u;
+    rec.v = v;
+    rec.front_face = front_face;
+    rec.weight = weight;
+    rec.dudx = dudx;
+    rec.dvdx = dvdx;
+    rec.dudy = dudy;
+    rec.dvdy = dvdy;
+
+    return rec;
+}
+
+// The primary hits of every sample of an image, for look-dev: once
+// captured, the image can be shaded again after each tweak of the
+// materials (through material_table::replace) or of the light intensities
+// without tracing the camera rays again. Moving the camera, the geometry or
+// the lights invalidates it.
+class gbuffer
+{
+ public:
+    gbuffer(int image_width, int image_height, int samples_per_pixel)
+        : width(image_width),
+          height(image_height),
+          samples(samples_per_pixel),
+          entries(static_cast<std::size_t>(image_width) * image_height *
+                  samples_per_pixel)
+    {
+        // Do nothing
+    }
+
+    // Traces the primary ray of every sample, jittered inside its pixel as
+    // in a regular render.
+    void capture(const camera& cam, const hittable& world);
+
+    const gbuffer_sample& at(int i, int j, int s) const
+    {
+        return entries[(static_cast<std::size_t>(j) * width + i) * samples +
+                       s];
+    }
+
+    std::size_t memory() const
+    {
+        return entries.size() * sizeof(gbuffer_sample);
+    }
+
+    int width, height, samples;
+
+ private:
+    std::vector<gbuffer_sample> entries;
+};
+
+inline void gbuffer::capture(const camera& cam, const hittable& world)
+{
+    auto entry = entries.begin();
+
+    for (int j = 0; j < height; ++j)
+    {
+        for (int i = 0; i < width; ++i)
+        {
+            for (int s = 0; s < samples; ++s, ++entry)
+            {
+                const auto u = (i + random_double()) / (width - 1);
+                const auto v = (j + random_double()) / (height - 1);
+                const ray r =
+                    cam.get_ray(u, v, 1.0 / (width - 1), 1.0 / (height - 1));
+                hit_record rec;
+
+                entry->direction = r.direction();
+                entry->time = r.time();
+                entry->hit = world.hit(r, 0.001, infinity, rec);
+                if (!entry->hit)
+                {
+                    continue;
+                }
+
+                rec.compute_differentials(r);
+
+                entry->p = rec.p;
+                entry->normal = rec.normal;
+                entry->t = rec.t;
+                entry->u = rec.u;
+                entry->v = rec.v;
+                entry->dudx = rec.dudx;
+                entry->dvdx = rec.dvdx;
+                entry->dudy = rec.dudy;
+                entry->dvdy = rec.dvdy;
+                entry->weight = rec.weight;
+                entry->mat = rec.mat;
+                entry->front_face = rec.front_face;
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,57 @@
+// Copyright (c) 2020 Chris Ohk
+
+// I am making my contributions/submissions to this project solely in my
+// personal capacity and are not conveying any rights to any intellectual
+// property of any third parties.
+
+// It is based on Ray Tracing: The Rest of Your Life book.
+// References: https://raytracing.github.io
+
+#ifndef RAY_TRACING_HENYEY_GREENSTEIN_HPP
+#define RAY_TRACING_HENYEY_GREENSTEIN_HPP
+
+#include "henyey_greenstein_pdf.hpp"
+#include "hittable.hpp"
+#include "material.hpp"
+#include "texture.hpp"
+
+#include <utility>
+
+// An anisotropic phase function for participating media. g is the mean
+// cosine of the scattering angle: clouds and haze scatter mostly forward
+// (g around 0.8), smoke is closer to isotropic.
+class henyey_greenstein final : public material
+{
+ public:
+    henyey_greenstein(std::shared_ptr<texture> a, double asymmetry)
+        : albedo(std::move(a)), g(asymmetry)
+    {
+        // Do nothing
+    }
+
+    bool scatter(const ray& r_in, const hit_record& rec,
+                 scatter_record& srec) const override
+    {
+        srec.is_specular = false;
+        srec.attenuation = albedo->value(rec.u, rec.v, rec.p);
+        srec.pdf_ptr =
+            std::make_shared<henyey_greenstein_pdf>(r_in.direction(), g);
+
+        return true;
+    }
+
+    double scattering_pdf(const ray& r_in,
+                          [[maybe_unused]] const hit_record& rec,
+                          const ray& scattered) const override
+    {
+        return henyey_greenstein_phase(
+            dot(unit_vector(r_in.direction()),
+                unit_vector(scattered.direction())),
+            g);
+    }
+
+    std::shared_ptr<texture> albedo;
+    double g;
+};
+
+#endif
@@ -0,0 +1,73 @@
+// Copyright (c) 2020 Chris Ohk
+
+// I am making my contributions/submissions to this project solely in my
+// personal capacity and are not conveying any rights to any intellectual
+// property of any third parties.
+
+// It is based on Ray Tracing: The Rest of Your Life book.
+// References: https://raytracing.github.io
+
+#ifndef RAY_TRACING_HENYEY_GREENSTEIN_PDF_HPP
+#define RAY_TRACING_HENYEY_GREENSTEIN_PDF_HPP
+
+#include "onb.hpp"
+#include "pdf.hpp"
+
+// The Henyey-Greenstein phase function, for the cosine of the angle between
+// the incoming and the scattered directions. g in (-1, 1) is the mean of
+// that cosine: 0 scatters uniformly, positive values forward and negative
+// values backward.
+inline double henyey_greenstein_phase(double cosine, double g)
+{
+    const auto denom = 1 + g * g - 2 * g * cosine;
+    return (1 - g * g) / (4 * pi * denom * sqrt(denom));
+}
+
+// Directions scattered around the incoming direction, distributed exactly as
+// the Henyey-Greenstein phase function.
+class henyey_greenstein_pdf final : public pdf
+{
+ public:
+    henyey_greenstein_pdf(const vec3& incoming, double asymmetry)
+        : g(asymmetry)
+    {
+        uvw.build_from_w(incoming);
+    }
+
+    double value(const vec3& direction) const override
+    {
+        return henyey_greenstein_phase(dot(unit_vector(direction), uvw.w()),
+                                       g);
+    }
+
+    vec3 generate() const override;
+
+    onb uvw;
+    double g;
+};
+
+inline vec3 henyey_greenstein_pdf::generate() const
+{
+    const auto r1 = random_double();
+    const auto r2 = random_double();
+
+    // Inverse of the cumulative distribution of the cosine, which turns into
+    // 0/0 as g goes to 0, where the phase function is uniform.
+    double cos_theta;
+    if (fabs(g) < 1e-3)
+    {
+        cos_theta = 1 - 2 * r1;
+    }
+    else
+    {
+        const auto s = (1 - g * g) / (1 - g + 2 * g * r1);
+        cos_theta = (1 + g * g - s * s) / (2 * g);
+    }
+
+    const auto sin_theta = sqrt(ffmax(0.0, 1 - cos_theta * cos_theta));
+    const auto phi = 2 * pi * r2;
+
+    return uvw.local(cos(phi) * sin_theta, sin(phi) * sin_theta, cos_theta);
+}
+
+#endif
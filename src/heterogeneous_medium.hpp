@@ -0,0 +1,217 @@
+// Copyright (c) 2020 Chris Ohk
+
+// I am making my contributions/submissions to this project solely in my
+// personal capacity and are not conveying any rights to any intellectual
+// property of any third parties.
+
+// It is based on Ray Tracing: The Rest of Your Life book.
+// References: https://raytracing.github.io
+
+#ifndef RAY_TRACING_HETEROGENEOUS_MEDIUM_HPP
+#define RAY_TRACING_HETEROGENEOUS_MEDIUM_HPP
+
+#include "hittable.hpp"
+#include "majorant_grid.hpp"
+#include "scalar_grid.hpp"
+
+#include <utility>
+
+// A participating medium whose density varies in space, given on a grid
+// (baked noise, a .vol file, ...) and zero outside of it. The medium fills
+// the inside of its boundary, which can be any closed surface, convex or
+// not.
+//
+// Free-flight distances are sampled with delta tracking and transmittance
+// is estimated with ratio tracking, for the light sampled from scattering
+// events in the medium (see scatter_step). Both step through a coarse
+// majorant grid, so sparse volumes cost little more than their occupied
+// cells.
+class heterogeneous_medium final : public hittable
+{
+ public:
+    // The extinction coefficient at p is density_scale times the density
+    // grid at p. phase: the scattering material, usually an isotropic.
+    heterogeneous_medium(std::shared_ptr<hittable> b, scalar_grid density,
+                         double density_scale, material_handle phase,
+                         int majorant_resolution = 16)
+        : boundary(std::move(b)),
+          grid(std::move(density)),
+          majorants(grid, majorant_resolution),
+          scale(density_scale),
+          phase_function(phase)
+    {
+        // Do nothing
+    }
+
+    bool hit(const ray& r, double t_min, double t_max,
+             hit_record& rec) const override;
+    bool bounding_box(double t0, double t1, aabb& output_box) const override
+    {
+        return boundary->bounding_box(t0, t1, output_box);
+    }
+
+    // Fraction of the light that goes through the medium along the ray
+    // between t_min and t_max. Unbiased, but noisy for thick media.
+    double transmittance(const ray& r, double t_min, double t_max) const;
+
+    std::shared_ptr<hittable> boundary;
+    scalar_grid grid;
+    majorant_grid majorants;
+    double scale;
+    material_handle phase_function{0};
+
+ private:
+    // Calls inside(t0, t1) for each interval of the ray between t_min and
+    // t_max that lies inside the boundary, in order, until it returns
+    // false. Each boundary crossing is found once.
+    template <typename Visitor>
+    void for_each_interval(const ray& r, double t_min, double t_max,
+                           Visitor&& inside) const;
+};
+
+template <typename Visitor>
+void heterogeneous_medium::for_each_interval(const ray& r, double t_min,
+                                             double t_max,
+                                             Visitor&& inside) const
+{
+    // Whether the start of the ray is inside is only known once the first
+    // crossing (an exit or an entry) is found.
+    const double step = 0.0001;
+    auto t = t_min;
+    bool known = false, is_inside = false;
+    hit_record crossing;
+
+    while (boundary->hit(r, t, t_max, crossing))
+    {
+        const bool entering = crossing.front_face;
+
+        if (!entering && (is_inside || !known))
+        {
+            if (!inside(t, crossing.t))
+            {
+                return;
+            }
+        }
+
+        known = true;
+        is_inside = entering;
+        t = crossing.t + step;
+    }
+
+    if (!known)
+    {
+        // No crossing before t_max: inside only if the next one is an exit.
+        is_inside = t_max < infinity &&
+                    boundary->hit(r, t_max, infinity, crossing) &&
+                    !crossing.front_face;
+    }
+
+    if (is_inside && t < t_max)
+    {
+        inside(t, t_max);
+    }
+}
+
+inline bool heterogeneous_medium::hit(const ray& r, double t_min,
+                                      double t_max, hit_record& rec) const
+{
+    const auto length = r.direction().length();
+    bool collided = false;
+    double collision_t = 0.0;
+
+    for_each_interval(r, t_min, t_max, [&](double t0, double t1) {
+        majorants.traverse(r, t0, t1, [&](double a, double b, double m) {
+            // Extinction bound per unit of t.
+            const auto sigma = m * scale * length;
+            if (sigma <= 0.0)
+            {
+                return true;
+            }
+
+            // Delta tracking: tentative collisions against the majorant,
+            // accepted with probability density / majorant.
+            auto t = a;
+            while (true)
+            {
+                // 1 - random_double() is in (0, 1], so the log is finite.
+                t -= log(1.0 - random_double()) / sigma;
+                if (t >= b)
+                {
+                    return true;
+                }
+
+                if (random_double() * m < grid.sample(r.at(t)))
+                {
+                    collided = true;
+                    collision_t = t;
+                    return false;
+                }
+            }
+        });
+
+        return !collided;
+    });
+
+    if (!collided)
+    {
+        return false;
+    }
+
+    rec.t = collision_t;
+    rec.p = r.at(collision_t);
+    rec.normal = vec3(1, 0, 0);  // arbitrary
+    rec.front_face = true;       // also arbitrary
+    rec.weight = 1.0;
+    rec.medium = this;
+    rec.mat = phase_function;
+
+    return true;
+}
+
+inline double heterogeneous_medium::transmittance(const ray& r, double t_min,
+                                                  double t_max) const
+{
+    const auto length = r.direction().length();
+    auto result = 1.0;
+
+    for_each_interval(r, t_min, t_max, [&](double t0, double t1) {
+        majorants.traverse(r, t0, t1, [&](double a, double b, double m) {
+            const auto sigma = m * scale * length;
+            if (sigma <= 0.0)
+            {
+                return true;
+            }
+
+            // Ratio tracking: every tentative collision attenuates by the
+            // probability of it being a null collision.
+            auto t = a;
+            while (true)
+            {
+                t -= log(1.0 - random_double()) / sigma;
+                if (t >= b)
+                {
+                    return true;
+                }
+
+                result *= 1.0 - grid.sample(r.at(t)) / m;
+
+                // Russian roulette once little light is left.
+                if (result < 0.1)
+                {
+                    if (random_double() < 0.5)
+                    {
+                        result = 0.0;
+                        return false;
+                    }
+                    result *= 2.0;
+                }
+            }
+        });
+
+        return result > 0.0;
+    });
+
+    return result;
+}
+
+#endif
@@ -13,17 +13,38 @@
 #include "aabb.hpp"
 #include "ray.hpp"
 
-class material;
+#include <cstdint>
+#include <memory>
+
+class heterogeneous_medium;
+
+// Index of a material in the scene's material_table.
+using material_handle = std::uint32_t;
 
 struct hit_record
 {
     vec3 p;
     vec3 normal;
-    std::shared_ptr<material> mat_ptr;
+    material_handle mat{0};
     double t{0.0};
     double u{0.0};
     double v{0.0};
     bool front_face{false};
+    // Factor on the light leaving the hit, for hits picked by a sampling
+    // strategy other than the one the estimator assumes (see
+    // constant_medium). Surfaces reset it to 1.
+    double weight{1.0};
+    // The medium the ray scattered in, for hits that are collisions in a
+    // heterogeneous_medium, so that light can be sampled through it.
+    // Surfaces reset it, and transforms too, as it works in its own space.
+    const heterogeneous_medium* medium{nullptr};
+
+    // Surface partial derivatives with respect to (u, v), and the texture
+    // space footprint of the ray differentials at this hit.
+    vec3 dpdu;
+    vec3 dpdv;
+    double dudx{0.0}, dvdx{0.0};
+    double dudy{0.0}, dvdy{0.0};
 
     void set_face_normal(const ray& r, const vec3& outward_normal)
     {
@@ -31,9 +52,67 @@ struct hit_record
         // dot(r.direction(), outward_normal) <= 0.0 => ray is outside the sphere
         front_face = dot(r.direction(), outward_normal) < 0;
         normal = front_face ? outward_normal : -outward_normal;
+        weight = 1.0;
+        medium = nullptr;
     }
+
+    void compute_differentials(const ray& r);
 };
 
+inline void hit_record::compute_differentials(const ray& r)
+{
+    dudx = dvdx = dudy = dvdy = 0.0;
+
+    if (!r.has_differentials)
+    {
+        return;
+    }
+
+    // Intersect the offset rays with the tangent plane at the hit point.
+    const auto d = dot(normal, p);
+    const auto denom_x = dot(normal, r.rx_direction);
+    const auto denom_y = dot(normal, r.ry_direction);
+
+    if (denom_x == 0.0 || denom_y == 0.0)
+    {
+        return;
+    }
+
+    const auto tx = -(dot(normal, r.rx_origin) - d) / denom_x;
+    const auto ty = -(dot(normal, r.ry_origin) - d) / denom_y;
+    const vec3 dpdx = r.rx_origin + tx * r.rx_direction - p;
+    const vec3 dpdy = r.ry_origin + ty * r.ry_direction - p;
+
+    // Solve the overdetermined system dp = dpdu * du + dpdv * dv on the two
+    // axes where the normal is smallest.
+    int dim0 = 1, dim1 = 2;
+    if (fabs(normal.y()) > fabs(normal.x()) &&
+        fabs(normal.y()) > fabs(normal.z()))
+    {
+        dim0 = 0;
+        dim1 = 2;
+    }
+    else if (fabs(normal.z()) > fabs(normal.x()))
+    {
+        dim0 = 0;
+        dim1 = 1;
+    }
+
+    const auto a00 = dpdu[dim0], a01 = dpdv[dim0];
+    const auto a10 = dpdu[dim1], a11 = dpdv[dim1];
+    const auto det = a00 * a11 - a01 * a10;
+
+    if (fabs(det) < 1e-12)
+    {
+        return;
+    }
+
+    dudx = (a11 * dpdx[dim0] - a01 * dpdx[dim1]) / det;
+    dvdx = (a00 * dpdx[dim1] - a10 * dpdx[dim0]) / det;
+    dudy = (a11 * dpdy[dim0] - a01 * dpdy[dim1]) / det;
+    dvdy = (a00 * dpdy[dim1] - a10 * dpdy[dim0]) / det;
+}
+
 class hittable
 {
  public:
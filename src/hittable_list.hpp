@@ -49,20 +49,30 @@ class hittable_list final : public hittable
 inline bool hittable_list::hit(const ray& r, double t_min, double t_max,
                                hit_record& rec) const
 {
-    hit_record temp_rec;
     bool hit_anything = false;
     auto closest_so_far = t_max;
+    auto weight = 1.0;
 
+    // Objects only write the record when they report a closer hit, so it
+    // can be filled in place instead of being copied for every hit. A hit
+    // that is overtaken by a closer one still carries the weight of the
+    // distance it sampled, so the weights of all hits are multiplied;
+    // otherwise which of two light-aimed media wins would bias the image.
     for (const auto& object : objects)
     {
-        if (object->hit(r, t_min, closest_so_far, temp_rec))
+        if (object->hit(r, t_min, closest_so_far, rec))
         {
             hit_anything = true;
-            closest_so_far = temp_rec.t;
-            rec = temp_rec;
+            closest_so_far = rec.t;
+            weight *= rec.weight;
         }
     }
 
+    if (hit_anything)
+    {
+        rec.weight = weight;
+    }
+
     return hit_anything;
 }
 
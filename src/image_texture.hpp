@@ -11,58 +11,42 @@
 #define RAY_TRACING_IMAGE_TEXTURE_HPP
 
 #include "texture.hpp"
+#include "texture_cache.hpp"
 
-// Disable pedantic warnings for this external library.
-#ifdef _MSC_VER
-// Microsoft Visual C++ Compiler
-#pragma warning(push, 0)
-#endif
-
-#define STB_IMAGE_IMPLEMENTATION
-#include "../external/stb_image.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
 
-// Restore warning levels.
-#ifdef _MSC_VER
-// Microsoft Visual C++ Compiler
-#pragma warning(pop)
-#endif
-
-#include <iostream>
+enum class texture_filter
+{
+    nearest,
+    bilinear,
+    trilinear
+};
 
 class image_texture final : public texture
 {
  public:
-    const static int bytes_per_pixel = 3;
-
     image_texture() = default;
-    image_texture(const char* filename)
-    {
-        auto components_per_pixel = bytes_per_pixel;
-
-        data = stbi_load(filename, &width, &height, &components_per_pixel,
-                         components_per_pixel);
-
-        if (!data)
-        {
-            std::cerr << "ERROR: Could not load texture image file '"
-                      << filename << "'.\n";
-            width = height = 0;
-        }
-
-        bytes_per_scanline = bytes_per_pixel * width;
-    }
-
-    ~image_texture()
+    image_texture(const std::string& filename,
+                  texture_filter f = texture_filter::trilinear)
+        : file(texture_cache::instance().register_file(filename)),
+          has_file(true),
+          filter(f)
     {
-        delete data;
+        // Do nothing
     }
 
     color value(double u, double v,
                 [[maybe_unused]] const point3& p) const override
     {
+        std::shared_ptr<const mipmap> keep;
+        const mipmap* mip = pyramid(keep);
+
         // If we have no texture data,
         // then return solid cyan as a debugging aid.
-        if (data == nullptr)
+        if (mip->empty())
         {
             return color(0, 1, 1);
         }
@@ -72,31 +56,74 @@ class image_texture final : public texture
         // Flip V to image coordinates
         v = 1.0 - std::clamp(v, 0.0, 1.0);
 
-        auto i = static_cast<int>(u * width);
-        auto j = static_cast<int>(v * height);
+        if (filter == texture_filter::nearest)
+        {
+            return mip->nearest(0, u, v);
+        }
+
+        return mip->bilinear(0, u, v);
+    }
 
-        // Clamp integer mapping, since actual coordinates
-        // should be less than 1.0
-        if (i >= width)
+    color filtered_value(double u, double v, const point3& p, double du,
+                         double dv) const override
+    {
+        if (filter != texture_filter::trilinear)
         {
-            i = width - 1;
+            return value(u, v, p);
         }
-        if (j >= height)
+
+        std::shared_ptr<const mipmap> keep;
+        const mipmap* mip = pyramid(keep);
+        if (mip->empty())
         {
-            j = height - 1;
+            return color(0, 1, 1);
         }
 
-        const auto color_scale = 1.0 / 255.0;
-        const auto pixel = data + j * bytes_per_scanline + i * bytes_per_pixel;
+        u = std::clamp(u, 0.0, 1.0);
+        v = 1.0 - std::clamp(v, 0.0, 1.0);
 
-        return color(color_scale * pixel[0], color_scale * pixel[1],
-                     color_scale * pixel[2]);
+        return mip->trilinear(u, v, ffmax(du, dv));
     }
 
  private:
-    unsigned char* data = nullptr;
-    int width = 0, height = 0;
-    int bytes_per_scanline = 0;
+    // Returns the pyramid of the file. While the cache is pinned this is the
+    // pointer resolved on the first lookup under that pin; otherwise the
+    // pyramid is fetched and keep holds it alive for the caller.
+    const mipmap* pyramid(std::shared_ptr<const mipmap>& keep) const
+    {
+        if (!has_file)
+        {
+            static const mipmap empty;
+            return &empty;
+        }
+
+        auto& cache = texture_cache::instance();
+        const std::uint64_t generation = cache.pin_generation();
+
+        if (generation != 0 &&
+            resolved_pin.load(std::memory_order_acquire) == generation)
+        {
+            return resolved.load(std::memory_order_relaxed);
+        }
+
+        keep = cache.fetch(file);
+
+        if (generation != 0)
+        {
+            // Every lookup under this pin resolves to the same pyramid, so
+            // racing stores write the same pointer.
+            resolved.store(keep.get(), std::memory_order_relaxed);
+            resolved_pin.store(generation, std::memory_order_release);
+        }
+
+        return keep.get();
+    }
+
+    texture_cache::handle file = 0;
+    bool has_file = false;
+    texture_filter filter = texture_filter::trilinear;
+    mutable std::atomic<const mipmap*> resolved{nullptr};
+    mutable std::atomic<std::uint64_t> resolved_pin{0};
 };
 
-#endif
\ No newline at end of file
+#endif
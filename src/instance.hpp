@@ -0,0 +1,88 @@
+// Copyright (c) 2020 Chris Ohk
+
+// I am making my contributions/submissions to this project solely in my
+// personal capacity and are not conveying any rights to any intellectual
+// property of any third parties.
+
+// It is based on Ray Tracing: The Rest of Your Life book.
+// References: https://raytracing.github.io
+
+#ifndef RAY_TRACING_INSTANCE_HPP
+#define RAY_TRACING_INSTANCE_HPP
+
+#include "hittable.hpp"
+#include "transform.hpp"
+
+#include <utility>
+
+// A placement of a shared object (usually a bottom-level bvh_node) in the
+// world. Any number of instances can refer to the same object, each one only
+// costs its transform. Putting the instances themselves in
+// a bvh_node gives a two-level hierarchy.
+class instance final : public hittable
+{
+ public:
+    instance(std::shared_ptr<hittable> p, const transform& object_to_world);
+
+    bool hit(const ray& r, double t_min, double t_max,
+             hit_record& rec) const override;
+    bool bounding_box(double t0, double t1, aabb& output_box) const override;
+
+    std::shared_ptr<hittable> ptr;
+    transform xform;
+};
+
+inline instance::instance(std::shared_ptr<hittable> p,
+                          const transform& object_to_world)
+    : ptr(std::move(p)), xform(object_to_world)
+{
+    // Do nothing
+}
+
+inline bool instance::hit(const ray& r, double t_min, double t_max,
+                          hit_record& rec) const
+{
+    // The direction is not renormalized, so t means the same thing in both
+    // spaces and the object can clip against t_max directly.
+    ray object_r{xform.apply_inverse_point(r.origin()),
+                 xform.apply_inverse_vector(r.direction()), r.time()};
+    if (r.has_differentials)
+    {
+        object_r.set_differentials(xform.apply_inverse_point(r.rx_origin),
+                                   xform.apply_inverse_vector(r.rx_direction),
+                                   xform.apply_inverse_point(r.ry_origin),
+                                   xform.apply_inverse_vector(r.ry_direction));
+    }
+
+    if (!ptr->hit(object_r, t_min, t_max, rec))
+    {
+        return false;
+    }
+
+    // The normal already faces the ray, and the inverse transpose keeps the
+    // sign of its dot product with the direction, so front_face still holds.
+    rec.p = xform.apply_point(rec.p);
+    rec.normal = unit_vector(xform.apply_normal(rec.normal));
+    rec.dpdu = xform.apply_vector(rec.dpdu);
+    rec.dpdv = xform.apply_vector(rec.dpdv);
+    // A medium tracks light in its own space (see hit_record::medium).
+    rec.medium = nullptr;
+
+    return true;
+}
+
+inline bool instance::bounding_box(double t0, double t1,
+                                   aabb& output_box) const
+{
+    // Not cached: the bounds of moving objects depend on the interval.
+    if (!ptr->bounding_box(t0, t1, output_box))
+    {
+        return false;
+    }
+
+    output_box = xform.apply_box(output_box);
+
+    return true;
+}
+
+#endif
@@ -10,6 +10,7 @@
 #ifndef RAY_TRACING_ISOTROPIC_HPP
 #define RAY_TRACING_ISOTROPIC_HPP
 
+#include "henyey_greenstein_pdf.hpp"
 #include "hittable.hpp"
 #include "material.hpp"
 #include "texture.hpp"
@@ -27,13 +28,23 @@ class isotropic final : public material
     bool scatter(const ray& r_in, const hit_record& rec,
                  scatter_record& srec) const override
     {
-        srec.is_specular = true;
-        srec.specular_ray = ray{rec.p, random_in_unit_sphere(), r_in.time()};
+        // Not specular, so that ray_color also samples the lights from
+        // inside the medium.
+        srec.is_specular = false;
         srec.attenuation = albedo->value(rec.u, rec.v, rec.p);
+        srec.pdf_ptr =
+            std::make_shared<henyey_greenstein_pdf>(r_in.direction(), 0.0);
 
         return true;
     }
 
+    double scattering_pdf([[maybe_unused]] const ray& r_in,
+                          [[maybe_unused]] const hit_record& rec,
+                          [[maybe_unused]] const ray& scattered) const override
+    {
+        return 1 / (4 * pi);
+    }
+
     std::shared_ptr<texture> albedo;
 };
 
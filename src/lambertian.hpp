@@ -30,7 +30,9 @@ class lambertian final : public material
                  scatter_record& srec) const override
     {
         srec.is_specular = false;
-        srec.attenuation = albedo->value(rec.u, rec.v, rec.p);
+        srec.attenuation = albedo->filtered_value(
+            rec.u, rec.v, rec.p, ffmax(fabs(rec.dudx), fabs(rec.dudy)),
+            ffmax(fabs(rec.dvdx), fabs(rec.dvdy)));
         srec.pdf_ptr = std::make_shared<cosine_pdf>(rec.normal);
 
         return true;
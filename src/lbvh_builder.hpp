@@ -0,0 +1,548 @@
+// Copyright (c) 2020 Chris Ohk
+
+// I am making my contributions/submissions to this project solely in my
+// personal capacity and are not conveying any rights to any intellectual
+// property of any third parties.
+
+// It is based on Ray Tracing: The Rest of Your Life book.
+// References: https://raytracing.github.io
+
+#ifndef RAY_TRACING_LBVH_BUILDER_HPP
+#define RAY_TRACING_LBVH_BUILDER_HPP
+
+#include "bvh.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Builds a bvh_node tree in linear time, for scenes that are rebuilt often
+// (Karras 2012). Object centroids are quantized on a grid over the scene and
+// keyed by the Morton code of their cell; the codes are radix sorted, and
+// the binary radix tree over them, which splits each range where its highest
+// differing bit flips, becomes the hierarchy.
+//
+// Such a tree follows the space-filling curve rather than the surface area
+// heuristic, so it traces slower than a sorted build. Treelet restructuring
+// (Karras and Aila 2013) wins much of that back: every subtree is cut into
+// a treelet of up to 7 leaves, which is rearranged into its cheapest
+// topology.
+class lbvh_builder
+{
+ public:
+    struct statistics
+    {
+        std::size_t objects = 0;
+        std::size_t treelets_restructured = 0;
+        int depth = 0;
+        // Surface area heuristic cost of the tree, relative to the area of
+        // its root, before and after treelet restructuring.
+        double sah_before = 0.0;
+        double sah_after = 0.0;
+    };
+
+    // Subtrees that would end deeper than this are built with median splits
+    // instead, so that the traversal stack of bvh_node cannot overflow.
+    static const int max_depth = 64;
+    static const int treelet_size = 7;
+
+    // code_bits: 30 (10 bits per axis) or 63 (21 bits per axis). Longer
+    // codes keep apart objects in dense clusters, for twice as many sort
+    // passes. treelet_passes: 0 for a plain LBVH.
+    explicit lbvh_builder(int code_bits = 63, int treelet_passes = 0)
+        : bits(code_bits), passes(treelet_passes)
+    {
+        // Do nothing
+    }
+
+    // Returns the root of a tree over objects, bounded over [time0, time1]
+    // and allocated from arena if one is given. A single object is returned
+    // as is, and no objects give nullptr.
+    std::shared_ptr<hittable> build(
+        const std::vector<std::shared_ptr<hittable>>& objects, double time0,
+        double time1, scene_arena* arena = nullptr);
+
+    const statistics& stats() const
+    {
+        return counters;
+    }
+
+    // Spreads the low 21 bits of x to every third bit, for Morton codes.
+    static std::uint64_t expand_bits(std::uint64_t x);
+
+ private:
+    static constexpr double traversal_cost = bvh_node::traversal_cost;
+    static constexpr double intersection_cost = bvh_node::intersection_cost;
+
+    struct node
+    {
+        aabb box;
+        // Surface area heuristic cost of the subtree.
+        double cost = 0.0;
+        // Both -1 for leaves, which refer to objects[object].
+        int child[2] = {-1, -1};
+        std::uint32_t object = 0;
+        std::uint32_t count = 1;
+        int height = 0;
+    };
+
+    // A subtree cut at up to treelet_size leaves, and the best split of each
+    // subset of its leaves.
+    struct treelet
+    {
+        int leaves[treelet_size];
+        int internals[treelet_size - 1];
+        unsigned split[1 << treelet_size];
+    };
+
+    static int leading_zeros(std::uint64_t x);
+
+    void sort_codes(std::vector<std::uint64_t>& codes,
+                    std::vector<std::uint32_t>& order) const;
+    int build_radix_tree(const std::vector<std::uint64_t>& codes);
+    void update(int i);
+    std::vector<int> children_first() const;
+    bool restructure(int i);
+    int rebuild(const treelet& t, unsigned subset, int id, int& next);
+    std::shared_ptr<hittable> emit(
+        int i, int depth, const std::vector<std::shared_ptr<hittable>>& objects,
+        double time0, double time1, scene_arena* arena) const;
+    void gather(int i, const std::vector<std::shared_ptr<hittable>>& objects,
+                std::vector<std::shared_ptr<hittable>>& out) const;
+
+    int bits;
+    int passes;
+    // Leaves first, in Morton order, then the inner nodes.
+    std::vector<node> nodes;
+    int root = 0;
+    statistics counters;
+};
+
+inline std::shared_ptr<hittable> lbvh_builder::build(
+    const std::vector<std::shared_ptr<hittable>>& objects, double time0,
+    double time1, scene_arena* arena)
+{
+    counters = statistics{};
+    counters.objects = objects.size();
+
+    if (objects.size() < 2)
+    {
+        return objects.empty() ? nullptr : objects.front();
+    }
+
+    const std::size_t n = objects.size();
+    std::vector<aabb> boxes(n);
+    aabb centroids;
+
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        if (!objects[i]->bounding_box(time0, time1, boxes[i]))
+        {
+            std::cerr << "No bounding box in lbvh_builder.\n";
+        }
+
+        const point3 c = 0.5 * (boxes[i].min() + boxes[i].max());
+        centroids = i == 0 ? aabb(c, c)
+                           : surrounding_box(centroids, aabb(c, c));
+    }
+
+    // Morton codes of the centroids, on a grid of 2^(bits / 3) cells per
+    // axis over their bounds.
+    const int axis_bits = bits / 3;
+    const auto cells = static_cast<double>(std::uint64_t{1} << axis_bits);
+    std::vector<std::uint64_t> codes(n);
+    std::vector<std::uint32_t> order(n);
+
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        const point3 c = 0.5 * (boxes[i].min() + boxes[i].max());
+        std::uint64_t code = 0;
+
+        for (int a = 0; a < 3; ++a)
+        {
+            const auto extent = centroids.max()[a] - centroids.min()[a];
+            const auto x =
+                extent > 0.0 ? (c[a] - centroids.min()[a]) / extent * cells
+                             : 0.0;
+            const auto cell = std::min(static_cast<std::uint64_t>(x),
+                                       static_cast<std::uint64_t>(cells) - 1);
+            code |= expand_bits(cell) << (2 - a);
+        }
+
+        codes[i] = code;
+        order[i] = static_cast<std::uint32_t>(i);
+    }
+
+    sort_codes(codes, order);
+
+    nodes.assign(2 * n - 1, node{});
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        nodes[i].box = boxes[order[i]];
+        nodes[i].cost = intersection_cost * nodes[i].box.surface_area();
+        nodes[i].object = order[i];
+    }
+
+    root = build_radix_tree(codes);
+
+    auto sequence = children_first();
+    for (const int i : sequence)
+    {
+        update(i);
+    }
+
+    const auto root_area = nodes[root].box.surface_area();
+    const auto relative_cost = [&] {
+        return root_area > 0.0 ? nodes[root].cost / root_area : 0.0;
+    };
+    counters.sah_before = relative_cost();
+
+    for (int pass = 0; pass < passes; ++pass)
+    {
+        // Restructuring a node only rearranges nodes below it, which come
+        // earlier in the sequence, so the sequence stays valid for the pass.
+        if (pass > 0)
+        {
+            sequence = children_first();
+        }
+
+        for (const int i : sequence)
+        {
+            update(i);
+            if (restructure(i))
+            {
+                ++counters.treelets_restructured;
+            }
+        }
+    }
+
+    counters.sah_after = relative_cost();
+    counters.depth = nodes[root].height;
+
+    return emit(root, 0, objects, time0, time1, arena);
+}
+
+inline std::uint64_t lbvh_builder::expand_bits(std::uint64_t x)
+{
+    x &= 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffffULL;
+    x = (x | x << 16) & 0x1f0000ff0000ffULL;
+    x = (x | x << 8) & 0x100f00f00f00f00fULL;
+    x = (x | x << 4) & 0x10c30c30c30c30c3ULL;
+    x = (x | x << 2) & 0x1249249249249249ULL;
+
+    return x;
+}
+
+inline int lbvh_builder::leading_zeros(std::uint64_t x)
+{
+    if (x == 0)
+    {
+        return 64;
+    }
+
+    int count = 0;
+    for (int shift = 32; shift > 0; shift /= 2)
+    {
+        if ((x >> (64 - shift)) == 0)
+        {
+            count += shift;
+            x <<= shift;
+        }
+    }
+
+    return count;
+}
+
+inline void lbvh_builder::sort_codes(std::vector<std::uint64_t>& codes,
+                                     std::vector<std::uint32_t>& order) const
+{
+    // Least significant digit first, 8 bits at a time. Each pass is stable,
+    // so equal codes keep their original order.
+    const std::size_t n = codes.size();
+    std::vector<std::uint64_t> sorted_codes(n);
+    std::vector<std::uint32_t> sorted_order(n);
+
+    for (int shift = 0; shift < bits; shift += 8)
+    {
+        std::size_t offsets[257] = {};
+        for (const auto code : codes)
+        {
+            ++offsets[((code >> shift) & 0xff) + 1];
+        }
+
+        // All the codes have the same digit: nothing would move.
+        if (std::find(offsets + 1, offsets + 257, n) != offsets + 257)
+        {
+            continue;
+        }
+
+        for (int digit = 0; digit < 256; ++digit)
+        {
+            offsets[digit + 1] += offsets[digit];
+        }
+
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            const auto slot = offsets[(codes[i] >> shift) & 0xff]++;
+            sorted_codes[slot] = codes[i];
+            sorted_order[slot] = order[i];
+        }
+
+        codes.swap(sorted_codes);
+        order.swap(sorted_order);
+    }
+}
+
+inline int lbvh_builder::build_radix_tree(
+    const std::vector<std::uint64_t>& codes)
+{
+    // Inner node k sits between leaves k and k + 1, at the length of the
+    // prefix they share (ties between equal codes are broken by position).
+    // In a binary radix tree, each node is the one with the shortest prefix
+    // within its range, so the tree is the Cartesian tree of the prefix
+    // lengths, which a stack builds in a single pass.
+    const int n = static_cast<int>(codes.size());
+    std::vector<int> prefix(n - 1);
+    std::vector<int> stack;
+
+    for (int k = 0; k + 1 < n; ++k)
+    {
+        prefix[k] =
+            codes[k] != codes[k + 1]
+                ? leading_zeros(codes[k] ^ codes[k + 1])
+                : 64 + leading_zeros(static_cast<std::uint64_t>(k ^ (k + 1)));
+
+        int last = -1;
+        while (!stack.empty() && prefix[stack.back()] > prefix[k])
+        {
+            last = stack.back();
+            stack.pop_back();
+        }
+
+        node& inner = nodes[n + k];
+        inner.child[0] = last >= 0 ? n + last : k;
+        // Replaced if an inner node turns up to the right.
+        inner.child[1] = k + 1;
+
+        if (!stack.empty())
+        {
+            nodes[n + stack.back()].child[1] = n + k;
+        }
+
+        stack.push_back(k);
+    }
+
+    return n + stack.front();
+}
+
+inline void lbvh_builder::update(int i)
+{
+    node& parent = nodes[i];
+    const node& left = nodes[parent.child[0]];
+    const node& right = nodes[parent.child[1]];
+
+    parent.box = surrounding_box(left.box, right.box);
+    parent.cost = traversal_cost * parent.box.surface_area() + left.cost +
+                  right.cost;
+    parent.count = left.count + right.count;
+    parent.height = 1 + std::max(left.height, right.height);
+}
+
+inline std::vector<int> lbvh_builder::children_first() const
+{
+    // Parents before children, reversed.
+    std::vector<int> result, stack{root};
+
+    while (!stack.empty())
+    {
+        const int i = stack.back();
+        stack.pop_back();
+
+        if (nodes[i].child[0] >= 0)
+        {
+            result.push_back(i);
+            stack.push_back(nodes[i].child[0]);
+            stack.push_back(nodes[i].child[1]);
+        }
+    }
+
+    std::reverse(result.begin(), result.end());
+
+    return result;
+}
+
+inline bool lbvh_builder::restructure(int i)
+{
+    if (nodes[i].count < static_cast<std::uint32_t>(treelet_size))
+    {
+        return false;
+    }
+
+    // Grow the treelet by opening its largest inner leaf, the one that
+    // matters most to the cost.
+    treelet t;
+    int leaf_count = 2, internal_count = 1;
+    t.leaves[0] = nodes[i].child[0];
+    t.leaves[1] = nodes[i].child[1];
+    t.internals[0] = i;
+
+    while (leaf_count < treelet_size)
+    {
+        int largest = -1;
+        double largest_area = -1.0;
+
+        for (int j = 0; j < leaf_count; ++j)
+        {
+            const node& candidate = nodes[t.leaves[j]];
+            if (candidate.child[0] >= 0 &&
+                candidate.box.surface_area() > largest_area)
+            {
+                largest = j;
+                largest_area = candidate.box.surface_area();
+            }
+        }
+
+        if (largest < 0)
+        {
+            break;
+        }
+
+        const int opened = t.leaves[largest];
+        t.internals[internal_count++] = opened;
+        t.leaves[largest] = nodes[opened].child[0];
+        t.leaves[leaf_count++] = nodes[opened].child[1];
+    }
+
+    // Cheapest tree over each subset of the leaves, from smaller subsets to
+    // larger ones. Each split is enumerated once, by its side holding the
+    // lowest leaf of the subset.
+    const unsigned full = (1u << leaf_count) - 1;
+    aabb box[1 << treelet_size];
+    double cost[1 << treelet_size];
+
+    for (unsigned s = 1; s <= full; ++s)
+    {
+        const unsigned lowest = s & (~s + 1);
+        int leaf = 0;
+        while ((lowest >> leaf) != 1)
+        {
+            ++leaf;
+        }
+
+        const node& leaf_node = nodes[t.leaves[leaf]];
+        if (s == lowest)
+        {
+            box[s] = leaf_node.box;
+            cost[s] = leaf_node.cost;
+            continue;
+        }
+
+        box[s] = surrounding_box(box[s ^ lowest], leaf_node.box);
+
+        double best = infinity;
+        for (unsigned p = (s - 1) & s; p != 0; p = (p - 1) & s)
+        {
+            if ((p & lowest) != 0 && cost[p] + cost[s ^ p] < best)
+            {
+                best = cost[p] + cost[s ^ p];
+                t.split[s] = p;
+            }
+        }
+
+        cost[s] = traversal_cost * box[s].surface_area() + best;
+    }
+
+    if (cost[full] >= nodes[i].cost * (1.0 - 1e-9))
+    {
+        return false;
+    }
+
+    int next = 1;
+    rebuild(t, full, i, next);
+
+    return true;
+}
+
+inline int lbvh_builder::rebuild(const treelet& t, unsigned subset, int id,
+                                 int& next)
+{
+    if ((subset & (subset - 1)) == 0)
+    {
+        int leaf = 0;
+        while ((subset >> leaf) != 1)
+        {
+            ++leaf;
+        }
+
+        return t.leaves[leaf];
+    }
+
+    if (id < 0)
+    {
+        id = t.internals[next++];
+    }
+
+    const unsigned left = t.split[subset];
+    nodes[id].child[0] = rebuild(t, left, -1, next);
+    nodes[id].child[1] = rebuild(t, subset ^ left, -1, next);
+    update(id);
+
+    return id;
+}
+
+inline std::shared_ptr<hittable> lbvh_builder::emit(
+    int i, int depth, const std::vector<std::shared_ptr<hittable>>& objects,
+    double time0, double time1, scene_arena* arena) const
+{
+    const node& current = nodes[i];
+    if (current.child[0] < 0)
+    {
+        return objects[current.object];
+    }
+
+    if (depth + current.height > max_depth)
+    {
+        std::vector<std::shared_ptr<hittable>> subtree;
+        gather(i, objects, subtree);
+
+        if (arena)
+        {
+            return arena->make<bvh_node>(subtree, 0, subtree.size(), time0,
+                                         time1, arena);
+        }
+
+        return std::make_shared<bvh_node>(subtree, 0, subtree.size(), time0,
+                                          time1);
+    }
+
+    auto left = emit(current.child[0], depth + 1, objects, time0, time1, arena);
+    auto right =
+        emit(current.child[1], depth + 1, objects, time0, time1, arena);
+
+    if (arena)
+    {
+        return arena->make<bvh_node>(std::move(left), std::move(right), time0,
+                                     time1);
+    }
+
+    return std::make_shared<bvh_node>(std::move(left), std::move(right), time0,
+                                      time1);
+}
+
+inline void lbvh_builder::gather(
+    int i, const std::vector<std::shared_ptr<hittable>>& objects,
+    std::vector<std::shared_ptr<hittable>>& out) const
+{
+    const node& current = nodes[i];
+    if (current.child[0] < 0)
+    {
+        out.push_back(objects[current.object]);
+        return;
+    }
+
+    gather(current.child[0], objects, out);
+    gather(current.child[1], objects, out);
+}
+
+#endif
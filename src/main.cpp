@@ -7,6 +7,7 @@
 // It is based on Ray Tracing: The Rest of Your Life book.
 // References: https://raytracing.github.io
 
+#include "accumulation_buffer.hpp"
 #include "box.hpp"
 #include "bvh.hpp"
 #include "camera.hpp"
@@ -17,75 +18,221 @@
 #include "dielectric.hpp"
 #include "diffuse_light.hpp"
 #include "flip_face.hpp"
+#include "gbuffer.hpp"
+#include "henyey_greenstein.hpp"
+#include "heterogeneous_medium.hpp"
 #include "hittable_list.hpp"
 #include "hittable_pdf.hpp"
 #include "image_texture.hpp"
+#include "instance.hpp"
+#include "isotropic.hpp"
 #include "lambertian.hpp"
 #include "metal.hpp"
 #include "mixture_pdf.hpp"
 #include "moving_sphere.hpp"
 #include "noise_texture.hpp"
+#include "ray_queue.hpp"
+#if !defined(_WIN32)
+#include "render_server.hpp"
+#include "tcp_connection.hpp"
+#include "tile_coordinator.hpp"
+#endif
 #include "rotate_y.hpp"
+#include "scene.hpp"
+#include "scene_animator.hpp"
+#include "scene_compiler.hpp"
 #include "solid_color.hpp"
 #include "sphere.hpp"
+#include "transform.hpp"
 #include "translate.hpp"
 #include "xy_rect.hpp"
 #include "xz_rect.hpp"
 #include "yz_rect.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+#endif
 
 vec3 ray_color(const ray& r, const color& background, const hittable& world,
-               const std::shared_ptr<hittable>& lights, int depth)
+               const material_table& materials,
+               const std::shared_ptr<hittable>& lights, int depth,
+               double emission_weight = 1.0);
+
+// Next event estimation from a scattering event rec in a heterogeneous
+// medium: the light reaching rec.p along a direction drawn from lights_pdf,
+// through the medium's ratio-tracked transmittance and whatever else is in
+// the way, scattered by the phase function. Weighted by the balance
+// heuristic against continuation, the pdf the path goes on with.
+color sample_medium_light(const ray& r, const hit_record& rec,
+                          const hittable& world, const color& background,
+                          const material_table& materials,
+                          const pdf& lights_pdf, const pdf& continuation,
+                          const color& attenuation)
 {
-    hit_record rec;
-
-    // If we've exceeded the ray bounce limit, no more light is gathered.
-    if (depth <= 0)
+    const ray shadow{rec.p, lights_pdf.generate(), r.time()};
+    const auto light_pdf = lights_pdf.value(shadow.direction());
+    if (light_pdf <= 0.0)
     {
         return color{0, 0, 0};
     }
 
-    // If the ray hits nothing, return the background color.
-    if (!world.hit(r, 0.001, infinity, rec))
+    // The first hit that is not a collision in the medium itself, whose
+    // share of the light is the transmittance instead. Collisions in other
+    // media block the light.
+    hit_record hit;
+    auto t = 0.001;
+    bool found;
+    while ((found = world.hit(shadow, t, infinity, hit)) &&
+           hit.medium == rec.medium)
     {
-        return background;
+        t = hit.t;
     }
 
+    const color light =
+        found ? materials[hit.mat].emitted(shadow, hit, hit.u, hit.v, hit.p)
+              : background;
+    if (light.length_squared() <= 0.0)
+    {
+        return color{0, 0, 0};
+    }
+
+    const auto transmittance =
+        rec.medium->transmittance(shadow, 0.001, found ? hit.t : infinity);
+
+    return rec.weight * attenuation *
+           materials[rec.mat].scattering_pdf(r, rec, shadow) * transmittance *
+           light / (light_pdf + continuation.value(shadow.direction()));
+}
+
+// One bounce of a path at the hit rec of the ray r: sets emitted to the
+// light the hit adds to the path and, if the material scatters, next to the
+// ray the path goes on with and factor to the weight of the light next
+// brings back. emission_weight is, on entry, the weight of the light the hit
+// emits and, on return, that of the light next reaches, which is less than 1
+// when light was also sampled here. Returns whether the material scatters.
+bool scatter_step(const ray& r, const hit_record& rec, const hittable& world,
+                  const color& background, const material_table& materials,
+                  const std::shared_ptr<hittable>& lights,
+                  double& emission_weight, color& emitted, ray& next,
+                  color& factor)
+{
+    const material& mat = materials[rec.mat];
     scatter_record srec;
-    const color emitted = rec.mat_ptr->emitted(r, rec, rec.u, rec.v, rec.p);
-    if (!rec.mat_ptr->scatter(r, rec, srec))
+    emitted = emission_weight * mat.emitted(r, rec, rec.u, rec.v, rec.p);
+    emission_weight = 1.0;
+    if (!mat.scatter(r, rec, srec))
     {
-        return emitted;
+        return false;
     }
 
     if (srec.is_specular)
     {
-        return srec.attenuation * ray_color(srec.specular_ray, background,
-                                            world, lights, depth - 1);
+        emitted = color{0, 0, 0};
+        next = srec.specular_ray;
+        factor = rec.weight * srec.attenuation;
+        return true;
     }
 
     const auto light_ptr = std::make_shared<hittable_pdf>(lights, rec.p);
     const mixture_pdf p{light_ptr, srec.pdf_ptr};
 
-    const ray scattered = ray{rec.p, p.generate(), r.time()};
-    const auto pdf_val = p.value(scattered.direction());
+    next = ray{rec.p, p.generate(), r.time()};
+    const auto pdf_val = p.value(next.direction());
+    factor = rec.weight * srec.attenuation *
+             mat.scattering_pdf(r, rec, next) / pdf_val;
 
-    return emitted +
-           srec.attenuation * rec.mat_ptr->scattering_pdf(r, rec, scattered) *
-               ray_color(scattered, background, world, lights, depth - 1) /
-               pdf_val;
+    // In a heterogeneous medium the path can rarely get through to the
+    // lights, so light is also sampled through its transmittance, and the
+    // light that next reaches directly is weighted to match.
+    if (rec.medium)
+    {
+        emitted += sample_medium_light(r, rec, world, background, materials,
+                                       *light_ptr, p, srec.attenuation);
+        emission_weight =
+            pdf_val / (pdf_val + light_ptr->value(next.direction()));
+    }
+
+    return true;
 }
 
-hittable_list random_scene()
+// The light leaving the hit rec of the ray r, which came from tracing r in
+// world (or from a gbuffer). emission_weight is that of the light the hit
+// emits (see scatter_step).
+vec3 shade(const ray& r, const hit_record& rec, const color& background,
+           const hittable& world, const material_table& materials,
+           const std::shared_ptr<hittable>& lights, int depth,
+           double emission_weight = 1.0)
 {
-    hittable_list world;
+    color emitted, factor;
+    ray next;
+    if (!scatter_step(r, rec, world, background, materials, lights,
+                      emission_weight, emitted, next, factor))
+    {
+        return emitted;
+    }
+
+    return emitted + factor * ray_color(next, background, world, materials,
+                                        lights, depth - 1, emission_weight);
+}
 
-    auto checker = std::make_shared<checker_texture>(
-        std::make_shared<solid_color>(0.2, 0.3, 0.1),
-        std::make_shared<solid_color>(0.9, 0.9, 0.9));
-    world.add(std::make_shared<sphere>(point3{0, -1000, 0}, 1000,
-                                       std::make_shared<lambertian>(checker)));
+vec3 ray_color(const ray& r, const color& background, const hittable& world,
+               const material_table& materials,
+               const std::shared_ptr<hittable>& lights, int depth,
+               double emission_weight)
+{
+    hit_record rec;
+
+    // If we've exceeded the ray bounce limit, no more light is gathered.
+    if (depth <= 0)
+    {
+        return color{0, 0, 0};
+    }
+
+    // If the ray hits nothing, return the background color.
+    if (!world.hit(r, 0.001, infinity, rec))
+    {
+        return emission_weight * background;
+    }
+
+    rec.compute_differentials(r);
+
+    return shade(r, rec, background, world, materials, lights, depth,
+                 emission_weight);
+}
+
+// motion scales how far the diffuse spheres move during the shutter.
+scene random_scene(double motion = 1.0)
+{
+    scene s;
+    // Hundreds of moving spheres: cheap to rebuild per frame.
+    s.bvh_method = bvh_build_method::morton_treelets;
+
+    auto checker = s.arena.make<checker_texture>(
+        s.arena.make<solid_color>(0.2, 0.3, 0.1),
+        s.arena.make<solid_color>(0.9, 0.9, 0.9));
+    s.world.add(s.arena.make<sphere>(
+        point3{0, -1000, 0}, 1000,
+        s.materials.add(s.arena.make<lambertian>(checker))));
 
     for (int a = -10; a < 10; ++a)
     {
@@ -101,134 +248,141 @@ hittable_list random_scene()
                 {
                     // diffuse
                     auto albedo = vec3::random() * vec3::random();
-                    world.add(std::make_shared<moving_sphere>(
-                        center, center + vec3{0, random_double(0, .5), 0}, 0.0,
-                        1.0, 0.2,
-                        std::make_shared<lambertian>(
-                            std::make_shared<solid_color>(albedo))));
+                    s.world.add(s.arena.make<moving_sphere>(
+                        center,
+                        center + vec3{0, motion * random_double(0, .5), 0},
+                        0.0, 1.0, 0.2,
+                        s.materials.add(s.arena.make<lambertian>(
+                            s.arena.make<solid_color>(albedo)))));
                 }
                 else if (choose_mat < 0.95)
                 {
                     // metal
                     auto albedo = vec3::random(.5, 1);
                     auto fuzz = random_double(0, .5);
-                    world.add(std::make_shared<sphere>(
-                        center, 0.2, std::make_shared<metal>(albedo, fuzz)));
+                    s.world.add(s.arena.make<sphere>(
+                        center, 0.2,
+                        s.materials.add(s.arena.make<metal>(albedo, fuzz))));
                 }
                 else
                 {
                     // glass
-                    world.add(std::make_shared<sphere>(
-                        center, 0.2, std::make_shared<dielectric>(1.5)));
+                    s.world.add(s.arena.make<sphere>(
+                        center, 0.2,
+                        s.materials.add(s.arena.make<dielectric>(1.5))));
                 }
             }
         }
     }
 
-    world.add(std::make_shared<sphere>(vec3{0, 1, 0}, 1.0,
-                                       std::make_shared<dielectric>(1.5)));
-    world.add(std::make_shared<sphere>(
+    s.world.add(s.arena.make<sphere>(
+        vec3{0, 1, 0}, 1.0, s.materials.add(s.arena.make<dielectric>(1.5))));
+    s.world.add(s.arena.make<sphere>(
         vec3{-4, 1, 0}, 1.0,
-        std::make_shared<lambertian>(
-            std::make_shared<solid_color>(0.4, 0.2, 0.1))));
-    world.add(std::make_shared<sphere>(
-        vec3{4, 1, 0}, 1.0, std::make_shared<metal>(vec3{0.7, 0.6, 0.5}, 0.0)));
+        s.materials.add(s.arena.make<lambertian>(
+            s.arena.make<solid_color>(0.4, 0.2, 0.1)))));
+    s.world.add(s.arena.make<sphere>(
+        vec3{4, 1, 0}, 1.0,
+        s.materials.add(s.arena.make<metal>(vec3{0.7, 0.6, 0.5}, 0.0))));
 
-    return world;
+    return s;
 }
 
-hittable_list two_spheres()
+scene two_spheres()
 {
-    hittable_list objects;
+    scene s;
 
-    auto checker = std::make_shared<checker_texture>(
-        std::make_shared<solid_color>(0.2, 0.3, 0.1),
-        std::make_shared<solid_color>(0.9, 0.9, 0.9));
+    auto checker = s.materials.add(
+        s.arena.make<lambertian>(s.arena.make<checker_texture>(
+            s.arena.make<solid_color>(0.2, 0.3, 0.1),
+            s.arena.make<solid_color>(0.9, 0.9, 0.9))));
 
-    objects.add(std::make_shared<sphere>(
-        point3(0, -10, 0), 10, std::make_shared<lambertian>(checker)));
-    objects.add(std::make_shared<sphere>(
-        point3(0, 10, 0), 10, std::make_shared<lambertian>(checker)));
+    s.world.add(s.arena.make<sphere>(point3(0, -10, 0), 10, checker));
+    s.world.add(s.arena.make<sphere>(point3(0, 10, 0), 10, checker));
 
-    return objects;
+    return s;
 }
 
-hittable_list two_perlin_spheres()
+scene two_perlin_spheres()
 {
-    hittable_list objects;
+    scene s;
 
-    const auto pertext = std::make_shared<noise_texture>(4.0);
+    // Both spheres are static, so bake the turbulence around the small one.
+    // At 128^3 the albedo is within 0.02 of the unbaked noise on average.
+    const auto noise = s.arena.make<noise_texture>(4.0);
+    noise->bake(aabb(point3(-2, 0, -2), point3(2, 4, 2)), 128);
+    const auto pertext = s.materials.add(s.arena.make<lambertian>(noise));
 
-    objects.add(std::make_shared<sphere>(
-        point3(0, -1000, 0), 1000, std::make_shared<lambertian>(pertext)));
-    objects.add(std::make_shared<sphere>(
-        point3(0, 2, 0), 2, std::make_shared<lambertian>(pertext)));
+    s.world.add(s.arena.make<sphere>(point3(0, -1000, 0), 1000, pertext));
+    s.world.add(s.arena.make<sphere>(point3(0, 2, 0), 2, pertext));
 
-    return objects;
+    return s;
 }
 
-hittable_list earth()
+scene earth()
 {
-    auto earth_texture = std::make_shared<image_texture>("earthmap.jpg");
-    auto earth_surface = std::make_shared<lambertian>(earth_texture);
-    const auto globe =
-        std::make_shared<sphere>(point3(0, 0, 0), 2, earth_surface);
+    scene s;
 
-    return hittable_list(globe);
+    auto earth_texture = s.arena.make<image_texture>("earthmap.jpg");
+    auto earth_surface =
+        s.materials.add(s.arena.make<lambertian>(earth_texture));
+    s.world.add(s.arena.make<sphere>(point3(0, 0, 0), 2, earth_surface));
+
+    return s;
 }
 
-hittable_list simple_light()
+scene simple_light()
 {
-    hittable_list objects;
+    scene s;
 
-    auto pertext = std::make_shared<noise_texture>(4);
-    objects.add(std::make_shared<sphere>(
-        point3(0, -1000, 0), 1000, std::make_shared<lambertian>(pertext)));
-    objects.add(std::make_shared<sphere>(
-        point3(0, 2, 0), 2, std::make_shared<lambertian>(pertext)));
+    auto pertext = s.materials.add(
+        s.arena.make<lambertian>(s.arena.make<noise_texture>(4)));
+    s.world.add(s.arena.make<sphere>(point3(0, -1000, 0), 1000, pertext));
+    s.world.add(s.arena.make<sphere>(point3(0, 2, 0), 2, pertext));
 
-    auto difflight =
-        std::make_shared<diffuse_light>(std::make_shared<solid_color>(4, 4, 4));
-    objects.add(std::make_shared<sphere>(point3(0, 7, 0), 2, difflight));
-    objects.add(std::make_shared<xy_rect>(3, 5, 1, 3, -2, difflight));
+    auto difflight = s.materials.add(s.arena.make<diffuse_light>(
+        s.arena.make<solid_color>(4, 4, 4)));
+    s.world.add(s.arena.make<sphere>(point3(0, 7, 0), 2, difflight));
+    s.world.add(s.arena.make<xy_rect>(3, 5, 1, 3, -2, difflight));
 
-    return objects;
+    return s;
 }
 
-hittable_list cornell_box(camera& cam, double aspect)
+scene cornell_box(camera& cam, double aspect)
 {
-    hittable_list world;
-
-    auto red = std::make_shared<lambertian>(
-        std::make_shared<solid_color>(.65, .05, .05));
-    auto white = std::make_shared<lambertian>(
-        std::make_shared<solid_color>(.73, .73, .73));
-    auto green = std::make_shared<lambertian>(
-        std::make_shared<solid_color>(.12, .45, .15));
-    auto light = std::make_shared<diffuse_light>(
-        std::make_shared<solid_color>(15, 15, 15));
-
-    world.add(std::make_shared<flip_face>(
-        std::make_shared<yz_rect>(0, 555, 0, 555, 555, green)));
-    world.add(std::make_shared<yz_rect>(0, 555, 0, 555, 0, red));
-    world.add(std::make_shared<flip_face>(
-        std::make_shared<xz_rect>(213, 343, 227, 332, 554, light)));
-    world.add(std::make_shared<flip_face>(
-        std::make_shared<xz_rect>(0, 555, 0, 555, 555, white)));
-    world.add(std::make_shared<xz_rect>(0, 555, 0, 555, 0, white));
-    world.add(std::make_shared<flip_face>(
-        std::make_shared<xy_rect>(0, 555, 0, 555, 555, white)));
-
-    std::shared_ptr<material> aluminum =
-        std::make_shared<metal>(color(0.8, 0.85, 0.88), 0.0);
+    scene s;
+
+    auto red = s.materials.add(s.arena.make<lambertian>(
+        s.arena.make<solid_color>(.65, .05, .05)));
+    auto white = s.materials.add(s.arena.make<lambertian>(
+        s.arena.make<solid_color>(.73, .73, .73)));
+    auto green = s.materials.add(s.arena.make<lambertian>(
+        s.arena.make<solid_color>(.12, .45, .15)));
+    auto light = s.materials.add(s.arena.make<diffuse_light>(
+        s.arena.make<solid_color>(15, 15, 15)));
+
+    s.world.add(s.arena.make<flip_face>(
+        s.arena.make<yz_rect>(0, 555, 0, 555, 555, green)));
+    s.world.add(s.arena.make<yz_rect>(0, 555, 0, 555, 0, red));
+    s.world.add(s.arena.make<flip_face>(
+        s.arena.make<xz_rect>(213, 343, 227, 332, 554, light)));
+    s.world.add(s.arena.make<flip_face>(
+        s.arena.make<xz_rect>(0, 555, 0, 555, 555, white)));
+    s.world.add(s.arena.make<xz_rect>(0, 555, 0, 555, 0, white));
+    s.world.add(s.arena.make<flip_face>(
+        s.arena.make<xy_rect>(0, 555, 0, 555, 555, white)));
+
+    const material_handle aluminum =
+        s.materials.add(s.arena.make<metal>(color(0.8, 0.85, 0.88), 0.0));
     std::shared_ptr<hittable> box1 =
-        std::make_shared<box>(point3(0, 0, 0), point3(165, 330, 165), aluminum);
-    box1 = std::make_shared<rotate_y>(box1, 15);
-    box1 = std::make_shared<translate>(box1, vec3(265, 0, 295));
-    world.add(std::move(box1));
+        s.arena.make<box>(point3(0, 0, 0), point3(165, 330, 165), aluminum);
+    box1 = s.arena.make<rotate_y>(box1, 15);
+    box1 = s.arena.make<translate>(box1, vec3(265, 0, 295));
+    s.world.add(std::move(box1));
 
-    std::shared_ptr<material> glass = std::make_shared<dielectric>(1.5);
-    world.add(std::make_shared<sphere>(point3(190, 90, 190), 90, glass));
+    const material_handle glass =
+        s.materials.add(s.arena.make<dielectric>(1.5));
+    s.world.add(s.arena.make<sphere>(point3(190, 90, 190), 90, glass));
 
     const point3 lookfrom(278, 278, -800);
     const point3 lookat(278, 278, 0);
@@ -242,55 +396,168 @@ hittable_list cornell_box(camera& cam, double aspect)
     cam = camera(lookfrom, lookat, vup, vfov, aspect, aperture, dist_to_focus,
                  t0, t1);
 
-    return world;
+    return s;
 }
 
-hittable_list cornell_smoke()
+scene cornell_smoke()
 {
-    hittable_list objects;
-
-    auto red = std::make_shared<lambertian>(
-        std::make_shared<solid_color>(.65, .05, .05));
-    auto white = std::make_shared<lambertian>(
-        std::make_shared<solid_color>(.73, .73, .73));
-    auto green = std::make_shared<lambertian>(
-        std::make_shared<solid_color>(.12, .45, .15));
-    auto light =
-        std::make_shared<diffuse_light>(std::make_shared<solid_color>(7, 7, 7));
-
-    objects.add(std::make_shared<flip_face>(
-        std::make_shared<yz_rect>(0, 555, 0, 555, 555, green)));
-    objects.add(std::make_shared<yz_rect>(0, 555, 0, 555, 0, red));
-    objects.add(std::make_shared<xz_rect>(113, 443, 127, 432, 554, light));
-    objects.add(std::make_shared<flip_face>(
-        std::make_shared<xz_rect>(0, 555, 0, 555, 555, white)));
-    objects.add(std::make_shared<xz_rect>(0, 555, 0, 555, 0, white));
-    objects.add(std::make_shared<flip_face>(
-        std::make_shared<xy_rect>(0, 555, 0, 555, 555, white)));
+    scene s;
+
+    auto red = s.materials.add(s.arena.make<lambertian>(
+        s.arena.make<solid_color>(.65, .05, .05)));
+    auto white = s.materials.add(s.arena.make<lambertian>(
+        s.arena.make<solid_color>(.73, .73, .73)));
+    auto green = s.materials.add(s.arena.make<lambertian>(
+        s.arena.make<solid_color>(.12, .45, .15)));
+    auto light = s.materials.add(
+        s.arena.make<diffuse_light>(s.arena.make<solid_color>(7, 7, 7)));
+
+    s.world.add(s.arena.make<flip_face>(
+        s.arena.make<yz_rect>(0, 555, 0, 555, 555, green)));
+    s.world.add(s.arena.make<yz_rect>(0, 555, 0, 555, 0, red));
+    auto light_rect = s.arena.make<xz_rect>(113, 443, 127, 432, 554, light);
+    s.world.add(s.arena.make<flip_face>(light_rect));
+    s.world.add(s.arena.make<flip_face>(
+        s.arena.make<xz_rect>(0, 555, 0, 555, 555, white)));
+    s.world.add(s.arena.make<xz_rect>(0, 555, 0, 555, 0, white));
+    s.world.add(s.arena.make<flip_face>(
+        s.arena.make<xy_rect>(0, 555, 0, 555, 555, white)));
 
     std::shared_ptr<hittable> box1 =
-        std::make_shared<box>(point3(0, 0, 0), point3(165, 330, 165), white);
-    box1 = std::make_shared<rotate_y>(box1, 15);
-    box1 = std::make_shared<translate>(box1, vec3(265, 0, 295));
+        s.arena.make<box>(point3(0, 0, 0), point3(165, 330, 165), white);
+    box1 = s.arena.make<rotate_y>(box1, 15);
+    box1 = s.arena.make<translate>(box1, vec3(265, 0, 295));
 
     std::shared_ptr<hittable> box2 =
-        std::make_shared<box>(point3(0, 0, 0), point3(165, 165, 165), white);
-    box2 = std::make_shared<rotate_y>(box2, -18);
-    box2 = std::make_shared<translate>(box2, vec3(130, 0, 65));
+        s.arena.make<box>(point3(0, 0, 0), point3(165, 165, 165), white);
+    box2 = s.arena.make<rotate_y>(box2, -18);
+    box2 = s.arena.make<translate>(box2, vec3(130, 0, 65));
+
+    auto smoke = s.arena.make<constant_medium>(
+        box1, 0.01,
+        s.materials.add(s.arena.make<isotropic>(
+            s.arena.make<solid_color>(0, 0, 0))));
+    auto fog = s.arena.make<constant_medium>(
+        box2, 0.01,
+        s.materials.add(s.arena.make<isotropic>(
+            s.arena.make<solid_color>(1, 1, 1))));
+    smoke->lights = fog->lights = light_rect;
+    s.world.add(smoke);
+    s.world.add(fog);
+
+    return s;
+}
 
-    objects.add(std::make_shared<constant_medium>(
-        box1, 0.01, std::make_shared<solid_color>(0, 0, 0)));
-    objects.add(std::make_shared<constant_medium>(
-        box2, 0.01, std::make_shared<solid_color>(1, 1, 1)));
+scene cornell_cloud()
+{
+    scene s;
+
+    auto red = s.materials.add(s.arena.make<lambertian>(
+        s.arena.make<solid_color>(.65, .05, .05)));
+    auto white = s.materials.add(s.arena.make<lambertian>(
+        s.arena.make<solid_color>(.73, .73, .73)));
+    auto green = s.materials.add(s.arena.make<lambertian>(
+        s.arena.make<solid_color>(.12, .45, .15)));
+    auto light = s.materials.add(s.arena.make<diffuse_light>(
+        s.arena.make<solid_color>(15, 15, 15)));
+
+    s.world.add(s.arena.make<flip_face>(
+        s.arena.make<yz_rect>(0, 555, 0, 555, 555, green)));
+    s.world.add(s.arena.make<yz_rect>(0, 555, 0, 555, 0, red));
+    s.world.add(s.arena.make<flip_face>(
+        s.arena.make<xz_rect>(213, 343, 227, 332, 554, light)));
+    s.world.add(s.arena.make<flip_face>(
+        s.arena.make<xz_rect>(0, 555, 0, 555, 555, white)));
+    s.world.add(s.arena.make<xz_rect>(0, 555, 0, 555, 0, white));
+    s.world.add(s.arena.make<flip_face>(
+        s.arena.make<xy_rect>(0, 555, 0, 555, 555, white)));
+
+    // A cloud.vol file in the working directory gives the density, placed
+    // and bounded by the box in its header. Without one, the cloud is a ball
+    // of turbulence fading out towards its surface.
+    scalar_grid density = scalar_grid::load_vol("cloud.vol");
+    std::shared_ptr<hittable> boundary;
+
+    if (!density.empty())
+    {
+        boundary = s.arena.make<box>(density.bounds.min(),
+                                     density.bounds.max(), white);
+    }
+    else
+    {
+        const point3 center(278, 250, 278);
+        const auto radius = 180.0;
+        const int resolution = 64;
+        const perlin noise;
+        const vec3 half_extent(radius, radius, radius);
+        density = scalar_grid(aabb(center - half_extent, center + half_extent),
+                              resolution, resolution, resolution);
+
+        for (int k = 0; k < resolution; ++k)
+        {
+            for (int j = 0; j < resolution; ++j)
+            {
+                for (int i = 0; i < resolution; ++i)
+                {
+                    const point3 p = density.vertex(i, j, k);
+                    const auto falloff = 1 - (p - center).length() / radius;
+                    const auto d = 2 * noise.turb(0.015 * p) + falloff - 0.6;
 
-    return objects;
+                    density.at(i, j, k) = static_cast<float>(ffmax(d, 0.0));
+                }
+            }
+        }
+
+        boundary = s.arena.make<sphere>(center, radius, white);
+    }
+
+    s.world.add(s.arena.make<heterogeneous_medium>(
+        boundary, std::move(density), 0.05,
+        s.materials.add(s.arena.make<henyey_greenstein>(
+            s.arena.make<solid_color>(0.9, 0.9, 0.9), 0.6))));
+
+    return s;
+}
+
+// The Cornell box with a thousand small spheres flying through it in all
+// directions, to animate.
+scene cornell_swarm()
+{
+    camera unused;
+    scene s = cornell_box(unused, 1.0);
+    // Rebuilt whenever refitting has let the tree get too loose.
+    s.bvh_method = bvh_build_method::morton;
+
+    material_handle colors[8];
+    for (auto& c : colors)
+    {
+        c = s.materials.add(s.arena.make<lambertian>(
+            s.arena.make<solid_color>(vec3::random(0.2, 0.9))));
+    }
+
+    for (int i = 0; i < 1000; ++i)
+    {
+        const point3 center = vec3::random(50, 505);
+        // 60 units per unit of time.
+        const vec3 velocity = 60.0 * random_unit_vector();
+        s.world.add(s.arena.make<moving_sphere>(center, center + velocity,
+                                                0.0, 1.0, 6.0,
+                                                colors[i % 8]));
+    }
+
+    return s;
 }
 
-hittable_list final_scene()
+scene final_scene()
 {
+    scene s;
+    // Over a thousand primitives, only one of them moving: the compressed
+    // layout traces faster.
+    s.bvh_format = bvh_node_format::compressed_wide;
+
     hittable_list boxes1;
-    auto ground = std::make_shared<lambertian>(
-        std::make_shared<solid_color>(0.48, 0.83, 0.53));
+    auto ground = s.materials.add(s.arena.make<lambertian>(
+        s.arena.make<solid_color>(0.48, 0.83, 0.53)));
 
     const int boxes_per_side = 20;
     for (int i = 0; i < boxes_per_side; i++)
@@ -305,68 +572,1139 @@ hittable_list final_scene()
             const auto y1 = random_double(1, 101);
             const auto z1 = z0 + w;
 
-            boxes1.add(std::make_shared<box>(point3(x0, y0, z0),
-                                             point3(x1, y1, z1), ground));
+            boxes1.add(s.arena.make<box>(point3(x0, y0, z0),
+                                         point3(x1, y1, z1), ground));
         }
     }
 
-    hittable_list objects;
+    s.world.add(s.arena.make<bvh_node>(boxes1, 0, 1, &s.arena));
 
-    objects.add(std::make_shared<bvh_node>(boxes1, 0, 1));
-
-    auto light =
-        std::make_shared<diffuse_light>(std::make_shared<solid_color>(7, 7, 7));
-    objects.add(std::make_shared<xz_rect>(123, 423, 147, 412, 554, light));
+    auto light = s.materials.add(
+        s.arena.make<diffuse_light>(s.arena.make<solid_color>(7, 7, 7)));
+    auto light_rect = s.arena.make<xz_rect>(123, 423, 147, 412, 554, light);
+    s.world.add(s.arena.make<flip_face>(light_rect));
 
     auto center1 = point3(400, 400, 200);
     auto center2 = center1 + vec3(30, 0, 0);
-    auto moving_sphere_material = std::make_shared<lambertian>(
-        std::make_shared<solid_color>(0.7, 0.3, 0.1));
-    objects.add(std::make_shared<moving_sphere>(center1, center2, 0, 1, 50,
-                                                moving_sphere_material));
-
-    objects.add(std::make_shared<sphere>(point3(260, 150, 45), 50,
-                                         std::make_shared<dielectric>(1.5)));
-    objects.add(std::make_shared<sphere>(
+    auto moving_sphere_material = s.materials.add(s.arena.make<lambertian>(
+        s.arena.make<solid_color>(0.7, 0.3, 0.1)));
+    s.world.add(s.arena.make<moving_sphere>(center1, center2, 0, 1, 50,
+                                            moving_sphere_material));
+
+    auto glass = s.materials.add(s.arena.make<dielectric>(1.5));
+    s.world.add(s.arena.make<sphere>(point3(260, 150, 45), 50, glass));
+    s.world.add(s.arena.make<sphere>(
         point3(0, 150, 145), 50,
-        std::make_shared<metal>(color(0.8, 0.8, 0.9), 10.0)));
-
-    auto boundary = std::make_shared<sphere>(point3(360, 150, 145), 70,
-                                             std::make_shared<dielectric>(1.5));
-    objects.add(boundary);
-    objects.add(std::make_shared<constant_medium>(
-        boundary, 0.2, std::make_shared<solid_color>(0.2, 0.4, 0.9)));
-    boundary = std::make_shared<sphere>(point3(0, 0, 0), 5000,
-                                        std::make_shared<dielectric>(1.5));
-    objects.add(std::make_shared<constant_medium>(
-        boundary, .0001, std::make_shared<solid_color>(1, 1, 1)));
-
-    auto emat = std::make_shared<lambertian>(
-        std::make_shared<image_texture>("earthmap.jpg"));
-    objects.add(std::make_shared<sphere>(point3(400, 200, 400), 100, emat));
-    auto pertext = std::make_shared<noise_texture>(0.1);
-    objects.add(std::make_shared<sphere>(
-        point3(220, 280, 300), 80, std::make_shared<lambertian>(pertext)));
+        s.materials.add(s.arena.make<metal>(color(0.8, 0.8, 0.9), 10.0))));
+
+    auto boundary = s.arena.make<sphere>(point3(360, 150, 145), 70, glass);
+    s.world.add(boundary);
+    auto subsurface = s.arena.make<constant_medium>(
+        boundary, 0.2,
+        s.materials.add(s.arena.make<isotropic>(
+            s.arena.make<solid_color>(0.2, 0.4, 0.9))));
+    boundary = s.arena.make<sphere>(point3(0, 0, 0), 5000, glass);
+    auto mist = s.arena.make<constant_medium>(
+        boundary, .0001,
+        s.materials.add(s.arena.make<henyey_greenstein>(
+            s.arena.make<solid_color>(1, 1, 1), 0.7)));
+    subsurface->lights = mist->lights = light_rect;
+    s.world.add(subsurface);
+    s.world.add(mist);
+
+    auto emat = s.materials.add(s.arena.make<lambertian>(
+        s.arena.make<image_texture>("earthmap.jpg")));
+    s.world.add(s.arena.make<sphere>(point3(400, 200, 400), 100, emat));
+    auto pertext = s.materials.add(
+        s.arena.make<lambertian>(s.arena.make<noise_texture>(0.1)));
+    s.world.add(s.arena.make<sphere>(point3(220, 280, 300), 80, pertext));
 
     hittable_list boxes2;
-    auto white = std::make_shared<lambertian>(
-        std::make_shared<solid_color>(.73, .73, .73));
+    auto white = s.materials.add(s.arena.make<lambertian>(
+        s.arena.make<solid_color>(.73, .73, .73)));
     const int ns = 1000;
     for (int j = 0; j < ns; j++)
     {
-        boxes2.add(std::make_shared<sphere>(point3::random(0, 165), 10, white));
+        boxes2.add(s.arena.make<sphere>(point3::random(0, 165), 10, white));
     }
 
-    objects.add(std::make_shared<translate>(
-        std::make_shared<rotate_y>(std::make_shared<bvh_node>(boxes2, 0.0, 1.0),
-                                   15),
+    s.world.add(s.arena.make<translate>(
+        s.arena.make<rotate_y>(
+            s.arena.make<bvh_node>(boxes2, 0.0, 1.0, &s.arena), 15),
         vec3(-100, 270, 395)));
 
-    return objects;
+    return s;
+}
+
+scene instanced_forest(camera& cam, double aspect)
+{
+    scene s;
+
+    const auto bark = s.materials.add(s.arena.make<lambertian>(
+        s.arena.make<solid_color>(0.35, 0.2, 0.1)));
+    const auto leaves = s.materials.add(s.arena.make<lambertian>(
+        s.arena.make<solid_color>(0.1, 0.4, 0.1)));
+    const auto grass = s.materials.add(s.arena.make<lambertian>(
+        s.arena.make<solid_color>(0.3, 0.5, 0.2)));
+    const auto sun = s.materials.add(s.arena.make<diffuse_light>(
+        s.arena.make<solid_color>(20, 20, 18)));
+
+    // One tree, built once as a bottom-level BVH.
+    hittable_list tree;
+    tree.add(s.arena.make<box>(point3(-0.1, 0, -0.1), point3(0.1, 1.2, 0.1),
+                               bark));
+    for (int i = 0; i < 12; ++i)
+    {
+        const point3 center(random_double(-0.4, 0.4), random_double(1.0, 2.0),
+                            random_double(-0.4, 0.4));
+        tree.add(s.arena.make<sphere>(center, random_double(0.25, 0.45),
+                                      leaves));
+    }
+    const auto tree_bvh = s.arena.make<bvh_node>(tree, 0, 1, &s.arena);
+
+    // 100k placements of it: each one is a transform, not a copy.
+    hittable_list forest;
+    const int trees_per_side = 316;
+    const double spacing = 3.0;
+    for (int i = 0; i < trees_per_side; ++i)
+    {
+        for (int j = 0; j < trees_per_side; ++j)
+        {
+            const vec3 position((i - trees_per_side / 2) * spacing +
+                                    random_double(-1, 1),
+                                0,
+                                (j - trees_per_side / 2) * spacing +
+                                    random_double(-1, 1));
+            const auto size = random_double(0.7, 1.3);
+
+            forest.add(s.arena.make<instance>(
+                tree_bvh, transform::translation(position) *
+                              transform::rotation_y(random_double(0, 360)) *
+                              transform::scaling(vec3(size, size, size))));
+        }
+    }
+    s.world.add(s.arena.make<bvh_node>(forest, 0, 1, &s.arena));
+
+    s.world.add(s.arena.make<sphere>(point3(0, -10000, 0), 10000, grass));
+    s.world.add(s.arena.make<sphere>(point3(-2000, 3000, -2000), 500, sun));
+
+    const point3 lookfrom(0, 12, -60);
+    const point3 lookat(0, 0, 0);
+    const vec3 vup(0, 1, 0);
+    const auto dist_to_focus = 10.0;
+    const auto aperture = 0.0;
+    const auto vfov = 40.0;
+    const auto t0 = 0.0;
+    const auto t1 = 1.0;
+
+    cam = camera(lookfrom, lookat, vup, vfov, aspect, aperture, dist_to_focus,
+                 t0, t1);
+
+    return s;
+}
+
+#if !defined(_WIN32)
+// A scene kept resident by the render server or a render worker, with what
+// rendering it takes besides its objects.
+struct served_scene
+{
+    scene content;
+    std::shared_ptr<hittable> lights;
+    point3 lookfrom;
+    point3 lookat;
+    double vfov;
+};
+
+// The scenes that have lights to sample, by the names jobs refer to them.
+const std::vector<std::string> served_scene_names{
+    "cornell", "cornell_cloud", "cornell_smoke", "cornell_swarm", "final",
+    "forest"};
+
+std::unique_ptr<served_scene> serve_scene(scene&& s,
+                                          std::shared_ptr<hittable> lights,
+                                          const point3& lookfrom,
+                                          const point3& lookat, double vfov)
+{
+    auto served = std::unique_ptr<served_scene>(
+        new served_scene{std::move(s), std::move(lights), lookfrom, lookat,
+                         vfov});
+
+    scene_compiler compiler(served->content.arena, 0.0, 1.0,
+                            served->content.bvh_method,
+                            served->content.bvh_format);
+    served->content.world = compiler.compile(served->content.world);
+
+    return served;
+}
+
+// Builds one of served_scene_names. The builders draw random numbers, so
+// processes that build the same scene first get the same scene.
+std::unique_ptr<served_scene> build_served_scene(const std::string& name)
+{
+    const point3 cornell_eye{278, 278, -800}, cornell_target{278, 278, 0};
+
+    if (name == "cornell")
+    {
+        camera unused;
+        auto lights = std::make_shared<hittable_list>();
+        lights->add(std::make_shared<xz_rect>(213, 343, 227, 332, 554,
+                                              material_handle{0}));
+        lights->add(std::make_shared<sphere>(point3{190, 90, 190}, 90,
+                                             material_handle{0}));
+        return serve_scene(cornell_box(unused, 1.0), lights, cornell_eye,
+                           cornell_target, 40.0);
+    }
+
+    if (name == "cornell_cloud")
+    {
+        return serve_scene(cornell_cloud(),
+                           std::make_shared<xz_rect>(213, 343, 227, 332, 554,
+                                                     material_handle{0}),
+                           cornell_eye, cornell_target, 40.0);
+    }
+
+    if (name == "cornell_smoke")
+    {
+        return serve_scene(cornell_smoke(),
+                           std::make_shared<xz_rect>(113, 443, 127, 432, 554,
+                                                     material_handle{0}),
+                           cornell_eye, cornell_target, 40.0);
+    }
+
+    if (name == "cornell_swarm")
+    {
+        return serve_scene(cornell_swarm(),
+                           std::make_shared<xz_rect>(213, 343, 227, 332, 554,
+                                                     material_handle{0}),
+                           cornell_eye, cornell_target, 40.0);
+    }
+
+    if (name == "final")
+    {
+        return serve_scene(final_scene(),
+                           std::make_shared<xz_rect>(123, 423, 147, 412, 554,
+                                                     material_handle{0}),
+                           point3{478, 278, -600}, point3{278, 278, 0}, 40.0);
+    }
+
+    if (name == "forest")
+    {
+        camera unused;
+        return serve_scene(instanced_forest(unused, 1.0),
+                           std::make_shared<sphere>(point3(-2000, 3000, -2000),
+                                                    500, material_handle{0}),
+                           point3{0, 12, -60}, point3{0, 0, 0}, 40.0);
+    }
+
+    return nullptr;
 }
 
-int main()
+// The job's camera, with its shutter open over [time0, time1].
+camera job_camera(const served_scene& s, const render_job& job,
+                  double time0 = 0.0, double time1 = 1.0)
 {
+    return camera{job.lookfrom.value_or(s.lookfrom),
+                  job.lookat.value_or(s.lookat),
+                  vec3{0, 1, 0},
+                  job.vfov.value_or(s.vfov),
+                  static_cast<double>(job.width) / job.height,
+                  0.0,
+                  10.0,
+                  time0,
+                  time1};
+}
+
+// The sum of the job's samples of pixel (i, j). Each sample restarts the
+// random sequence from the job seed, the pixel and the sample index, so it
+// does not depend on what was rendered before it.
+color sample_pixel(const served_scene& s, const camera& cam,
+                   const render_job& job, int i, int j)
+{
+    const int max_depth = 50;
+    const color background{0, 0, 0};
+    const auto pixel_seed = pcg32::mix(
+        job.seed ^ pcg32::mix(static_cast<std::uint64_t>(j) * job.width + i));
+    color pixel_color;
+
+    for (int k = job.first_sample;
+         k < job.first_sample + job.samples_per_pixel; ++k)
+    {
+        seed_random(pixel_seed, static_cast<std::uint64_t>(k));
+
+        const auto u = (i + random_double()) / (job.width - 1);
+        const auto v = (j + random_double()) / (job.height - 1);
+        ray r = cam.get_ray(u, v, 1.0 / (job.width - 1),
+                            1.0 / (job.height - 1));
+        pixel_color += ray_color(r, background, s.content.world,
+                                 s.content.materials, s.lights, max_depth);
+    }
+
+    return pixel_color;
+}
+
+// Stores the mean radiance of pixel (i, j) of the job's image in out.
+void render_pixel(const served_scene& s, const camera& cam,
+                  const render_job& job, int i, int j, float* out)
+{
+    const color sum = sample_pixel(s, cam, job, i, j);
+
+    for (int c = 0; c < 3; ++c)
+    {
+        out[c] = static_cast<float>(sum[c] / job.samples_per_pixel);
+    }
+}
+
+// The sums of the job's samples of the pixels [x0, x1) x [y0, y1), row by
+// row from y0, as sample_pixel computes them, but with the paths of a whole
+// wave of samples traced together, a bounce at a time. After each bounce the
+// rays that go on are sorted by a ray_queue, and their paths are laid out in
+// that order. Each path carries its own random generator, seeded as in
+// sample_pixel, so the samples are the same up to rounding.
+std::vector<color> sample_tile_queued(const served_scene& s, const camera& cam,
+                                      const render_job& job, int x0, int y0,
+                                      int x1, int y1)
+{
+    struct path
+    {
+        ray r;
+        color throughput{1, 1, 1};
+        color radiance;
+        pcg32 random;
+        std::uint32_t pixel = 0;
+        int depth = 0;
+        double emission_weight = 1.0;
+    };
+
+    const int max_depth = 50;
+    const color background{0, 0, 0};
+    // About 1 MB of paths, which stays in L2. Larger waves sort into more
+    // coherent batches, but were slower overall.
+    const std::size_t wave_size = 1 << 12;
+    const int width = x1 - x0;
+    const std::size_t pixels = static_cast<std::size_t>(width) * (y1 - y0);
+    const std::size_t samples = pixels * job.samples_per_pixel;
+
+    aabb bounds;
+    s.content.world.bounding_box(0.0, 1.0, bounds);
+    ray_queue queue(bounds);
+    std::vector<path> paths, scattered_paths;
+    std::vector<color> sums(pixels);
+
+    for (std::size_t first = 0; first < samples; first += wave_size)
+    {
+        paths.resize(std::min(wave_size, samples - first));
+
+        for (std::size_t n = 0; n < paths.size(); ++n)
+        {
+            const auto pixel = (first + n) / job.samples_per_pixel;
+            const auto k = job.first_sample +
+                           (first + n) % job.samples_per_pixel;
+            const auto i = x0 + static_cast<int>(pixel % width);
+            const auto j = y0 + static_cast<int>(pixel / width);
+            const auto pixel_seed = pcg32::mix(
+                job.seed ^
+                pcg32::mix(static_cast<std::uint64_t>(j) * job.width + i));
+            seed_random(pixel_seed, static_cast<std::uint64_t>(k));
+
+            path& p = paths[n];
+            const auto u = (i + random_double()) / (job.width - 1);
+            const auto v = (j + random_double()) / (job.height - 1);
+            p = path{};
+            p.r = cam.get_ray(u, v, 1.0 / (job.width - 1),
+                              1.0 / (job.height - 1));
+            p.random = random_generator();
+            p.pixel = static_cast<std::uint32_t>(pixel);
+            p.depth = max_depth;
+        }
+
+        // Camera rays are coherent in the order they are made.
+        while (!paths.empty())
+        {
+            scattered_paths.clear();
+            queue.clear();
+
+            for (path& p : paths)
+            {
+                random_generator() = p.random;
+                hit_record rec;
+                bool goes_on = false;
+
+                if (!s.content.world.hit(p.r, 0.001, infinity, rec))
+                {
+                    p.radiance +=
+                        p.emission_weight * p.throughput * background;
+                }
+                else
+                {
+                    rec.compute_differentials(p.r);
+
+                    color emitted, factor;
+                    ray next;
+                    const bool scattered = scatter_step(
+                        p.r, rec, s.content.world, background,
+                        s.content.materials, s.lights, p.emission_weight,
+                        emitted, next, factor);
+                    p.radiance += p.throughput * emitted;
+
+                    if (scattered && p.depth > 1)
+                    {
+                        p.throughput = p.throughput * factor;
+                        p.r = next;
+                        --p.depth;
+                        goes_on = true;
+                    }
+                }
+
+                p.random = random_generator();
+                if (goes_on)
+                {
+                    queue.push(p.r, static_cast<std::uint32_t>(
+                                        scattered_paths.size()));
+                    scattered_paths.push_back(p);
+                }
+                else
+                {
+                    sums[p.pixel] += p.radiance;
+                }
+            }
+
+            queue.sort();
+            paths.clear();
+            for (const auto& entry : queue.entries)
+            {
+                paths.push_back(scattered_paths[entry.path]);
+            }
+        }
+    }
+
+    return sums;
+}
+
+// Stores the mean radiance of the pixels [x0, x1) x [y0, y1) of the job's
+// image in out, row by row from y0.
+void render_tile(const served_scene& s, const camera& cam,
+                 const render_job& job, int x0, int y0, int x1, int y1,
+                 float* out)
+{
+    if (!job.queue_rays)
+    {
+        for (int j = y0; j < y1; ++j)
+        {
+            for (int i = x0; i < x1; ++i, out += 3)
+            {
+                render_pixel(s, cam, job, i, j, out);
+            }
+        }
+        return;
+    }
+
+    for (const color& sum : sample_tile_queued(s, cam, job, x0, y0, x1, y1))
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            *out++ = static_cast<float>(sum[c] / job.samples_per_pixel);
+        }
+    }
+}
+
+// Writes mean radiance, rows from the bottom up, as a float .pfm or, for any
+// other extension, as a gamma-corrected .ppm.
+bool write_image(const std::string& path, const std::vector<float>& pixels,
+                 int width, int height)
+{
+    const bool pfm =
+        path.size() >= 4 && path.compare(path.size() - 4, 4, ".pfm") == 0;
+    std::ofstream out(path, pfm ? std::ios::binary : std::ios::out);
+
+    if (pfm)
+    {
+        // Negative scale: little-endian floats, bottom row first.
+        out << "PF\n" << width << ' ' << height << "\n-1.0\n";
+        for (const float value : pixels)
+        {
+            unsigned char bytes[4];
+            std::uint32_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            for (int b = 0; b < 4; ++b)
+            {
+                bytes[b] = static_cast<unsigned char>(bits >> (8 * b));
+            }
+            out.write(reinterpret_cast<const char*>(bytes), 4);
+        }
+
+        return static_cast<bool>(out);
+    }
+
+    out << "P3\n" << width << ' ' << height << "\n255\n";
+    for (int j = height - 1; j >= 0; --j)
+    {
+        for (int i = 0; i < width; ++i)
+        {
+            const float* p = &pixels[(static_cast<std::size_t>(j) * width + i) *
+                                     3];
+            color{p[0], p[1], p[2]}.write_color(out, 1);
+        }
+    }
+
+    return static_cast<bool>(out);
+}
+
+bool render_job_to_file(const served_scene& s, render_job& job,
+                        double time0 = 0.0, double time1 = 1.0)
+{
+    const camera cam = job_camera(s, job, time0, time1);
+    const texture_cache::pin textures;
+    std::vector<float> pixels(static_cast<std::size_t>(job.width) *
+                              job.height * 3);
+
+    for (int j = job.height - 1; j >= 0; --j)
+    {
+        if (job.cancel_requested)
+        {
+            return false;
+        }
+
+        render_tile(s, cam, job, 0, j, job.width, j + 1,
+                    &pixels[static_cast<std::size_t>(j) * job.width * 3]);
+
+        ++job.rows_done;
+    }
+
+    return write_image(job.output, pixels, job.width, job.height);
+}
+
+// Renders the job from the primary hits of its view instead of tracing
+// camera rays: only the bounces after them are traced, with the scene's
+// current materials.
+bool render_look_dev_to_file(const served_scene& s, const gbuffer& hits,
+                             render_job& job)
+{
+    const int max_depth = 50;
+    const color background{0, 0, 0};
+    const texture_cache::pin textures;
+    std::vector<float> pixels(static_cast<std::size_t>(job.width) *
+                              job.height * 3);
+
+    for (int j = job.height - 1; j >= 0; --j)
+    {
+        if (job.cancel_requested)
+        {
+            return false;
+        }
+
+        for (int i = 0; i < job.width; ++i)
+        {
+            const auto pixel_seed = pcg32::mix(
+                job.seed ^
+                pcg32::mix(static_cast<std::uint64_t>(j) * job.width + i));
+            color sum;
+
+            for (int k = 0; k < hits.samples; ++k)
+            {
+                seed_random(pixel_seed, static_cast<std::uint64_t>(k));
+
+                const auto& sample = hits.at(i, j, k);
+                sum += sample.hit ? shade(sample.incoming(), sample.record(),
+                                          background, s.content.world,
+                                          s.content.materials, s.lights,
+                                          max_depth)
+                                  : background;
+            }
+
+            float* out =
+                &pixels[(static_cast<std::size_t>(j) * job.width + i) * 3];
+            for (int c = 0; c < 3; ++c)
+            {
+                out[c] = static_cast<float>(sum[c] / hits.samples);
+            }
+        }
+
+        ++job.rows_done;
+    }
+
+    return write_image(job.output, pixels, job.width, job.height);
+}
+
+// Reads "<id> <kind> <values>" for the material command of render_server
+// and returns the error, if any. The new material is queued in edits.
+std::string parse_material_edit(
+    const served_scene& s, std::istream& args,
+    std::vector<std::pair<material_handle, std::shared_ptr<material>>>&
+        edits)
+{
+    std::size_t id = 0;
+    std::string kind;
+    if (!(args >> id >> kind))
+    {
+        return "usage: material <scene> <id> <kind> <values>";
+    }
+
+    if (id >= s.content.materials.size())
+    {
+        return "no material " + std::to_string(id);
+    }
+
+    // Handle 0 is the plain material of the table, which must stay as is.
+    if (id == 0)
+    {
+        return "material 0 cannot be edited";
+    }
+
+    std::shared_ptr<material> m;
+    double r = 0, g = 0, b = 0, value = 0;
+
+    if (kind == "lambertian" && args >> r >> g >> b)
+    {
+        m = std::make_shared<lambertian>(
+            std::make_shared<solid_color>(r, g, b));
+    }
+    else if (kind == "metal" && args >> r >> g >> b >> value)
+    {
+        m = std::make_shared<metal>(color{r, g, b}, value);
+    }
+    else if (kind == "dielectric" && args >> value)
+    {
+        m = std::make_shared<dielectric>(value);
+    }
+    else if (kind == "light" && args >> r >> g >> b)
+    {
+        m = std::make_shared<diffuse_light>(
+            std::make_shared<solid_color>(r, g, b));
+    }
+    else
+    {
+        return "bad material '" + kind + "'";
+    }
+
+    edits.emplace_back(static_cast<material_handle>(id), std::move(m));
+
+    return {};
+}
+
+// Builds every served scene once, then renders the jobs sent to the socket
+// (see render_server).
+int serve(const std::string& socket_path)
+{
+    std::map<std::string, std::unique_ptr<served_scene>> scenes;
+    for (const auto& name : served_scene_names)
+    {
+        scenes[name] = build_served_scene(name);
+    }
+
+    std::cerr << "Scene memory:\n";
+    for (const auto& entry : scenes)
+    {
+        std::cerr << entry.first << ":\n";
+        entry.second->content.arena.report(std::cerr);
+    }
+
+    // The primary hits of the last look-dev view of each scene, which take
+    // about 150 bytes per sample, hence the cap. Only the render thread
+    // touches them.
+    struct look_dev_view
+    {
+        std::string view;
+        std::unique_ptr<gbuffer> hits;
+    };
+    const std::size_t max_look_dev_bytes = std::size_t{2} << 30;
+    std::map<std::string, look_dev_view> look_dev;
+
+    // Material edits wait here for the next job of their scene, so that the
+    // render thread is the only one to touch the materials.
+    std::mutex edits_lock;
+    std::map<std::string,
+             std::vector<std::pair<material_handle, std::shared_ptr<material>>>>
+        edits;
+
+    const auto render = [&](render_job& job) {
+        served_scene& s = *scenes.at(job.scene);
+
+        {
+            std::lock_guard<std::mutex> guard(edits_lock);
+            for (auto& edit : edits[job.scene])
+            {
+                s.content.materials.replace(edit.first,
+                                            std::move(edit.second));
+            }
+            edits[job.scene].clear();
+        }
+
+        if (!job.look_dev)
+        {
+            return render_job_to_file(s, job);
+        }
+
+        auto& cached = look_dev[job.scene];
+        const std::string view = job.describe_frame() + " spp=" +
+                                 std::to_string(job.samples_per_pixel) +
+                                 " seed=" + std::to_string(job.seed);
+
+        if (!cached.hits || cached.view != view)
+        {
+            cached.hits.reset();
+            if (static_cast<std::size_t>(job.width) * job.height *
+                    job.samples_per_pixel * sizeof(gbuffer_sample) >
+                max_look_dev_bytes)
+            {
+                std::cerr << "Job " << job.id
+                          << ": too many samples to keep for look-dev\n";
+                return false;
+            }
+
+            seed_random(job.seed, 0);
+            cached.hits = std::make_unique<gbuffer>(job.width, job.height,
+                                                    job.samples_per_pixel);
+            cached.hits->capture(job_camera(s, job), s.content.world);
+            cached.view = view;
+
+            std::cerr << "Job " << job.id << ": captured "
+                      << cached.hits->memory() / 1024 / 1024
+                      << " MB of primary hits\n";
+        }
+
+        return render_look_dev_to_file(s, *cached.hits, job);
+    };
+
+    const auto edit = [&](const std::string& scene, std::istream& args) {
+        std::lock_guard<std::mutex> guard(edits_lock);
+        return parse_material_edit(*scenes.at(scene), args, edits[scene]);
+    };
+
+    render_server server(socket_path, served_scene_names, render, edit);
+
+    return server.run(std::cerr) ? 0 : 1;
+}
+
+// Renders the tiles a tile_coordinator sends until it says done.
+int work_for(const std::string& host, int port)
+{
+    auto link = tcp_connection::connect_to(host, port);
+    std::string line;
+
+    if (!link.valid() || !link.read_line(line) || line.rfind("job ", 0) != 0)
+    {
+        std::cerr << "ERROR: No coordinator at " << host << ':' << port
+                  << ".\n";
+        return 1;
+    }
+
+    render_job job;
+    std::istringstream args(line.substr(4));
+    const std::string error = job.parse(args);
+    const auto s = error.empty() ? build_served_scene(job.scene) : nullptr;
+    if (!s)
+    {
+        std::cerr << "ERROR: Cannot render '" << line << "'. " << error
+                  << '\n';
+        return 1;
+    }
+
+    const camera cam = job_camera(*s, job);
+    const texture_cache::pin textures;
+    std::vector<float> pixels;
+
+    while (link.read_line(line) && line != "done")
+    {
+        std::istringstream in(line);
+        std::string verb;
+        int index, x0, y0, x1, y1;
+
+        if (!(in >> verb >> index >> x0 >> y0 >> x1 >> y1) || verb != "tile")
+        {
+            std::cerr << "ERROR: Unexpected message '" << line << "'.\n";
+            return 1;
+        }
+
+        pixels.resize(static_cast<std::size_t>(x1 - x0) * (y1 - y0) * 3);
+        render_tile(*s, cam, job, x0, y0, x1, y1, pixels.data());
+
+        if (!link.send_line("result " + std::to_string(index)) ||
+            !link.send_floats(pixels))
+        {
+            break;
+        }
+    }
+
+    return 0;
+}
+
+// Renders one image with worker processes: the workers started here on the
+// local machine, plus any started with --worker on other machines.
+int coordinate(int port, int argc, char* argv[], const char* self)
+{
+    int tile_size = 32, local_workers = 0;
+    double timeout = 60.0;
+    std::string job_args;
+
+    for (int a = 0; a < argc; ++a)
+    {
+        const std::string arg = argv[a];
+        if (arg.rfind("tile=", 0) == 0)
+        {
+            tile_size = std::max(1, std::atoi(arg.c_str() + 5));
+        }
+        else if (arg.rfind("workers=", 0) == 0)
+        {
+            local_workers = std::max(0, std::atoi(arg.c_str() + 8));
+        }
+        else if (arg.rfind("timeout=", 0) == 0)
+        {
+            timeout = std::atof(arg.c_str() + 8);
+        }
+        else
+        {
+            job_args += arg + ' ';
+        }
+    }
+
+    render_job job;
+    std::istringstream args(job_args);
+    std::string error = job.parse(args);
+    if (error.empty() && std::find(served_scene_names.begin(),
+                                   served_scene_names.end(),
+                                   job.scene) == served_scene_names.end())
+    {
+        error = "unknown scene '" + job.scene + "'";
+    }
+    if (error.empty() && job.output.empty())
+    {
+        error = "missing out=<file>";
+    }
+    if (!error.empty())
+    {
+        std::cerr << "ERROR: " << error << ".\n";
+        return 1;
+    }
+
+    tile_coordinator coordinator(job, tile_size, timeout);
+    if (!coordinator.listen_on(port))
+    {
+        std::cerr << "ERROR: Could not listen on port " << port << ".\n";
+        return 1;
+    }
+
+    std::cerr << "Coordinating on port " << coordinator.port() << '\n';
+
+    std::vector<pid_t> children;
+    const std::string port_text = std::to_string(coordinator.port());
+    for (int w = 0; w < local_workers; ++w)
+    {
+        char* child_argv[] = {const_cast<char*>(self),
+                              const_cast<char*>("--worker"),
+                              const_cast<char*>("127.0.0.1"),
+                              const_cast<char*>(port_text.c_str()), nullptr};
+        pid_t pid;
+        if (posix_spawn(&pid, self, nullptr, nullptr, child_argv, environ) ==
+            0)
+        {
+            children.push_back(pid);
+        }
+    }
+
+    // Without local workers, the image waits for workers started elsewhere.
+    const auto local_workers_running = [&] {
+        children.erase(std::remove_if(children.begin(), children.end(),
+                                      [](pid_t pid) {
+                                          return waitpid(pid, nullptr,
+                                                         WNOHANG) != 0;
+                                      }),
+                       children.end());
+        return !children.empty();
+    };
+
+    const auto start = std::chrono::steady_clock::now();
+    const bool complete = coordinator.run(
+        std::cerr, local_workers > 0 ? std::function<bool()>(
+                                           local_workers_running)
+                                     : nullptr);
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    for (const pid_t pid : children)
+    {
+        waitpid(pid, nullptr, 0);
+    }
+
+    if (!complete)
+    {
+        return 1;
+    }
+
+    const auto& stats = coordinator.stats();
+    std::cerr << "Rendered in " << elapsed.count() << " s with "
+              << stats.workers << " workers (" << stats.workers_lost
+              << " lost), " << stats.tiles_requeued << " tiles requeued, "
+              << stats.tiles_duplicated << " duplicated ("
+              << stats.duplicates_discarded << " copies discarded)\n";
+
+    return write_image(job.output, coordinator.image(), job.width, job.height)
+               ? 0
+               : 1;
+}
+
+// Renders the job's range of samples into an accumulation file (out=...).
+int accumulate(int argc, char* argv[])
+{
+    render_job job;
+    std::string job_args;
+    for (int a = 0; a < argc; ++a)
+    {
+        job_args += std::string(argv[a]) + ' ';
+    }
+
+    std::istringstream args(job_args);
+    const std::string error = job.parse(args);
+    const auto s = error.empty() ? build_served_scene(job.scene) : nullptr;
+    if (!s || job.output.empty())
+    {
+        std::cerr << "ERROR: Cannot render '" << job_args << "'. " << error
+                  << '\n';
+        return 1;
+    }
+
+    const camera cam = job_camera(*s, job);
+    const texture_cache::pin textures;
+    accumulation_buffer buffer(job.width, job.height, job.describe_frame());
+    buffer.ranges.push_back({job.seed,
+                             static_cast<std::uint64_t>(job.first_sample),
+                             static_cast<std::uint64_t>(
+                                 job.samples_per_pixel)});
+
+    for (int j = job.height - 1; j >= 0; --j)
+    {
+        std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
+
+        const auto queued =
+            job.queue_rays ? sample_tile_queued(*s, cam, job, 0, j, job.width,
+                                                j + 1)
+                           : std::vector<color>{};
+
+        for (int i = 0; i < job.width; ++i)
+        {
+            buffer.add(i, j,
+                       job.queue_rays ? queued[i]
+                                      : sample_pixel(*s, cam, job, i, j),
+                       static_cast<std::uint32_t>(job.samples_per_pixel));
+        }
+    }
+
+    std::cerr << "\nDone.\n";
+
+    if (!buffer.save(job.output))
+    {
+        std::cerr << "ERROR: Could not write '" << job.output << "'.\n";
+        return 1;
+    }
+
+    return 0;
+}
+
+// Combines accumulation files into an image, or into another accumulation
+// file if output ends in .acc.
+int merge(const std::string& output, int argc, char* argv[])
+{
+    accumulation_buffer total;
+
+    for (int a = 0; a < argc; ++a)
+    {
+        accumulation_buffer part;
+        if (!part.load(argv[a]))
+        {
+            std::cerr << "ERROR: '" << argv[a]
+                      << "' is not an accumulation file.\n";
+            return 1;
+        }
+
+        if (a == 0)
+        {
+            total = std::move(part);
+            continue;
+        }
+
+        const std::string error = total.merge(part);
+        if (!error.empty())
+        {
+            std::cerr << "ERROR: Cannot merge '" << argv[a] << "': " << error
+                      << ".\n";
+            return 1;
+        }
+    }
+
+    std::uint64_t samples = 0;
+    for (const auto& r : total.ranges)
+    {
+        samples += r.count;
+    }
+    std::cerr << "Merged " << argc << " files, " << samples
+              << " samples per pixel: " << total.frame << '\n';
+
+    const bool keep_accumulating =
+        output.size() >= 4 &&
+        output.compare(output.size() - 4, 4, ".acc") == 0;
+    const bool written =
+        keep_accumulating
+            ? total.save(output)
+            : write_image(output, total.resolve(), total.width, total.height);
+
+    if (!written)
+    {
+        std::cerr << "ERROR: Could not write '" << output << "'.\n";
+        return 1;
+    }
+
+    return 0;
+}
+
+// Renders frames [start, start + frames) of a served scene, to the output
+// path with the frame number before the extension. Frame f is exposed over
+// [f, f + shutter] / fps, and the world follows the moving objects from
+// frame to frame (see scene_animator).
+int animate(int argc, char* argv[])
+{
+    int start = 0, frames = 24;
+    double fps = 24.0, shutter = 0.5, threshold = 1.2;
+    std::string job_args;
+
+    for (int a = 0; a < argc; ++a)
+    {
+        const std::string arg = argv[a];
+        if (arg.rfind("start=", 0) == 0)
+        {
+            start = std::max(0, std::atoi(arg.c_str() + 6));
+        }
+        else if (arg.rfind("frames=", 0) == 0)
+        {
+            frames = std::max(1, std::atoi(arg.c_str() + 7));
+        }
+        else if (arg.rfind("fps=", 0) == 0)
+        {
+            fps = std::max(1e-3, std::atof(arg.c_str() + 4));
+        }
+        else if (arg.rfind("shutter=", 0) == 0)
+        {
+            shutter = std::clamp(std::atof(arg.c_str() + 8), 0.0, 1.0);
+        }
+        else if (arg.rfind("rebuild=", 0) == 0)
+        {
+            threshold = std::max(1.0, std::atof(arg.c_str() + 8));
+        }
+        else
+        {
+            job_args += arg + ' ';
+        }
+    }
+
+    render_job job;
+    std::istringstream args(job_args);
+    const std::string error = job.parse(args);
+    const auto s = error.empty() ? build_served_scene(job.scene) : nullptr;
+    if (!s || job.output.empty())
+    {
+        std::cerr << "ERROR: Cannot render '" << job_args << "'. " << error
+                  << '\n';
+        return 1;
+    }
+
+    const std::string output = job.output;
+    const auto dot = output.rfind('.');
+    const std::string stem = output.substr(0, dot);
+    const std::string extension =
+        dot == std::string::npos ? ".ppm" : output.substr(dot);
+    const std::uint64_t seed = job.seed;
+
+    scene_animator animator(s->content, threshold);
+
+    for (int f = start; f < start + frames; ++f)
+    {
+        const double time0 = f / fps, time1 = (f + shutter) / fps;
+        const auto frame_start = std::chrono::steady_clock::now();
+        const bool rebuilt = animator.advance(time0, time1);
+        const double update_seconds =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                          frame_start)
+                .count();
+
+        std::string number = std::to_string(f);
+        number.insert(0, number.size() < 4 ? 4 - number.size() : 0, '0');
+        job.output = stem + '.' + number + extension;
+        job.seed = seed + static_cast<std::uint64_t>(f);
+
+        if (!render_job_to_file(*s, job, time0, time1))
+        {
+            std::cerr << "ERROR: Could not write '" << job.output << "'.\n";
+            return 1;
+        }
+
+        std::cerr << "Frame " << f << ": " << (rebuilt ? "rebuilt" : "refitted")
+                  << " in " << update_seconds * 1000.0
+                  << " ms, SAH growth " << animator.stats().growth << ", "
+                  << std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - frame_start)
+                         .count()
+                  << " s\n";
+    }
+
+    const auto& stats = animator.stats();
+    std::cerr << stats.refits << " refits (" << stats.refit_seconds * 1000.0
+              << " ms), " << stats.rebuilds << " rebuilds ("
+              << stats.rebuild_seconds * 1000.0 << " ms)\n";
+
+    return 0;
+}
+#endif
+
+int main(int argc, char* argv[])
+{
+#if !defined(_WIN32)
+    const std::string mode = argc > 1 ? argv[1] : "";
+    if (argc == 3 && mode == "--serve")
+    {
+        return serve(argv[2]);
+    }
+    if (argc == 4 && mode == "--worker")
+    {
+        return work_for(argv[2], std::atoi(argv[3]));
+    }
+    if (argc >= 3 && mode == "--coordinate")
+    {
+        return coordinate(std::atoi(argv[2]), argc - 3, argv + 3, argv[0]);
+    }
+    if (argc >= 3 && mode == "--accumulate")
+    {
+        return accumulate(argc - 2, argv + 2);
+    }
+    if (argc >= 4 && mode == "--merge")
+    {
+        return merge(argv[2], argc - 3, argv + 3);
+    }
+    if (argc >= 3 && mode == "--animate")
+    {
+        return animate(argc - 2, argv + 2);
+    }
+#endif
+
+    if (argc != 1)
+    {
+        std::cerr
+            << "Usage: " << argv[0] << '\n'
+            << "       " << argv[0] << " --serve <socket path>\n"
+            << "       " << argv[0]
+            << " --coordinate <port> [workers=<local workers>] [tile=32]"
+               " [timeout=60] scene=<name> out=<file.pfm|.ppm> [width=600]"
+               " [height=600] [spp=100] [lookfrom=x,y,z] [lookat=x,y,z]"
+               " [vfov=degrees] [queue=0]\n"
+            << "       " << argv[0] << " --worker <host> <port>\n"
+            << "       " << argv[0]
+            << " --accumulate scene=<name> out=<file.acc> [first=0]"
+               " [spp=100] [seed=0] [width=600] [height=600] ...\n"
+            << "       " << argv[0]
+            << " --merge <file.pfm|.ppm|.acc> <file.acc>...\n"
+            << "       " << argv[0]
+            << " --animate scene=<name> out=<file.pfm|.ppm> [start=0]"
+               " [frames=24] [fps=24] [shutter=0.5] [rebuild=1.2] ...\n";
+        return 1;
+    }
+
     const int image_width = 600;
     const int image_height = 600;
     const int samples_per_pixel = 1000;
@@ -378,14 +1716,24 @@ int main()
     const color background{0, 0, 0};
 
     camera cam;
-    const auto world = cornell_box(cam, aspect_ratio);
+    auto cornell = cornell_box(cam, aspect_ratio);
+
+    scene_compiler compiler(cornell.arena, 0.0, 1.0, cornell.bvh_method,
+                            cornell.bvh_format);
+    cornell.world = compiler.compile(cornell.world);
+
+    std::cerr << "Scene compilation:\n";
+    compiler.report(std::cerr);
+    std::cerr << "Scene memory:\n";
+    cornell.arena.report(std::cerr);
 
     const auto lights = std::make_shared<hittable_list>();
     lights->add(std::make_shared<xz_rect>(213, 343, 227, 332, 554,
-                                          std::make_shared<material>()));
+                                          material_handle{0}));
     lights->add(std::make_shared<sphere>(point3{190, 90, 190}, 90,
-                                         std::make_shared<material>()));
+                                         material_handle{0}));
 
+    const texture_cache::pin textures;
     for (int j = image_height - 1; j >= 0; --j)
     {
         std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
@@ -398,9 +1746,11 @@ int main()
             {
                 const auto u = (i + random_double()) / (image_width - 1);
                 const auto v = (j + random_double()) / (image_height - 1);
-                ray r = cam.get_ray(u, v);
+                ray r = cam.get_ray(u, v, 1.0 / (image_width - 1),
+                                    1.0 / (image_height - 1));
                 pixel_color +=
-                    ray_color(r, background, world, lights, max_depth);
+                    ray_color(r, background, cornell.world, cornell.materials,
+                              lights, max_depth);
             }
 
             pixel_color.write_color(std::cout, samples_per_pixel);
@@ -0,0 +1,209 @@
+// Copyright (c) 2020 Chris Ohk
+
+// I am making my contributions/submissions to this project solely in my
+// personal capacity and are not conveying any rights to any intellectual
+// property of any third parties.
+
+// It is based on Ray Tracing: The Rest of Your Life book.
+// References: https://raytracing.github.io
+
+#ifndef RAY_TRACING_MAJORANT_GRID_HPP
+#define RAY_TRACING_MAJORANT_GRID_HPP
+
+#include "scalar_grid.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// A coarse grid over a scalar_grid storing, for each cell, an upper bound of
+// the field inside the cell. Tracking through a volume uses it to take
+// long steps where the density is low and to skip empty cells entirely.
+class majorant_grid
+{
+ public:
+    majorant_grid() = default;
+    majorant_grid(const scalar_grid& field, int resolution);
+
+    // Calls visit(t0, t1, majorant) for each cell crossed by the ray between
+    // t_min and t_max, in order, until visit returns false.
+    template <typename Visitor>
+    void traverse(const ray& r, double t_min, double t_max,
+                  Visitor&& visit) const;
+
+    float at(int i, int j, int k) const
+    {
+        return values[(static_cast<std::size_t>(k) * n[1] + j) * n[0] + i];
+    }
+
+    aabb bounds;
+    int n[3] = {0, 0, 0};
+    std::vector<float> values;
+};
+
+inline majorant_grid::majorant_grid(const scalar_grid& field, int resolution)
+    : bounds(field.bounds)
+{
+    const int vertices[3] = {field.nx, field.ny, field.nz};
+
+    for (int a = 0; a < 3; ++a)
+    {
+        n[a] = std::max(1, std::min(resolution, vertices[a] - 1));
+    }
+
+    values.resize(static_cast<std::size_t>(n[0]) * n[1] * n[2]);
+
+    // The trilinear reconstruction inside a cell never exceeds the largest
+    // vertex of the field cells overlapping it.
+    const auto vertex_range = [&](int a, int c, int& lo, int& hi) {
+        const double scale = static_cast<double>(vertices[a] - 1) / n[a];
+        lo = static_cast<int>(std::floor(c * scale));
+        hi = std::min(static_cast<int>(std::ceil((c + 1) * scale)),
+                      vertices[a] - 1);
+    };
+
+    for (int k = 0; k < n[2]; ++k)
+    {
+        int k0, k1;
+        vertex_range(2, k, k0, k1);
+
+        for (int j = 0; j < n[1]; ++j)
+        {
+            int j0, j1;
+            vertex_range(1, j, j0, j1);
+
+            for (int i = 0; i < n[0]; ++i)
+            {
+                int i0, i1;
+                vertex_range(0, i, i0, i1);
+
+                float majorant = 0.0f;
+                for (int z = k0; z <= k1; ++z)
+                {
+                    for (int y = j0; y <= j1; ++y)
+                    {
+                        for (int x = i0; x <= i1; ++x)
+                        {
+                            majorant = std::max(majorant, field.at(x, y, z));
+                        }
+                    }
+                }
+
+                values[(static_cast<std::size_t>(k) * n[1] + j) * n[0] + i] =
+                    majorant;
+            }
+        }
+    }
+}
+
+template <typename Visitor>
+void majorant_grid::traverse(const ray& r, double t_min, double t_max,
+                             Visitor&& visit) const
+{
+    if (values.empty())
+    {
+        return;
+    }
+
+    // Clip the ray to the grid.
+    const point3& o = r.origin();
+    const vec3& d = r.direction();
+
+    for (int a = 0; a < 3; ++a)
+    {
+        if (d[a] == 0.0)
+        {
+            if (o[a] < bounds.min()[a] || o[a] > bounds.max()[a])
+            {
+                return;
+            }
+            continue;
+        }
+
+        auto t0 = (bounds.min()[a] - o[a]) / d[a];
+        auto t1 = (bounds.max()[a] - o[a]) / d[a];
+        if (t0 > t1)
+        {
+            std::swap(t0, t1);
+        }
+
+        t_min = std::max(t_min, t0);
+        t_max = std::min(t_max, t1);
+    }
+
+    if (t_min >= t_max)
+    {
+        return;
+    }
+
+    // 3D-DDA through the cells.
+    const point3 start = r.at(t_min);
+    int cell[3], step[3];
+    double next_t[3], delta_t[3];
+
+    for (int a = 0; a < 3; ++a)
+    {
+        const auto size = (bounds.max()[a] - bounds.min()[a]) / n[a];
+        const auto x = size > 0 ? (start[a] - bounds.min()[a]) / size : 0.0;
+        cell[a] = std::clamp(static_cast<int>(x), 0, n[a] - 1);
+
+        if (d[a] > 0.0)
+        {
+            step[a] = 1;
+            next_t[a] =
+                t_min + (bounds.min()[a] + (cell[a] + 1) * size - start[a]) /
+                            d[a];
+            delta_t[a] = size / d[a];
+        }
+        else if (d[a] < 0.0)
+        {
+            step[a] = -1;
+            next_t[a] =
+                t_min + (bounds.min()[a] + cell[a] * size - start[a]) / d[a];
+            delta_t[a] = -size / d[a];
+        }
+        else
+        {
+            step[a] = 0;
+            next_t[a] = infinity;
+            delta_t[a] = infinity;
+        }
+    }
+
+    auto t = t_min;
+
+    while (true)
+    {
+        int axis = 0;
+        if (next_t[1] < next_t[axis])
+        {
+            axis = 1;
+        }
+        if (next_t[2] < next_t[axis])
+        {
+            axis = 2;
+        }
+
+        const auto t_next = std::min(next_t[axis], t_max);
+        if (t_next > t && !visit(t, t_next, at(cell[0], cell[1], cell[2])))
+        {
+            return;
+        }
+
+        if (t_next >= t_max)
+        {
+            return;
+        }
+
+        t = t_next;
+        cell[axis] += step[axis];
+        if (cell[axis] < 0 || cell[axis] >= n[axis])
+        {
+            return;
+        }
+
+        next_t[axis] += delta_t[axis];
+    }
+}
+
+#endif
@@ -0,0 +1,167 @@
+// Copyright (c) 2020 Chris Ohk
+
+// I am making my contributions/submissions to this project solely in my
+// personal capacity and are not conveying any rights to any intellectual
+// property of any third parties.
+
+// It is based on Ray Tracing: The Rest of Your Life book.
+// References: https://raytracing.github.io
+
+#ifndef RAY_TRACING_MAPPED_FILE_HPP
+#define RAY_TRACING_MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// A read-only memory mapping of a whole file. Pages are read from disk by
+// the operating system the first time they are touched.
+class mapped_file
+{
+ public:
+    mapped_file() = default;
+    explicit mapped_file(const std::string& path);
+
+    ~mapped_file()
+    {
+        close();
+    }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    bool is_open() const
+    {
+        return ptr != nullptr;
+    }
+
+    const unsigned char* data() const
+    {
+        return static_cast<const unsigned char*>(ptr);
+    }
+
+    std::size_t size() const
+    {
+        return length;
+    }
+
+ private:
+    void close();
+
+    void* ptr = nullptr;
+    std::size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+};
+
+#ifdef _WIN32
+
+inline mapped_file::mapped_file(const std::string& path)
+{
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                       OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return;
+    }
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+    {
+        close();
+        return;
+    }
+
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr)
+    {
+        close();
+        return;
+    }
+
+    ptr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    length = ptr ? static_cast<std::size_t>(file_size.QuadPart) : 0;
+}
+
+inline void mapped_file::close()
+{
+    if (ptr)
+    {
+        UnmapViewOfFile(ptr);
+    }
+    if (mapping)
+    {
+        CloseHandle(mapping);
+    }
+    if (file != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(file);
+    }
+
+    ptr = nullptr;
+    mapping = nullptr;
+    file = INVALID_HANDLE_VALUE;
+    length = 0;
+}
+
+#else
+
+inline mapped_file::mapped_file(const std::string& path)
+{
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+        ::close(fd);
+        return;
+    }
+
+    void* p = mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ,
+                   MAP_PRIVATE, fd, 0);
+    // The mapping stays valid after the descriptor is closed.
+    ::close(fd);
+
+    if (p == MAP_FAILED)
+    {
+        return;
+    }
+
+    // Texture lookups jump around, so read-ahead mostly wastes I/O.
+    madvise(p, static_cast<std::size_t>(info.st_size), MADV_RANDOM);
+
+    ptr = p;
+    length = static_cast<std::size_t>(info.st_size);
+}
+
+inline void mapped_file::close()
+{
+    if (ptr)
+    {
+        munmap(ptr, length);
+    }
+
+    ptr = nullptr;
+    length = 0;
+}
+
+#endif
+
+#endif
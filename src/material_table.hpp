@@ -0,0 +1,77 @@
+// Copyright (c) 2020 Chris Ohk
+
+// I am making my contributions/submissions to this project solely in my
+// personal capacity and are not conveying any rights to any intellectual
+// property of any third parties.
+
+// It is based on Ray Tracing: The Rest of Your Life book.
+// References: https://raytracing.github.io
+
+#ifndef RAY_TRACING_MATERIAL_TABLE_HPP
+#define RAY_TRACING_MATERIAL_TABLE_HPP
+
+#include "hittable.hpp"
+#include "material.hpp"
+
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Owns the materials of a scene. Primitives and hit records refer to them by
+// a 32-bit handle, so intersection code never copies a shared_ptr (and never
+// touches a reference count). Textures are only reached from the materials
+// while shading, so they keep being shared through the materials.
+//
+// Handle 0 is always a plain material that neither scatters nor emits; it is
+// what default-constructed primitives and hit records refer to.
+class material_table
+{
+ public:
+    material_table()
+    {
+        add(std::make_shared<material>());
+    }
+
+    // Registers the material and returns its handle. Adding the same
+    // material again returns the handle it already has.
+    material_handle add(std::shared_ptr<material> m)
+    {
+        const auto iter = handles.find(m.get());
+        if (iter != handles.end())
+        {
+            return iter->second;
+        }
+
+        const auto h = static_cast<material_handle>(materials.size());
+        handles.emplace(m.get(), h);
+        materials.emplace_back(std::move(m));
+
+        return h;
+    }
+
+    // Swaps the material behind an existing handle, e.g. to tweak a scene
+    // without rebuilding its geometry.
+    void replace(material_handle h, std::shared_ptr<material> m)
+    {
+        handles.erase(materials[h].get());
+        handles.emplace(m.get(), h);
+        materials[h] = std::move(m);
+    }
+
+    const material& operator[](material_handle h) const
+    {
+        return *materials[h];
+    }
+
+    std::size_t size() const
+    {
+        return materials.size();
+    }
+
+ private:
+    std::vector<std::shared_ptr<material>> materials;
+    std::unordered_map<const material*, material_handle> handles;
+};
+
+#endif
@@ -0,0 +1,413 @@
+// Copyright (c) 2020 Chris Ohk
+
+// I am making my contributions/submissions to this project solely in my
+// personal capacity and are not conveying any rights to any intellectual
+// property of any third parties.
+
+// It is based on Ray Tracing: The Rest of Your Life book.
+// References: https://raytracing.github.io
+
+#ifndef RAY_TRACING_MIPMAP_HPP
+#define RAY_TRACING_MIPMAP_HPP
+
+#include "common.hpp"
+#include "mapped_file.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// An image pyramid of RGB float texels. Level 0 is the full resolution image
+// and each following level halves the resolution down to a single texel.
+// Texture coordinates (s, t) are in image space: s goes left to right and
+// t goes top to bottom, both in [0, 1].
+//
+// Each level is stored in square tiles of tile_size x tile_size texels so
+// that the four texels of a bilinear lookup are almost always close in
+// memory, whatever the orientation of the access pattern. All levels live
+// back to back in one block, which is also the layout of the .rtmip files
+// written by save() and memory-mapped by map_file().
+class mipmap
+{
+ public:
+    static const int channels = 3;
+    static const int tile_size = 8;
+
+    mipmap() = default;
+    mipmap(int width, int height, std::vector<float> texels);
+
+    // Level pointers refer into our own storage, so copies are not allowed.
+    mipmap(const mipmap&) = delete;
+    mipmap(mipmap&&) = default;
+    mipmap& operator=(const mipmap&) = delete;
+    mipmap& operator=(mipmap&&) = default;
+
+    // Writes the pyramid in the tiled .rtmip format.
+    bool save(const std::string& path) const;
+
+    // Maps a .rtmip file without decoding or copying any texel. Returns an
+    // empty pyramid if the file is missing or malformed.
+    static mipmap map_file(const std::string& path);
+
+    bool empty() const
+    {
+        return pyramid.empty();
+    }
+
+    int levels() const
+    {
+        return static_cast<int>(pyramid.size());
+    }
+
+    int width(int level) const
+    {
+        return pyramid[level].width;
+    }
+
+    int height(int level) const
+    {
+        return pyramid[level].height;
+    }
+
+    color texel(int level, int s, int t) const;
+    color nearest(int level, double s, double t) const;
+    color bilinear(int level, double s, double t) const;
+    color trilinear(double s, double t, double filter_width) const;
+
+    // Number of heap bytes used by the texels of all levels. Mapped
+    // pyramids are paged by the operating system and report zero.
+    std::size_t memory_size() const;
+
+ private:
+    struct image_level
+    {
+        int width = 0, height = 0;
+        int tiles_x = 0;
+        const float* texels = nullptr;
+    };
+
+    // On-disk layout: file_header, one level_header per level, then the
+    // texels of every level starting at data_offset.
+    struct file_header
+    {
+        char magic[8];
+        std::uint32_t channels;
+        std::uint32_t tile_size;
+        std::uint32_t levels;
+        std::uint32_t reserved;
+        std::uint64_t data_offset;
+    };
+
+    struct level_header
+    {
+        std::uint32_t width;
+        std::uint32_t height;
+        // Offset and size of the level in floats from data_offset
+        std::uint64_t offset;
+        std::uint64_t count;
+    };
+
+    static constexpr char file_magic[8] = {'R', 'T', 'M', 'I',
+                                           'P', '0', '0', '1'};
+    static const std::size_t file_alignment = 4096;
+    // Largest level side map_file() accepts, so that level sizes and tile
+    // indices stay within int.
+    static const std::uint32_t max_file_dimension = 1u << 16;
+
+    static std::size_t tiled_size(int width, int height)
+    {
+        const std::size_t tiles_x = (width + tile_size - 1) / tile_size;
+        const std::size_t tiles_y = (height + tile_size - 1) / tile_size;
+
+        return tiles_x * tiles_y * tile_size * tile_size * channels;
+    }
+
+    static void tile(int width, int height, const std::vector<float>& row_major,
+                     float* out);
+
+    static std::size_t tiled_offset(const image_level& l, int s, int t)
+    {
+        const int tile = (t / tile_size) * l.tiles_x + s / tile_size;
+        const int in_tile = (t % tile_size) * tile_size + s % tile_size;
+
+        return (static_cast<std::size_t>(tile) * tile_size * tile_size +
+                in_tile) * channels;
+    }
+
+    std::vector<image_level> pyramid;
+    std::vector<float> storage;
+    std::shared_ptr<const mapped_file> mapping;
+};
+
+inline mipmap::mipmap(int width, int height, std::vector<float> texels)
+{
+    // Build each level with a 2x2 box filter of the previous one. Odd sizes
+    // clamp the last row/column instead of dropping it. Filtering works on
+    // row-major copies, each level is tiled once all of them are done.
+    std::vector<std::vector<float>> levels;
+    levels.push_back(std::move(texels));
+    std::vector<std::pair<int, int>> sizes{{width, height}};
+
+    while (width > 1 || height > 1)
+    {
+        const std::vector<float>& src = levels.back();
+        const int dst_width = std::max(1, width / 2);
+        const int dst_height = std::max(1, height / 2);
+        std::vector<float> dst(static_cast<std::size_t>(dst_width) *
+                               dst_height * channels);
+
+        for (int t = 0; t < dst_height; ++t)
+        {
+            const int t0 = std::min(2 * t, height - 1);
+            const int t1 = std::min(2 * t + 1, height - 1);
+
+            for (int s = 0; s < dst_width; ++s)
+            {
+                const int s0 = std::min(2 * s, width - 1);
+                const int s1 = std::min(2 * s + 1, width - 1);
+
+                for (int c = 0; c < channels; ++c)
+                {
+                    const auto at = [&](int x, int y) {
+                        return src[(static_cast<std::size_t>(y) * width + x) *
+                                       channels + c];
+                    };
+
+                    dst[(static_cast<std::size_t>(t) * dst_width + s) *
+                            channels + c] =
+                        0.25f * (at(s0, t0) + at(s1, t0) + at(s0, t1) +
+                                 at(s1, t1));
+                }
+            }
+        }
+
+        width = dst_width;
+        height = dst_height;
+        levels.push_back(std::move(dst));
+        sizes.emplace_back(width, height);
+    }
+
+    std::size_t total = 0;
+    for (const auto& size : sizes)
+    {
+        total += tiled_size(size.first, size.second);
+    }
+
+    storage.resize(total);
+
+    std::size_t offset = 0;
+    for (std::size_t i = 0; i < levels.size(); ++i)
+    {
+        image_level l;
+        l.width = sizes[i].first;
+        l.height = sizes[i].second;
+        l.tiles_x = (l.width + tile_size - 1) / tile_size;
+        l.texels = storage.data() + offset;
+
+        tile(l.width, l.height, levels[i], storage.data() + offset);
+        offset += tiled_size(l.width, l.height);
+        pyramid.push_back(l);
+    }
+}
+
+inline void mipmap::tile(int width, int height,
+                         const std::vector<float>& row_major, float* out)
+{
+    image_level l;
+    l.width = width;
+    l.height = height;
+    l.tiles_x = (width + tile_size - 1) / tile_size;
+
+    for (int t = 0; t < height; ++t)
+    {
+        for (int s = 0; s < width; ++s)
+        {
+            const auto src =
+                (static_cast<std::size_t>(t) * width + s) * channels;
+            const auto dst = tiled_offset(l, s, t);
+
+            for (int c = 0; c < channels; ++c)
+            {
+                out[dst + c] = row_major[src + c];
+            }
+        }
+    }
+}
+
+inline bool mipmap::save(const std::string& path) const
+{
+    if (empty() || storage.empty())
+    {
+        return false;
+    }
+
+    std::ofstream out(path, std::ios::binary);
+    if (!out)
+    {
+        return false;
+    }
+
+    file_header header{};
+    std::memcpy(header.magic, file_magic, sizeof(header.magic));
+    header.channels = channels;
+    header.tile_size = tile_size;
+    header.levels = static_cast<std::uint32_t>(pyramid.size());
+
+    // Start the texels on a page boundary so that each mapped page holds
+    // whole tiles of a single level as often as possible.
+    const std::size_t headers_size =
+        sizeof(file_header) + pyramid.size() * sizeof(level_header);
+    header.data_offset = (headers_size + file_alignment - 1) /
+                         file_alignment * file_alignment;
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    for (const auto& l : pyramid)
+    {
+        level_header level{};
+        level.width = static_cast<std::uint32_t>(l.width);
+        level.height = static_cast<std::uint32_t>(l.height);
+        level.offset = static_cast<std::uint64_t>(l.texels - storage.data());
+        level.count = tiled_size(l.width, l.height);
+
+        out.write(reinterpret_cast<const char*>(&level), sizeof(level));
+    }
+
+    const std::vector<char> padding(header.data_offset - headers_size, 0);
+    out.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+    out.write(reinterpret_cast<const char*>(storage.data()),
+              static_cast<std::streamsize>(storage.size() * sizeof(float)));
+
+    return static_cast<bool>(out);
+}
+
+inline mipmap mipmap::map_file(const std::string& path)
+{
+    auto file = std::make_shared<const mapped_file>(path);
+    if (!file->is_open() || file->size() < sizeof(file_header))
+    {
+        return mipmap{};
+    }
+
+    file_header header;
+    std::memcpy(&header, file->data(), sizeof(header));
+
+    if (std::memcmp(header.magic, file_magic, sizeof(header.magic)) != 0 ||
+        header.channels != channels || header.tile_size != tile_size ||
+        header.levels == 0 ||
+        sizeof(file_header) + header.levels * sizeof(level_header) >
+            file->size() ||
+        header.data_offset % alignof(float) != 0)
+    {
+        return mipmap{};
+    }
+
+    const auto* texels =
+        reinterpret_cast<const float*>(file->data() + header.data_offset);
+    const std::size_t available =
+        (file->size() - std::min<std::size_t>(header.data_offset,
+                                              file->size())) / sizeof(float);
+
+    mipmap result;
+
+    for (std::uint32_t i = 0; i < header.levels; ++i)
+    {
+        level_header level;
+        std::memcpy(&level,
+                    file->data() + sizeof(file_header) +
+                        i * sizeof(level_header),
+                    sizeof(level));
+
+        if (level.width == 0 || level.height == 0 ||
+            level.width > max_file_dimension ||
+            level.height > max_file_dimension ||
+            level.count != tiled_size(static_cast<int>(level.width),
+                                      static_cast<int>(level.height)) ||
+            level.offset > available ||
+            level.count > available - level.offset)
+        {
+            return mipmap{};
+        }
+
+        image_level l;
+        l.width = static_cast<int>(level.width);
+        l.height = static_cast<int>(level.height);
+        l.tiles_x = (l.width + tile_size - 1) / tile_size;
+        l.texels = texels + level.offset;
+        result.pyramid.push_back(l);
+    }
+
+    result.mapping = std::move(file);
+
+    return result;
+}
+
+inline color mipmap::texel(int level, int s, int t) const
+{
+    const image_level& l = pyramid[level];
+    s = std::clamp(s, 0, l.width - 1);
+    t = std::clamp(t, 0, l.height - 1);
+
+    const float* pixel = l.texels + tiled_offset(l, s, t);
+
+    return color(pixel[0], pixel[1], pixel[2]);
+}
+
+inline color mipmap::nearest(int level, double s, double t) const
+{
+    return texel(level, static_cast<int>(s * width(level)),
+                 static_cast<int>(t * height(level)));
+}
+
+inline color mipmap::bilinear(int level, double s, double t) const
+{
+    // Texel centers sit at half-integer coordinates.
+    const auto x = s * width(level) - 0.5;
+    const auto y = t * height(level) - 0.5;
+    const auto x0 = std::floor(x);
+    const auto y0 = std::floor(y);
+    const auto dx = x - x0;
+    const auto dy = y - y0;
+    const int i = static_cast<int>(x0);
+    const int j = static_cast<int>(y0);
+
+    return (1 - dx) * (1 - dy) * texel(level, i, j) +
+           dx * (1 - dy) * texel(level, i + 1, j) +
+           (1 - dx) * dy * texel(level, i, j + 1) +
+           dx * dy * texel(level, i + 1, j + 1);
+}
+
+inline color mipmap::trilinear(double s, double t, double filter_width) const
+{
+    // Choose the level where one texel covers the filter width, then blend
+    // between the two closest levels.
+    const int last = levels() - 1;
+    const auto level = last + std::log2(ffmax(filter_width, 1e-8));
+
+    if (level <= 0)
+    {
+        return bilinear(0, s, t);
+    }
+
+    if (level >= last)
+    {
+        return texel(last, 0, 0);
+    }
+
+    const int l0 = static_cast<int>(level);
+    const auto delta = level - l0;
+
+    return (1 - delta) * bilinear(l0, s, t) + delta * bilinear(l0 + 1, s, t);
+}
+
+inline std::size_t mipmap::memory_size() const
+{
+    return storage.size() * sizeof(float);
+}
+
+#endif
@@ -13,20 +13,18 @@
 #include "hittable.hpp"
 #include "vec3.hpp"
 
-#include <utility>
-
 class moving_sphere final : public hittable
 {
  public:
     moving_sphere() = default;
     moving_sphere(vec3 cen0, vec3 cen1, double t0, double t1, double r,
-                  std::shared_ptr<material> m)
+                  material_handle m)
         : center0(cen0),
           center1(cen1),
           time0(t0),
           time1(t1),
           radius(r),
-          mat_ptr(std::move(m))
+          mat(m)
     {
         // Do nothing
     }
@@ -40,7 +38,7 @@ class moving_sphere final : public hittable
     vec3 center0, center1;
     double time0{0.0}, time1{0.0};
     double radius{0.0};
-    std::shared_ptr<material> mat_ptr;
+    material_handle mat{0};
 };
 
 inline bool moving_sphere::hit(const ray& r, double t_min, double t_max,
@@ -64,7 +62,7 @@ inline bool moving_sphere::hit(const ray& r, double t_min, double t_max,
 
             const vec3 outward_normal = (rec.p - center(r.time())) / radius;
             rec.set_face_normal(r, outward_normal);
-            rec.mat_ptr = mat_ptr;
+            rec.mat = mat;
 
             return true;
         }
@@ -78,7 +76,7 @@ inline bool moving_sphere::hit(const ray& r, double t_min, double t_max,
 
             const vec3 outward_normal = (rec.p - center(r.time())) / radius;
             rec.set_face_normal(r, outward_normal);
-            rec.mat_ptr = mat_ptr;
+            rec.mat = mat;
 
             return true;
         }
@@ -11,6 +11,7 @@
 #define RAY_TRACING_NOISE_TEXTURE_HPP
 
 #include "perlin.hpp"
+#include "scalar_grid.hpp"
 #include "texture.hpp"
 
 class noise_texture final : public texture
@@ -25,12 +26,41 @@ class noise_texture final : public texture
     color value([[maybe_unused]] double u, [[maybe_unused]] double v,
                 const point3& p) const override
     {
+        const auto turbulence =
+            (!baked.empty() && baked.contains(p)) ? baked.sample(p)
+                                                  : noise.turb(p);
+
         return color(1, 1, 1) * 0.5 *
-               (1 + sin(scale * p.z() + 10 * noise.turb(p)));
+               (1 + sin(scale * p.z() + 10 * turbulence));
     }
 
+    // Precomputes the turbulence on a grid of resolution^3 vertices over
+    // bounds, so that lookups inside it cost one trilinear interpolation
+    // instead of seven octaves of noise. Only worth it for static objects,
+    // and the grid must be fine enough for the highest octave of interest:
+    // details smaller than a grid cell are smoothed out.
+    void bake(const aabb& bounds, int resolution);
+
     perlin noise;
     double scale = 0.0;
+    scalar_grid baked;
 };
 
-#endif
\ No newline at end of file
+inline void noise_texture::bake(const aabb& bounds, int resolution)
+{
+    baked = scalar_grid(bounds, resolution, resolution, resolution);
+
+    for (int k = 0; k < resolution; ++k)
+    {
+        for (int j = 0; j < resolution; ++j)
+        {
+            for (int i = 0; i < resolution; ++i)
+            {
+                baked.at(i, j, k) =
+                    static_cast<float>(noise.turb(baked.vertex(i, j, k)));
+            }
+        }
+    }
+}
+
+#endif
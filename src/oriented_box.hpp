@@ -0,0 +1,110 @@
+// Copyright (c) 2020 Chris Ohk
+
+// I am making my contributions/submissions to this project solely in my
+// personal capacity and are not conveying any rights to any intellectual
+// property of any third parties.
+
+// It is based on Ray Tracing: The Rest of Your Life book.
+// References: https://raytracing.github.io
+
+#ifndef RAY_TRACING_ORIENTED_BOX_HPP
+#define RAY_TRACING_ORIENTED_BOX_HPP
+
+#include "box.hpp"
+#include "hittable.hpp"
+#include "transform.hpp"
+
+// The box [p0, p1] placed in the world by a rotation and a translation.
+// The ray is projected on the box axes and slab-tested in the box frame,
+// which is cheaper than wrapping a box in rotate_y and translate.
+class oriented_box final : public hittable
+{
+ public:
+    oriented_box() = default;
+    // placement must be rigid: rotations and translations only.
+    oriented_box(const point3& p0, const point3& p1,
+                 const transform& placement, material_handle ptr);
+
+    bool hit(const ray& r, double t0, double t1,
+             hit_record& rec) const override;
+    bool bounding_box([[maybe_unused]] double t0, [[maybe_unused]] double t1,
+                      aabb& output_box) const override;
+
+    // Corners in the box frame, and the world position and axes of that
+    // frame.
+    point3 box_min;
+    point3 box_max;
+    point3 origin;
+    vec3 axis[3];
+    material_handle mp{0};
+};
+
+inline oriented_box::oriented_box(const point3& p0, const point3& p1,
+                                  const transform& placement,
+                                  material_handle ptr)
+    : box_min(p0), box_max(p1), origin(placement.apply_point(point3{})), mp(ptr)
+{
+    for (int a = 0; a < 3; ++a)
+    {
+        vec3 unit;
+        unit[a] = 1.0;
+        axis[a] = unit_vector(placement.apply_vector(unit));
+    }
+}
+
+inline bool oriented_box::hit(const ray& r, double t0, double t1,
+                              hit_record& rec) const
+{
+    const vec3 offset = r.origin() - origin;
+    const point3 local_origin{dot(offset, axis[0]), dot(offset, axis[1]),
+                              dot(offset, axis[2])};
+    const vec3 local_direction{dot(r.direction(), axis[0]),
+                               dot(r.direction(), axis[1]),
+                               dot(r.direction(), axis[2])};
+    double t, side;
+    int a;
+
+    if (!box_slab_hit(local_origin, local_direction, box_min, box_max, t0, t1,
+                      t, a, side))
+    {
+        return false;
+    }
+
+    rec.t = t;
+    rec.p = r.at(t);
+
+    int u_axis, v_axis;
+    box_face_uv(local_origin + t * local_direction, box_min, box_max, a, rec.u,
+                rec.v, u_axis, v_axis);
+    rec.dpdu = (box_max[u_axis] - box_min[u_axis]) * axis[u_axis];
+    rec.dpdv = (box_max[v_axis] - box_min[v_axis]) * axis[v_axis];
+
+    rec.set_face_normal(r, side * axis[a]);
+    rec.mat = mp;
+
+    return true;
+}
+
+inline bool oriented_box::bounding_box([[maybe_unused]] double t0,
+                                       [[maybe_unused]] double t1,
+                                       aabb& output_box) const
+{
+    const vec3 center = 0.5 * (box_min + box_max);
+    const vec3 half = 0.5 * (box_max - box_min);
+    const point3 world_center =
+        origin + center[0] * axis[0] + center[1] * axis[1] +
+        center[2] * axis[2];
+    vec3 extent;
+
+    for (int i = 0; i < 3; ++i)
+    {
+        extent[i] = fabs(axis[0][i]) * half[0] + fabs(axis[1][i]) * half[1] +
+                    fabs(axis[2][i]) * half[2];
+    }
+
+    output_box = aabb(world_center - extent, world_center + extent);
+
+    return true;
+}
+
+#endif
@@ -0,0 +1,68 @@
+// Copyright (c) 2020 Chris Ohk
+
+// I am making my contributions/submissions to this project solely in my
+// personal capacity and are not conveying any rights to any intellectual
+// property of any third parties.
+
+// It is based on Ray Tracing: The Rest of Your Life book.
+// References: https://raytracing.github.io
+
+#ifndef RAY_TRACING_PCG32_HPP
+#define RAY_TRACING_PCG32_HPP
+
+#include <cstdint>
+
+// The PCG32 generator (XSH-RR output of a 64-bit LCG, O'Neill 2014). Its
+// state is two words, so it can be reseeded for every sample at almost no
+// cost, and each of its 2^63 streams is an independent sequence.
+class pcg32
+{
+ public:
+    pcg32()
+    {
+        seed(0x853c49e6748fea9bULL, 0xda3e39cb94b95bdbULL);
+    }
+
+    void seed(std::uint64_t initial_state, std::uint64_t stream)
+    {
+        state = 0;
+        increment = (stream << 1) | 1;
+        next_uint();
+        state += initial_state;
+        next_uint();
+    }
+
+    std::uint32_t next_uint()
+    {
+        const std::uint64_t old = state;
+        state = old * 6364136223846793005ULL + increment;
+
+        const auto xorshifted =
+            static_cast<std::uint32_t>(((old >> 18) ^ old) >> 27);
+        const auto rotation = static_cast<std::uint32_t>(old >> 59);
+
+        return (xorshifted >> rotation) | (xorshifted << ((32 - rotation) & 31));
+    }
+
+    // A real in [0, 1), with 32 random bits.
+    double next_double()
+    {
+        return next_uint() * (1.0 / 4294967296.0);
+    }
+
+    // Spreads the bits of x over the whole word (the SplitMix64 finalizer),
+    // to turn indices into seeds.
+    static std::uint64_t mix(std::uint64_t x)
+    {
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+
+        return x ^ (x >> 31);
+    }
+
+ private:
+    std::uint64_t state = 0;
+    std::uint64_t increment = 1;
+};
+
+#endif
@@ -12,149 +12,223 @@
 
 #include "common.hpp"
 
-inline double trilinear_interp(double c[2][2][2], double u, double v, double w)
+#include <cmath>
+#include <cstdint>
+
+// Permutation and gradient tables of the noise, generated at compile time
+// so that evaluating the noise never touches the heap.
+struct perlin_tables
 {
-    auto accum = 0.0;
+    static const int point_count = 256;
+
+    int perm_x[point_count];
+    int perm_y[point_count];
+    int perm_z[point_count];
+    double ranvec[point_count][3];
+};
 
-    for (int i = 0; i < 2; ++i)
+constexpr std::uint32_t perlin_next_random(std::uint64_t& state)
+{
+    // PCG-XSH-RR
+    const std::uint64_t old = state;
+    state = old * 6364136223846793005ULL + 1442695040888963407ULL;
+    const auto xorshifted =
+        static_cast<std::uint32_t>(((old >> 18u) ^ old) >> 27u);
+    const auto rot = static_cast<std::uint32_t>(old >> 59u);
+
+    return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+}
+
+constexpr double perlin_sqrt(double x)
+{
+    // Newton iterations; the inputs are squared lengths in (0, 1].
+    double r = 1.0;
+    for (int i = 0; i < 32; ++i)
     {
-        for (int j = 0; j < 2; ++j)
-        {
-            for (int k = 0; k < 2; ++k)
-            {
-                accum += (i * u + (1 - i) * (1 - u)) *
-                         (j * v + (1 - j) * (1 - v)) *
-                         (k * w + (1 - k) * (1 - w)) * c[i][j][k];
-            }
-        }
+        r = 0.5 * (r + x / r);
     }
 
-    return accum;
+    return r;
 }
 
-class perlin
+constexpr void perlin_generate_perm(int* p, std::uint64_t& state)
 {
- public:
-    perlin()
+    for (int i = 0; i < perlin_tables::point_count; ++i)
     {
-        ranvec = new vec3[point_count];
-        for (int i = 0; i < point_count; ++i)
-        {
-            ranvec[i] = unit_vector(vec3::random(-1, 1));
-        }
-
-        perm_x = perlin_generate_perm();
-        perm_y = perlin_generate_perm();
-        perm_z = perlin_generate_perm();
+        p[i] = i;
     }
 
-    ~perlin()
+    for (int i = perlin_tables::point_count - 1; i > 0; --i)
     {
-        delete[] ranvec;
-        delete[] perm_x;
-        delete[] perm_y;
-        delete[] perm_z;
+        const int target = static_cast<int>(perlin_next_random(state) %
+                                            static_cast<std::uint32_t>(i + 1));
+
+        const int tmp = p[i];
+        p[i] = p[target];
+        p[target] = tmp;
     }
+}
 
-    double noise(const point3& p) const
+constexpr perlin_tables perlin_generate_tables(std::uint64_t seed)
+{
+    perlin_tables tables{};
+    std::uint64_t state = seed;
+
+    for (int i = 0; i < perlin_tables::point_count; ++i)
     {
-        auto u = p.x() - floor(p.x());
-        auto v = p.y() - floor(p.y());
-        auto w = p.z() - floor(p.z());
-        const int i = static_cast<int>(floor(p.x()));
-        const int j = static_cast<int>(floor(p.y()));
-        const int k = static_cast<int>(floor(p.z()));
-        vec3 c[2][2][2];
-
-        for (int di = 0; di < 2; ++di)
+        // Random unit vector: rejection sample the unit ball, then normalize.
+        while (true)
         {
-            for (int dj = 0; dj < 2; ++dj)
+            double v[3] = {0.0, 0.0, 0.0};
+            for (double& c : v)
             {
-                for (int dk = 0; dk < 2; ++dk)
-                {
-                    c[di][dj][dk] =
-                        ranvec[perm_x[(i + di) & 255] ^ perm_y[(j + dj) & 255] ^
-                               perm_z[(k + dk) & 255]];
-                }
+                c = 2.0 * (perlin_next_random(state) / 4294967296.0) - 1.0;
             }
-        }
 
-        return perlin_interp(c, u, v, w);
-    }
+            const double len2 = v[0] * v[0] + v[1] * v[1] + v[2] * v[2];
+            if (len2 > 1.0 || len2 < 1e-4)
+            {
+                continue;
+            }
 
-    double turb(const point3& p, int depth = 7) const
-    {
-        auto accum = 0.0;
-        auto temp_p = p;
-        auto weight = 1.0;
+            const double inv_len = 1.0 / perlin_sqrt(len2);
+            for (int c = 0; c < 3; ++c)
+            {
+                tables.ranvec[i][c] = v[c] * inv_len;
+            }
 
-        for (int i = 0; i < depth; ++i)
-        {
-            accum += weight * noise(temp_p);
-            weight *= 0.5;
-            temp_p *= 2;
+            break;
         }
+    }
+
+    perlin_generate_perm(tables.perm_x, state);
+    perlin_generate_perm(tables.perm_y, state);
+    perlin_generate_perm(tables.perm_z, state);
 
-        return fabs(accum);
+    return tables;
+}
+
+inline constexpr perlin_tables perlin_table =
+    perlin_generate_tables(0x853c49e6748fea9bULL);
+
+class perlin
+{
+ public:
+    // Number of points noise_n() evaluates together. The lanes are
+    // independent, so the compiler is free to map them onto SIMD registers.
+    static const int lanes = 4;
+
+    double noise(const point3& p) const
+    {
+        double result;
+        noise_n(&p.e[0], &p.e[1], &p.e[2], &result, 1);
+
+        return result;
     }
 
+    // Evaluates the noise at `count` (at most `lanes`) points given as
+    // separate coordinate arrays.
+    static void noise_n(const double* x, const double* y, const double* z,
+                        double* out, int count);
+
+    double turb(const point3& p, int depth = 7) const;
+
  private:
-    static int* perlin_generate_perm()
+    static double corner(int hx, int hy, int hz, double u, double v, double w)
     {
-        const auto p = new int[point_count];
+        const auto& g = perlin_table.ranvec[perlin_table.perm_x[hx & 255] ^
+                                            perlin_table.perm_y[hy & 255] ^
+                                            perlin_table.perm_z[hz & 255]];
 
-        for (int i = 0; i < point_count; ++i)
-        {
-            p[i] = i;
-        }
+        return g[0] * u + g[1] * v + g[2] * w;
+    }
+};
 
-        permute(p, point_count);
+inline void perlin::noise_n(const double* x, const double* y, const double* z,
+                            double* out, int count)
+{
+    double u[lanes], v[lanes], w[lanes];
+    int i[lanes], j[lanes], k[lanes];
 
-        return p;
+    for (int l = 0; l < count; ++l)
+    {
+        const auto fx = std::floor(x[l]);
+        const auto fy = std::floor(y[l]);
+        const auto fz = std::floor(z[l]);
+
+        u[l] = x[l] - fx;
+        v[l] = y[l] - fy;
+        w[l] = z[l] - fz;
+        i[l] = static_cast<int>(fx);
+        j[l] = static_cast<int>(fy);
+        k[l] = static_cast<int>(fz);
     }
 
-    static void permute(int* p, int n)
+    // Gradient dot products at the eight cell corners.
+    double c[8][lanes];
+    for (int l = 0; l < count; ++l)
     {
-        for (int i = n - 1; i > 0; --i)
+        for (int corner_index = 0; corner_index < 8; ++corner_index)
         {
-            const int target = random_int(0, i);
+            const int di = corner_index >> 2;
+            const int dj = (corner_index >> 1) & 1;
+            const int dk = corner_index & 1;
 
-            const int tmp = p[i];
-            p[i] = p[target];
-            p[target] = tmp;
+            c[corner_index][l] = corner(i[l] + di, j[l] + dj, k[l] + dk,
+                                        u[l] - di, v[l] - dj, w[l] - dk);
         }
     }
 
-    static double perlin_interp(vec3 c[2][2][2], double u, double v, double w)
+    // Hermite smoothing and trilinear blend of the corners.
+    for (int l = 0; l < count; ++l)
     {
-        const auto uu = u * u * (3 - 2 * u);
-        const auto vv = v * v * (3 - 2 * v);
-        const auto ww = w * w * (3 - 2 * w);
-        auto accum = 0.0;
+        const auto uu = u[l] * u[l] * (3 - 2 * u[l]);
+        const auto vv = v[l] * v[l] * (3 - 2 * v[l]);
+        const auto ww = w[l] * w[l] * (3 - 2 * w[l]);
+
+        const auto x00 = c[0][l] + uu * (c[4][l] - c[0][l]);
+        const auto x01 = c[1][l] + uu * (c[5][l] - c[1][l]);
+        const auto x10 = c[2][l] + uu * (c[6][l] - c[2][l]);
+        const auto x11 = c[3][l] + uu * (c[7][l] - c[3][l]);
+        const auto y0 = x00 + vv * (x10 - x00);
+        const auto y1 = x01 + vv * (x11 - x01);
+
+        out[l] = y0 + ww * (y1 - y0);
+    }
+}
 
-        for (int i = 0; i < 2; ++i)
+inline double perlin::turb(const point3& p, int depth) const
+{
+    auto accum = 0.0;
+    auto weight = 1.0;
+    auto scale = 1.0;
+
+    // Evaluate the octaves `lanes` at a time.
+    for (int first = 0; first < depth; first += lanes)
+    {
+        const int count = depth - first < lanes ? depth - first : lanes;
+        double x[lanes], y[lanes], z[lanes], n[lanes];
+        double weights[lanes];
+
+        for (int l = 0; l < count; ++l)
         {
-            for (int j = 0; j < 2; ++j)
-            {
-                for (int k = 0; k < 2; ++k)
-                {
-                    vec3 weight_v(u - i, v - j, w - k);
-                    accum += (i * uu + (1 - i) * (1 - uu)) *
-                             (j * vv + (1 - j) * (1 - vv)) *
-                             (k * ww + (1 - k) * (1 - ww)) *
-                             dot(c[i][j][k], weight_v);
-                }
-            }
+            x[l] = scale * p.x();
+            y[l] = scale * p.y();
+            z[l] = scale * p.z();
+            weights[l] = weight;
+            scale *= 2;
+            weight *= 0.5;
         }
 
-        return accum;
+        noise_n(x, y, z, n, count);
+
+        for (int l = 0; l < count; ++l)
+        {
+            accum += weights[l] * n[l];
+        }
     }
 
-    static const int point_count = 256;
-    vec3* ranvec;
-    int* perm_x;
-    int* perm_y;
-    int* perm_z;
-};
+    return fabs(accum);
+}
 
-#endif
\ No newline at end of file
+#endif
@@ -43,9 +43,26 @@ class ray
         return orig + t * dir;
     }
 
+    // Attaches the rays through the neighboring pixels in x and y so that
+    // hits can estimate their screen-space texture footprint.
+    void set_differentials(const vec3& x_origin, const vec3& x_direction,
+                           const vec3& y_origin, const vec3& y_direction)
+    {
+        has_differentials = true;
+        rx_origin = x_origin;
+        rx_direction = x_direction;
+        ry_origin = y_origin;
+        ry_direction = y_direction;
+    }
+
     vec3 orig;
     vec3 dir;
     double tm;
+
+    // Ray differentials (offset rays for one pixel step in x and y)
+    bool has_differentials{false};
+    vec3 rx_origin, rx_direction;
+    vec3 ry_origin, ry_direction;
 };
 
 #endif
\ No newline at end of file
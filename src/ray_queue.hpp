@@ -0,0 +1,125 @@
+// Copyright (c) 2020 Chris Ohk
+
+// I am making my contributions/submissions to this project solely in my
+// personal capacity and are not conveying any rights to any intellectual
+// property of any third parties.
+
+// It is based on Ray Tracing: The Rest of Your Life book.
+// References: https://raytracing.github.io
+
+#ifndef RAY_TRACING_RAY_QUEUE_HPP
+#define RAY_TRACING_RAY_QUEUE_HPP
+
+#include "aabb.hpp"
+#include "lbvh_builder.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Rays of many paths waiting to be traced together. After a diffuse bounce
+// the rays of neighbouring samples go every which way, and tracing them in
+// the order of their paths visits unrelated parts of the BVH one after the
+// other. Sorted by the octant of their direction, then by the Morton code
+// of their origin (Garanzha and Loop 2010), consecutive rays start close to
+// each other and head the same way, so they mostly visit the same nodes
+// while these are still in cache.
+class ray_queue
+{
+ public:
+    struct entry
+    {
+        std::uint64_t key;
+        std::uint32_t path;
+    };
+
+    // Origins are quantized on a grid over bounds, usually the scene's.
+    explicit ray_queue(const aabb& bounds) : grid(bounds)
+    {
+        // Do nothing
+    }
+
+    void push(const ray& r, std::uint32_t path)
+    {
+        entries.push_back({key_of(r), path});
+    }
+
+    // Stable: rays with the same key keep the order they were pushed in.
+    void sort();
+
+    void clear()
+    {
+        entries.clear();
+    }
+
+    std::vector<entry> entries;
+
+ private:
+    // 3 bits of octant above 10 bits of cell per axis, a grid much finer
+    // than a wave of rays is dense, sorted in 3 passes.
+    static const int cell_bits = 10;
+    static const int key_bits = 3 + 3 * cell_bits;
+
+    std::uint64_t key_of(const ray& r) const;
+
+    aabb grid;
+    std::vector<entry> sorted;
+};
+
+inline void ray_queue::sort()
+{
+    // Least significant digit first, 11 bits at a time, as in
+    // lbvh_builder. With std::sort, sorting took a sizeable share of the
+    // time it takes to trace the rays.
+    const std::size_t n = entries.size();
+    sorted.resize(n);
+
+    for (int shift = 0; shift < key_bits; shift += 11)
+    {
+        std::size_t offsets[2049] = {};
+        for (const auto& e : entries)
+        {
+            ++offsets[((e.key >> shift) & 0x7ff) + 1];
+        }
+
+        if (std::find(offsets + 1, offsets + 2049, n) != offsets + 2049)
+        {
+            continue;
+        }
+
+        for (int digit = 0; digit < 2048; ++digit)
+        {
+            offsets[digit + 1] += offsets[digit];
+        }
+
+        for (const auto& e : entries)
+        {
+            sorted[offsets[(e.key >> shift) & 0x7ff]++] = e;
+        }
+
+        entries.swap(sorted);
+    }
+}
+
+inline std::uint64_t ray_queue::key_of(const ray& r) const
+{
+    const auto cells = static_cast<double>(1 << cell_bits);
+    std::uint64_t octant = 0, code = 0;
+
+    for (int a = 0; a < 3; ++a)
+    {
+        octant = octant << 1 | (r.direction()[a] < 0.0 ? 1 : 0);
+
+        const auto extent = grid.max()[a] - grid.min()[a];
+        const auto x =
+            extent > 0.0 ? (r.origin()[a] - grid.min()[a]) / extent * cells
+                         : 0.0;
+        const auto cell = static_cast<std::uint64_t>(
+            std::clamp(x, 0.0, cells - 1.0));
+        code |= lbvh_builder::expand_bits(cell) << (2 - a);
+    }
+
+    return octant << (3 * cell_bits) | code;
+}
+
+#endif
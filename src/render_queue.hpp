@@ -0,0 +1,365 @@
+// Copyright (c) 2020 Chris Ohk
+
+// I am making my contributions/submissions to this project solely in my
+// personal capacity and are not conveying any rights to any intellectual
+// property of any third parties.
+
+// It is based on Ray Tracing: The Rest of Your Life book.
+// References: https://raytracing.github.io
+
+#ifndef RAY_TRACING_RENDER_QUEUE_HPP
+#define RAY_TRACING_RENDER_QUEUE_HPP
+
+#include "common.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// A request to render one image of a resident scene. The camera fields left
+// unset fall back to the scene's own camera.
+struct render_job
+{
+    enum class state
+    {
+        queued,
+        running,
+        done,
+        failed,
+        cancelled
+    };
+
+    std::uint64_t id = 0;
+    int priority = 0;
+    std::string scene;
+    std::string output;
+    int width = 600;
+    int height = 600;
+    int samples_per_pixel = 100;
+    // Sample indices [first_sample, first_sample + samples_per_pixel) are
+    // rendered, each seeded from seed, its pixel and its index.
+    int first_sample = 0;
+    std::uint64_t seed = 0;
+    std::optional<point3> lookfrom;
+    std::optional<point3> lookat;
+    std::optional<double> vfov;
+    // Trace the paths of many samples together, a bounce at a time, with
+    // their rays sorted for coherence (see ray_queue). Same samples, up to
+    // rounding.
+    bool queue_rays = false;
+    // Shade the primary hits kept for the scene's view (see gbuffer), which
+    // the first look-dev job of a view captures, instead of tracing them.
+    // Only the render server keeps primary hits; elsewhere this is ignored.
+    // The kept hits are samples [0, samples_per_pixel), shaded one by one, so
+    // it cannot be combined with first_sample or queue_rays.
+    bool look_dev = false;
+
+    // Sets the fields given as key=value words (the keys are the render
+    // command parameters of render_server). Returns an error message, or an
+    // empty string if all of them were valid.
+    std::string parse(std::istream& args);
+    // The image fields as key=value words, as parse() reads them.
+    std::string describe() const;
+    // The same, without the samples: what the image shows.
+    std::string describe_frame() const;
+
+    // Updated by the renderer while the job runs.
+    std::atomic<state> status{state::queued};
+    std::atomic<int> rows_done{0};
+    std::atomic<bool> cancel_requested{false};
+};
+
+inline std::string render_job::parse(std::istream& args)
+{
+    const auto parse_point = [](const std::string& text, point3& p) {
+        std::istringstream in(text);
+        char comma1 = 0, comma2 = 0;
+
+        return static_cast<bool>(in >> p[0] >> comma1 >> p[1] >> comma2 >>
+                                 p[2]) &&
+               comma1 == ',' && comma2 == ',';
+    };
+
+    std::string token;
+
+    while (args >> token)
+    {
+        const auto equal = token.find('=');
+        if (equal == std::string::npos)
+        {
+            return "expected key=value, got '" + token + "'";
+        }
+
+        const std::string key = token.substr(0, equal);
+        const std::string value = token.substr(equal + 1);
+        std::istringstream in(value);
+        bool valid = true;
+
+        if (key == "scene")
+        {
+            scene = value;
+        }
+        else if (key == "out")
+        {
+            output = value;
+        }
+        else if (key == "width")
+        {
+            valid = static_cast<bool>(in >> width) && width > 1;
+        }
+        else if (key == "height")
+        {
+            valid = static_cast<bool>(in >> height) && height > 1;
+        }
+        else if (key == "spp")
+        {
+            valid = static_cast<bool>(in >> samples_per_pixel) &&
+                    samples_per_pixel > 0;
+        }
+        else if (key == "first")
+        {
+            valid = static_cast<bool>(in >> first_sample) && first_sample >= 0;
+        }
+        else if (key == "seed")
+        {
+            valid = static_cast<bool>(in >> seed);
+        }
+        else if (key == "priority")
+        {
+            valid = static_cast<bool>(in >> priority);
+        }
+        else if (key == "lookfrom" || key == "lookat")
+        {
+            point3 p;
+            valid = parse_point(value, p);
+            (key == "lookfrom" ? lookfrom : lookat) = p;
+        }
+        else if (key == "vfov")
+        {
+            double degrees = 0.0;
+            valid = static_cast<bool>(in >> degrees) && degrees > 0 &&
+                    degrees < 180;
+            vfov = degrees;
+        }
+        else if (key == "queue")
+        {
+            valid = static_cast<bool>(in >> queue_rays);
+        }
+        else if (key == "lookdev")
+        {
+            valid = static_cast<bool>(in >> look_dev);
+        }
+        else
+        {
+            return "unknown parameter '" + key + "'";
+        }
+
+        if (!valid)
+        {
+            return "bad value for " + key + ": '" + value + "'";
+        }
+    }
+
+    if (look_dev && (first_sample != 0 || queue_rays))
+    {
+        return "lookdev=1 takes neither first= nor queue=";
+    }
+
+    return {};
+}
+
+inline std::string render_job::describe() const
+{
+    return describe_frame() + " spp=" + std::to_string(samples_per_pixel) +
+           " first=" + std::to_string(first_sample) +
+           " seed=" + std::to_string(seed) + (queue_rays ? " queue=1" : "");
+}
+
+inline std::string render_job::describe_frame() const
+{
+    std::ostringstream out;
+    out.precision(17);
+
+    out << "scene=" << scene << " width=" << width << " height=" << height;
+    if (lookfrom)
+    {
+        out << " lookfrom=" << lookfrom->x() << ',' << lookfrom->y() << ','
+            << lookfrom->z();
+    }
+    if (lookat)
+    {
+        out << " lookat=" << lookat->x() << ',' << lookat->y() << ','
+            << lookat->z();
+    }
+    if (vfov)
+    {
+        out << " vfov=" << *vfov;
+    }
+
+    return out.str();
+}
+
+inline const char* to_string(render_job::state s)
+{
+    switch (s)
+    {
+        case render_job::state::queued:
+            return "queued";
+        case render_job::state::running:
+            return "running";
+        case render_job::state::done:
+            return "done";
+        case render_job::state::failed:
+            return "failed";
+        case render_job::state::cancelled:
+            return "cancelled";
+    }
+
+    return "unknown";
+}
+
+// The jobs of a render server. Jobs are taken by decreasing priority, and
+// in submission order for equal priorities. Finished jobs are kept so that
+// their status can still be queried.
+class render_queue
+{
+ public:
+    // Assigns the job an id and queues it.
+    std::shared_ptr<render_job> push(std::shared_ptr<render_job> job);
+
+    // Blocks until a job is available and marks it running, or returns
+    // nullptr once the queue is closed.
+    std::shared_ptr<render_job> pop();
+
+    // A queued job is dropped right away; a running one is flagged and
+    // stops at the next row. Returns false for unknown or finished jobs.
+    bool cancel(std::uint64_t id);
+
+    std::shared_ptr<render_job> find(std::uint64_t id) const;
+    std::vector<std::shared_ptr<render_job>> jobs() const;
+
+    // Wakes up pop() for good. Queued jobs are cancelled.
+    void close();
+
+ private:
+    mutable std::mutex mutex;
+    std::condition_variable available;
+    std::uint64_t next_id = 1;
+    bool closed = false;
+    // Queued jobs, ordered by (-priority, id).
+    std::set<std::pair<int, std::uint64_t>> pending;
+    std::map<std::uint64_t, std::shared_ptr<render_job>> all;
+};
+
+inline std::shared_ptr<render_job> render_queue::push(
+    std::shared_ptr<render_job> job)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        job->id = next_id++;
+        job->status = closed ? render_job::state::cancelled
+                             : render_job::state::queued;
+        all.emplace(job->id, job);
+        if (!closed)
+        {
+            pending.emplace(-job->priority, job->id);
+        }
+    }
+
+    available.notify_one();
+
+    return job;
+}
+
+inline std::shared_ptr<render_job> render_queue::pop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    available.wait(lock, [this] { return closed || !pending.empty(); });
+
+    if (closed)
+    {
+        return nullptr;
+    }
+
+    const auto first = pending.begin();
+    auto job = all.at(first->second);
+    pending.erase(first);
+    job->status = render_job::state::running;
+
+    return job;
+}
+
+inline bool render_queue::cancel(std::uint64_t id)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    const auto iter = all.find(id);
+    if (iter == all.end())
+    {
+        return false;
+    }
+
+    render_job& job = *iter->second;
+    switch (job.status)
+    {
+        case render_job::state::queued:
+            pending.erase({-job.priority, id});
+            job.status = render_job::state::cancelled;
+            return true;
+        case render_job::state::running:
+            job.cancel_requested = true;
+            return true;
+        default:
+            return false;
+    }
+}
+
+inline std::shared_ptr<render_job> render_queue::find(std::uint64_t id) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    const auto iter = all.find(id);
+    return iter == all.end() ? nullptr : iter->second;
+}
+
+inline std::vector<std::shared_ptr<render_job>> render_queue::jobs() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::vector<std::shared_ptr<render_job>> result;
+    result.reserve(all.size());
+    for (const auto& entry : all)
+    {
+        result.push_back(entry.second);
+    }
+
+    return result;
+}
+
+inline void render_queue::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        closed = true;
+        for (const auto& entry : pending)
+        {
+            all.at(entry.second)->status = render_job::state::cancelled;
+        }
+        pending.clear();
+    }
+
+    available.notify_all();
+}
+
+#endif
@@ -0,0 +1,361 @@
+// Copyright (c) 2020 Chris Ohk
+
+// I am making my contributions/submissions to this project solely in my
+// personal capacity and are not conveying any rights to any intellectual
+// property of any third parties.
+
+// It is based on Ray Tracing: The Rest of Your Life book.
+// References: https://raytracing.github.io
+
+#ifndef RAY_TRACING_RENDER_SERVER_HPP
+#define RAY_TRACING_RENDER_SERVER_HPP
+
+#include "render_queue.hpp"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// A long-lived render process: the scenes are built once, with their
+// acceleration structures and textures kept resident, and render jobs come
+// in over a Unix domain socket. One line per command, e.g. with
+// `nc -U <socket>`:
+//
+//   render scene=<name> out=<file.ppm> [width=600] [height=600] [spp=100]
+//          [priority=0] [lookfrom=x,y,z] [lookat=x,y,z] [vfov=degrees]
+//          [queue=0] [lookdev=0]
+//   material <scene> <id> lambertian <r> <g> <b>
+//   material <scene> <id> metal <r> <g> <b> <fuzz>
+//   material <scene> <id> dielectric <index>
+//   material <scene> <id> light <r> <g> <b>
+//   cancel <id>
+//   status [<id>]
+//   scenes
+//   shutdown
+//
+// Every reply ends with a line starting with "ok" or "error". Jobs are
+// rendered one at a time, highest priority first, on a thread of their own;
+// connections are served together, a command at a time. A material command
+// swaps the material behind a handle of a scene (lights are diffuse_light
+// materials, and handle 0 cannot be edited) from the next job of that scene
+// on; with lookdev=1, which does not combine with queue=1 or first=, that
+// job only traces the bounces after the primary hits it already has.
+class render_server
+{
+ public:
+    // Renders the job into its output file and returns whether it worked.
+    // It must bump job.rows_done as it goes and give up (returning false)
+    // once job.cancel_requested is set.
+    using renderer = std::function<bool(render_job& job)>;
+    // Applies the arguments of a material command to the scene. Returns an
+    // error message, or an empty string if the edit was accepted.
+    using editor = std::function<std::string(const std::string& scene,
+                                             std::istream& args)>;
+
+    render_server(std::string path, std::vector<std::string> scene_names,
+                  renderer render, editor edit = nullptr)
+        : socket_path(std::move(path)),
+          scenes(std::move(scene_names)),
+          render_fn(std::move(render)),
+          edit_fn(std::move(edit))
+    {
+        // Do nothing
+    }
+
+    // Serves until a client sends shutdown. Returns false if the socket
+    // could not be set up.
+    bool run(std::ostream& log);
+
+ private:
+    std::string handle(const std::string& command, bool& stop);
+    std::string submit(std::istringstream& args);
+    void work(std::ostream& log);
+
+    std::string socket_path;
+    std::vector<std::string> scenes;
+    renderer render_fn;
+    editor edit_fn;
+    render_queue queue;
+};
+
+inline bool render_server::run(std::ostream& log)
+{
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path))
+    {
+        log << "ERROR: Socket path '" << socket_path << "' is too long.\n";
+        return false;
+    }
+    std::strcpy(address.sun_path, socket_path.c_str());
+
+    const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    // A stale socket file from an earlier run would make bind fail.
+    unlink(socket_path.c_str());
+    if (listener < 0 ||
+        bind(listener, reinterpret_cast<const sockaddr*>(&address),
+             sizeof(address)) != 0 ||
+        listen(listener, 8) != 0)
+    {
+        log << "ERROR: Could not listen on '" << socket_path
+            << "': " << std::strerror(errno) << '\n';
+        if (listener >= 0)
+        {
+            close(listener);
+        }
+        return false;
+    }
+
+    log << "Listening on " << socket_path << '\n';
+
+    std::thread worker([&] { work(log); });
+    bool stop = false;
+
+    // The connections and the input each one has sent past its last full
+    // line. They are polled together, so an idle client holds up no one.
+    struct client
+    {
+        int fd;
+        std::string pending;
+    };
+    std::vector<client> clients;
+    std::vector<pollfd> watched;
+
+    while (!stop)
+    {
+        watched.assign(1, pollfd{listener, POLLIN, 0});
+        for (const auto& c : clients)
+        {
+            watched.push_back(pollfd{c.fd, POLLIN, 0});
+        }
+
+        if (poll(watched.data(), watched.size(), -1) < 0)
+        {
+            continue;
+        }
+
+        for (std::size_t i = 0; i < clients.size() && !stop; ++i)
+        {
+            if (watched[i + 1].revents == 0)
+            {
+                continue;
+            }
+
+            client& c = clients[i];
+            char buffer[4096];
+            const ssize_t count = read(c.fd, buffer, sizeof(buffer));
+            bool open = count > 0;
+            if (open)
+            {
+                c.pending.append(buffer, static_cast<std::size_t>(count));
+            }
+
+            std::size_t end;
+            while (open && !stop && (end = c.pending.find('\n')) !=
+                                        std::string::npos)
+            {
+                const std::string reply =
+                    handle(c.pending.substr(0, end), stop);
+                c.pending.erase(0, end + 1);
+                // MSG_NOSIGNAL: a client that is gone must not take the
+                // server down with a SIGPIPE.
+                open = send(c.fd, reply.data(), reply.size(),
+                            MSG_NOSIGNAL) ==
+                       static_cast<ssize_t>(reply.size());
+            }
+
+            if (!open)
+            {
+                close(c.fd);
+                c.fd = -1;
+            }
+        }
+
+        clients.erase(std::remove_if(clients.begin(), clients.end(),
+                                     [](const client& c) { return c.fd < 0; }),
+                      clients.end());
+
+        if (!stop && (watched[0].revents & POLLIN))
+        {
+            const int fd = accept(listener, nullptr, nullptr);
+            if (fd >= 0)
+            {
+                clients.push_back(client{fd, {}});
+            }
+        }
+    }
+
+    for (const auto& c : clients)
+    {
+        close(c.fd);
+    }
+
+    queue.close();
+    worker.join();
+    close(listener);
+    unlink(socket_path.c_str());
+
+    return true;
+}
+
+inline std::string render_server::handle(const std::string& command,
+                                         bool& stop)
+{
+    std::istringstream args(command);
+    std::string verb;
+    args >> verb;
+
+    if (verb == "render")
+    {
+        return submit(args);
+    }
+
+    if (verb == "material" && edit_fn)
+    {
+        std::string scene;
+        args >> scene;
+        if (std::find(scenes.begin(), scenes.end(), scene) == scenes.end())
+        {
+            return "error unknown scene '" + scene + "'\n";
+        }
+
+        const std::string error = edit_fn(scene, args);
+
+        return error.empty() ? "ok replaced in " + scene +
+                                   " from the next job\n"
+                             : "error " + error + '\n';
+    }
+
+    if (verb == "cancel")
+    {
+        std::uint64_t id = 0;
+        if (!(args >> id))
+        {
+            return "error usage: cancel <id>\n";
+        }
+
+        return queue.cancel(id) ? "ok cancelling " + std::to_string(id) + '\n'
+                                : "error no pending job " +
+                                      std::to_string(id) + '\n';
+    }
+
+    if (verb == "status")
+    {
+        std::vector<std::shared_ptr<render_job>> jobs;
+        std::uint64_t id = 0;
+        if (args >> id)
+        {
+            if (auto job = queue.find(id))
+            {
+                jobs.push_back(std::move(job));
+            }
+            else
+            {
+                return "error no job " + std::to_string(id) + '\n';
+            }
+        }
+        else
+        {
+            jobs = queue.jobs();
+        }
+
+        std::ostringstream reply;
+        for (const auto& job : jobs)
+        {
+            reply << job->id << ' ' << to_string(job->status) << " priority "
+                  << job->priority << ' ' << job->scene << ' '
+                  << job->rows_done << '/' << job->height << " rows -> "
+                  << job->output << '\n';
+        }
+        reply << "ok\n";
+
+        return reply.str();
+    }
+
+    if (verb == "scenes")
+    {
+        std::string reply;
+        for (const auto& name : scenes)
+        {
+            reply += name + '\n';
+        }
+
+        return reply + "ok\n";
+    }
+
+    if (verb == "shutdown")
+    {
+        // Stop the job in progress too; the queued ones are dropped when
+        // the queue closes.
+        for (const auto& job : queue.jobs())
+        {
+            queue.cancel(job->id);
+        }
+        stop = true;
+
+        return "ok shutting down\n";
+    }
+
+    return "error unknown command '" + verb + "'\n";
+}
+
+inline std::string render_server::submit(std::istringstream& args)
+{
+    auto job = std::make_shared<render_job>();
+
+    const std::string error = job->parse(args);
+    if (!error.empty())
+    {
+        return "error " + error + '\n';
+    }
+
+    if (std::find(scenes.begin(), scenes.end(), job->scene) == scenes.end())
+    {
+        return "error unknown scene '" + job->scene + "'\n";
+    }
+
+    if (job->output.empty())
+    {
+        return "error missing out=<file>\n";
+    }
+
+    return "ok queued " + std::to_string(queue.push(std::move(job))->id) +
+           '\n';
+}
+
+inline void render_server::work(std::ostream& log)
+{
+    while (const auto job = queue.pop())
+    {
+        log << "Job " << job->id << ": rendering " << job->scene << " into "
+            << job->output << '\n';
+
+        const bool rendered = render_fn(*job);
+
+        if (job->cancel_requested)
+        {
+            job->status = render_job::state::cancelled;
+        }
+        else
+        {
+            job->status =
+                rendered ? render_job::state::done : render_job::state::failed;
+        }
+
+        log << "Job " << job->id << ": " << to_string(job->status) << '\n';
+    }
+}
+
+#endif
@@ -27,6 +27,20 @@ class rotate_y final : public hittable
         return hasbox;
     }
 
+    // Rotates from world space into object space.
+    vec3 to_object(const vec3& v) const
+    {
+        return vec3{cos_theta * v[0] - sin_theta * v[2], v[1],
+                    sin_theta * v[0] + cos_theta * v[2]};
+    }
+
+    // Rotates from object space back into world space.
+    vec3 to_world(const vec3& v) const
+    {
+        return vec3{cos_theta * v[0] + sin_theta * v[2], v[1],
+                    -sin_theta * v[0] + cos_theta * v[2]};
+    }
+
     std::shared_ptr<hittable> ptr;
     double sin_theta;
     double cos_theta;
@@ -75,33 +89,26 @@ inline rotate_y::rotate_y(std::shared_ptr<hittable> p, double angle)
 inline bool rotate_y::hit(const ray& r, double t_min, double t_max,
                           hit_record& rec) const
 {
-    auto origin = r.origin();
-    auto direction = r.direction();
-
-    origin[0] = cos_theta * r.origin()[0] - sin_theta * r.origin()[2];
-    origin[2] = sin_theta * r.origin()[0] + cos_theta * r.origin()[2];
-
-    direction[0] = cos_theta * r.direction()[0] - sin_theta * r.direction()[2];
-    direction[2] = sin_theta * r.direction()[0] + cos_theta * r.direction()[2];
-
-    const ray rotated_r{origin, direction, r.time()};
+    ray rotated_r{to_object(r.origin()), to_object(r.direction()), r.time()};
+    if (r.has_differentials)
+    {
+        rotated_r.set_differentials(
+            to_object(r.rx_origin), to_object(r.rx_direction),
+            to_object(r.ry_origin), to_object(r.ry_direction));
+    }
 
     if (!ptr->hit(rotated_r, t_min, t_max, rec))
     {
         return false;
     }
 
-    auto p = rec.p;
-    auto normal = rec.normal;
-
-    p[0] = cos_theta * rec.p[0] + sin_theta * rec.p[2];
-    p[2] = -sin_theta * rec.p[0] + cos_theta * rec.p[2];
-
-    normal[0] = cos_theta * rec.normal[0] + sin_theta * rec.normal[2];
-    normal[2] = -sin_theta * rec.normal[0] + cos_theta * rec.normal[2];
-
-    rec.p = p;
-    rec.set_face_normal(rotated_r, normal);
+    rec.p = to_world(rec.p);
+    rec.dpdu = to_world(rec.dpdu);
+    rec.dpdv = to_world(rec.dpdv);
+    // Rotating keeps the normal facing the ray, and front_face as it was.
+    rec.normal = to_world(rec.normal);
+    // A medium tracks light in its own space (see hit_record::medium).
+    rec.medium = nullptr;
 
     return true;
 }
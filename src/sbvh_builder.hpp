@@ -0,0 +1,586 @@
+// Copyright (c) 2020 Chris Ohk
+
+// I am making my contributions/submissions to this project solely in my
+// personal capacity and are not conveying any rights to any intellectual
+// property of any third parties.
+
+// It is based on Ray Tracing: The Rest of Your Life book.
+// References: https://raytracing.github.io
+
+#ifndef RAY_TRACING_SBVH_BUILDER_HPP
+#define RAY_TRACING_SBVH_BUILDER_HPP
+
+#include "bvh.hpp"
+#include "sphere.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+// Builds a bvh_node tree with the surface area heuristic, considering
+// spatial splits as well as object splits (Stich et al. 2009). Large
+// objects that overlap everything (ground spheres, walls) make every object
+// split produce overlapping children; a spatial split cuts such an object
+// at the split plane instead, and references it from both sides with its
+// bounds clipped to each.
+//
+// Clipping is exact for axis-aligned boxes and rects, whose bounds are the
+// objects themselves, and follows the surface for spheres. The tree may
+// hold at most memory_budget times as many references as there are
+// objects. Its node bounds are the clipped ones, so refitting the tree
+// loosens them back to the plain bounds of the objects.
+class sbvh_builder
+{
+ public:
+    struct statistics
+    {
+        std::size_t objects = 0;
+        std::size_t references = 0;
+        std::size_t object_splits = 0;
+        std::size_t spatial_splits = 0;
+        // Straddling references kept on one side of a spatial split.
+        std::size_t unsplit = 0;
+    };
+
+    static const int bins = 32;
+    // Below this depth, objects are split at the median, so that the depth
+    // stays within what the traversal of bvh_node can take.
+    static const int max_depth = 48;
+
+    // memory_budget: the most references the tree may hold, relative to
+    // the number of objects; 1 disables spatial splits. overlap_threshold:
+    // spatial splits are only tried where the children of the best object
+    // split overlap by more than this fraction of the area of the root.
+    explicit sbvh_builder(double memory_budget = 1.5,
+                          double overlap_threshold = 1e-5)
+        : budget(memory_budget), alpha(overlap_threshold)
+    {
+        // Do nothing
+    }
+
+    // Returns the root of a tree over objects, bounded over [time0, time1]
+    // and allocated from arena if one is given. A single object is returned
+    // as is, and no objects give nullptr.
+    std::shared_ptr<hittable> build(
+        const std::vector<std::shared_ptr<hittable>>& objects, double time0,
+        double time1, scene_arena* arena = nullptr);
+
+    const statistics& stats() const
+    {
+        return counters;
+    }
+
+ private:
+    struct reference
+    {
+        aabb box;
+        std::size_t index = 0;
+    };
+
+    struct split
+    {
+        double cost = infinity;
+        int axis = -1;
+        // Bins [0, bin] go left.
+        int bin = 0;
+        bool spatial = false;
+        // The bins span [origin, origin + bins / scale) along the axis.
+        double origin = 0.0;
+        double scale = 0.0;
+        aabb left_box, right_box;
+        std::size_t left_count = 0, right_count = 0;
+    };
+
+    static aabb empty_box()
+    {
+        return aabb(point3(infinity, infinity, infinity),
+                    point3(-infinity, -infinity, -infinity));
+    }
+    static bool is_empty(const aabb& b)
+    {
+        return b.min().x() > b.max().x() || b.min().y() > b.max().y() ||
+               b.min().z() > b.max().z();
+    }
+    static double area(const aabb& b)
+    {
+        return is_empty(b) ? 0.0 : b.surface_area();
+    }
+    static aabb overlap(const aabb& a, const aabb& b);
+    static int bin_of(double x, double origin, double scale);
+
+    std::shared_ptr<hittable> subdivide(std::vector<reference>& refs,
+                                        int depth);
+    split find_object_split(const std::vector<reference>& refs) const;
+    split find_spatial_split(const std::vector<reference>& refs,
+                             const aabb& bounds) const;
+    void partition_object(const std::vector<reference>& refs, const split& s,
+                          std::vector<reference>& left,
+                          std::vector<reference>& right) const;
+    void partition_spatial(const std::vector<reference>& refs, split s,
+                           std::vector<reference>& left,
+                           std::vector<reference>& right);
+    // The part of a reference within [low, high] along axis, empty if the
+    // object does not reach into it.
+    reference clip(const reference& ref, int axis, double low,
+                   double high) const;
+
+    double budget;
+    double alpha;
+
+    // State of the build under way.
+    const std::vector<std::shared_ptr<hittable>>* source = nullptr;
+    std::vector<const sphere*> spheres;
+    double start_time = 0.0, end_time = 0.0;
+    scene_arena* nodes = nullptr;
+    double root_area = 0.0;
+    std::size_t reference_limit = 0;
+    statistics counters;
+};
+
+inline std::shared_ptr<hittable> sbvh_builder::build(
+    const std::vector<std::shared_ptr<hittable>>& objects, double time0,
+    double time1, scene_arena* arena)
+{
+    counters = statistics{};
+    counters.objects = counters.references = objects.size();
+
+    if (objects.size() < 2)
+    {
+        return objects.empty() ? nullptr : objects.front();
+    }
+
+    source = &objects;
+    start_time = time0;
+    end_time = time1;
+    nodes = arena;
+    reference_limit = static_cast<std::size_t>(
+        std::max(1.0, budget) * static_cast<double>(objects.size()));
+
+    std::vector<reference> refs(objects.size());
+    spheres.assign(objects.size(), nullptr);
+    aabb bounds = empty_box();
+
+    for (std::size_t i = 0; i < objects.size(); ++i)
+    {
+        if (!objects[i]->bounding_box(time0, time1, refs[i].box))
+        {
+            std::cerr << "No bounding box in sbvh_builder.\n";
+        }
+
+        refs[i].index = i;
+        bounds = surrounding_box(bounds, refs[i].box);
+
+        // A moving sphere has no single center to clip around.
+        spheres[i] = dynamic_cast<const sphere*>(objects[i].get());
+    }
+
+    root_area = area(bounds);
+
+    return subdivide(refs, 0);
+}
+
+inline aabb sbvh_builder::overlap(const aabb& a, const aabb& b)
+{
+    point3 low, high;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        low[axis] = std::max(a.min()[axis], b.min()[axis]);
+        high[axis] = std::min(a.max()[axis], b.max()[axis]);
+    }
+
+    return aabb(low, high);
+}
+
+inline int sbvh_builder::bin_of(double x, double origin, double scale)
+{
+    return std::clamp(static_cast<int>((x - origin) * scale), 0, bins - 1);
+}
+
+inline std::shared_ptr<hittable> sbvh_builder::subdivide(
+    std::vector<reference>& refs, int depth)
+{
+    if (refs.size() == 1)
+    {
+        return (*source)[refs.front().index];
+    }
+
+    aabb bounds = empty_box();
+    for (const auto& ref : refs)
+    {
+        bounds = surrounding_box(bounds, ref.box);
+    }
+
+    std::vector<reference> left, right;
+
+    if (depth >= max_depth)
+    {
+        // Median split along the longest axis of the centroids.
+        const vec3 extent = bounds.max() - bounds.min();
+        const int axis = extent.x() >= extent.y()
+                             ? (extent.x() >= extent.z() ? 0 : 2)
+                             : (extent.y() >= extent.z() ? 1 : 2);
+        const auto mid = refs.begin() + refs.size() / 2;
+        std::nth_element(refs.begin(), mid, refs.end(),
+                         [axis](const reference& a, const reference& b) {
+                             return a.box.min()[axis] + a.box.max()[axis] <
+                                    b.box.min()[axis] + b.box.max()[axis];
+                         });
+        left.assign(refs.begin(), mid);
+        right.assign(mid, refs.end());
+    }
+    else
+    {
+        const split object = find_object_split(refs);
+        split best = object;
+
+        if (counters.references < reference_limit && object.axis >= 0 &&
+            area(overlap(object.left_box, object.right_box)) >
+                alpha * root_area)
+        {
+            const split spatial = find_spatial_split(refs, bounds);
+            if (spatial.cost < best.cost)
+            {
+                best = spatial;
+            }
+        }
+
+        if (best.spatial)
+        {
+            partition_spatial(refs, best, left, right);
+            if (left.empty() || right.empty())
+            {
+                left.clear();
+                right.clear();
+                best = object;
+            }
+            else
+            {
+                ++counters.spatial_splits;
+            }
+        }
+
+        if (!best.spatial)
+        {
+            partition_object(refs, best, left, right);
+            ++counters.object_splits;
+        }
+    }
+
+    // Free the parent's references before going down.
+    std::vector<reference>().swap(refs);
+
+    auto l = subdivide(left, depth + 1);
+    auto r = subdivide(right, depth + 1);
+
+    std::shared_ptr<bvh_node> node =
+        nodes ? nodes->make<bvh_node>(std::move(l), std::move(r), start_time,
+                                      end_time)
+              : std::make_shared<bvh_node>(std::move(l), std::move(r),
+                                           start_time, end_time);
+
+    // The children bound whole objects; the references only bound the
+    // parts of them within this node.
+    node->box0 = node->box1 =
+        overlap(bounds, surrounding_box(node->box0, node->box1));
+    node->moving = false;
+
+    return node;
+}
+
+inline sbvh_builder::split sbvh_builder::find_object_split(
+    const std::vector<reference>& refs) const
+{
+    aabb centroids = empty_box();
+    for (const auto& ref : refs)
+    {
+        const point3 c = 0.5 * (ref.box.min() + ref.box.max());
+        centroids = surrounding_box(centroids, aabb(c, c));
+    }
+
+    split best;
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const auto extent = centroids.max()[axis] - centroids.min()[axis];
+        if (extent <= 0.0)
+        {
+            continue;
+        }
+
+        const double origin = centroids.min()[axis];
+        const double scale = bins / extent;
+        aabb boxes[bins];
+        std::size_t counts[bins] = {};
+        std::fill(boxes, boxes + bins, empty_box());
+
+        for (const auto& ref : refs)
+        {
+            const int b = bin_of(
+                0.5 * (ref.box.min()[axis] + ref.box.max()[axis]), origin,
+                scale);
+            boxes[b] = surrounding_box(boxes[b], ref.box);
+            ++counts[b];
+        }
+
+        // Right-hand sums, then a sweep from the left.
+        aabb right_boxes[bins];
+        std::size_t right_counts[bins];
+        right_boxes[bins - 1] = boxes[bins - 1];
+        right_counts[bins - 1] = counts[bins - 1];
+        for (int b = bins - 2; b >= 0; --b)
+        {
+            right_boxes[b] = surrounding_box(right_boxes[b + 1], boxes[b]);
+            right_counts[b] = right_counts[b + 1] + counts[b];
+        }
+
+        aabb left_box = empty_box();
+        std::size_t left_count = 0;
+        for (int b = 0; b + 1 < bins; ++b)
+        {
+            left_box = surrounding_box(left_box, boxes[b]);
+            left_count += counts[b];
+            if (left_count == 0 || right_counts[b + 1] == 0)
+            {
+                continue;
+            }
+
+            const auto cost = area(left_box) * left_count +
+                              area(right_boxes[b + 1]) * right_counts[b + 1];
+            if (cost < best.cost)
+            {
+                best.cost = cost;
+                best.axis = axis;
+                best.bin = b;
+                best.origin = origin;
+                best.scale = scale;
+                best.left_box = left_box;
+                best.right_box = right_boxes[b + 1];
+                best.left_count = left_count;
+                best.right_count = right_counts[b + 1];
+            }
+        }
+    }
+
+    return best;
+}
+
+inline sbvh_builder::split sbvh_builder::find_spatial_split(
+    const std::vector<reference>& refs, const aabb& bounds) const
+{
+    split best;
+    best.spatial = true;
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const auto extent = bounds.max()[axis] - bounds.min()[axis];
+        if (extent <= 0.0)
+        {
+            continue;
+        }
+
+        const double origin = bounds.min()[axis];
+        const double scale = bins / extent;
+        const double width = extent / bins;
+        aabb boxes[bins];
+        std::size_t entries[bins] = {}, exits[bins] = {};
+        std::fill(boxes, boxes + bins, empty_box());
+
+        // Each reference adds its clipped part to every bin it crosses, and
+        // is counted where it enters and where it leaves.
+        for (const auto& ref : refs)
+        {
+            const int first = bin_of(ref.box.min()[axis], origin, scale);
+            const int last =
+                std::max(first, bin_of(ref.box.max()[axis], origin, scale));
+
+            for (int b = first; b <= last; ++b)
+            {
+                const reference part =
+                    first == last
+                        ? ref
+                        : clip(ref, axis, origin + b * width,
+                               origin + (b + 1) * width);
+                if (!is_empty(part.box))
+                {
+                    boxes[b] = surrounding_box(boxes[b], part.box);
+                }
+            }
+
+            ++entries[first];
+            ++exits[last];
+        }
+
+        aabb right_boxes[bins];
+        std::size_t right_counts[bins];
+        right_boxes[bins - 1] = boxes[bins - 1];
+        right_counts[bins - 1] = exits[bins - 1];
+        for (int b = bins - 2; b >= 0; --b)
+        {
+            right_boxes[b] = surrounding_box(right_boxes[b + 1], boxes[b]);
+            right_counts[b] = right_counts[b + 1] + exits[b];
+        }
+
+        aabb left_box = empty_box();
+        std::size_t left_count = 0;
+        for (int b = 0; b + 1 < bins; ++b)
+        {
+            left_box = surrounding_box(left_box, boxes[b]);
+            left_count += entries[b];
+            if (left_count == 0 || right_counts[b + 1] == 0)
+            {
+                continue;
+            }
+
+            const auto cost = area(left_box) * left_count +
+                              area(right_boxes[b + 1]) * right_counts[b + 1];
+            if (cost < best.cost)
+            {
+                best.cost = cost;
+                best.axis = axis;
+                best.bin = b;
+                best.origin = origin;
+                best.scale = scale;
+                best.left_box = left_box;
+                best.right_box = right_boxes[b + 1];
+                best.left_count = left_count;
+                best.right_count = right_counts[b + 1];
+            }
+        }
+    }
+
+    return best;
+}
+
+inline void sbvh_builder::partition_object(
+    const std::vector<reference>& refs, const split& s,
+    std::vector<reference>& left, std::vector<reference>& right) const
+{
+    if (s.axis < 0)
+    {
+        // All the centroids coincide: any halves will do.
+        const auto mid = refs.begin() + refs.size() / 2;
+        left.assign(refs.begin(), mid);
+        right.assign(mid, refs.end());
+        return;
+    }
+
+    for (const auto& ref : refs)
+    {
+        const double c = 0.5 * (ref.box.min()[s.axis] + ref.box.max()[s.axis]);
+        (bin_of(c, s.origin, s.scale) <= s.bin ? left : right).push_back(ref);
+    }
+}
+
+inline void sbvh_builder::partition_spatial(const std::vector<reference>& refs,
+                                            split s,
+                                            std::vector<reference>& left,
+                                            std::vector<reference>& right)
+{
+    const double plane = s.origin + (s.bin + 1) / s.scale;
+
+    for (const auto& ref : refs)
+    {
+        const int first = bin_of(ref.box.min()[s.axis], s.origin, s.scale);
+        const int last =
+            std::max(first, bin_of(ref.box.max()[s.axis], s.origin, s.scale));
+
+        if (last <= s.bin)
+        {
+            left.push_back(ref);
+            continue;
+        }
+        if (first > s.bin)
+        {
+            right.push_back(ref);
+            continue;
+        }
+
+        // Straddling: keep the reference whole on one side if that is
+        // cheaper than splitting it.
+        const double split_cost = area(s.left_box) * s.left_count +
+                                  area(s.right_box) * s.right_count;
+        const aabb left_grown = surrounding_box(s.left_box, ref.box);
+        const aabb right_grown = surrounding_box(s.right_box, ref.box);
+        const double left_cost = area(left_grown) * s.left_count +
+                                 area(s.right_box) * (s.right_count - 1);
+        const double right_cost = area(s.left_box) * (s.left_count - 1) +
+                                  area(right_grown) * s.right_count;
+
+        if (left_cost < split_cost && left_cost <= right_cost)
+        {
+            left.push_back(ref);
+            s.left_box = left_grown;
+            --s.right_count;
+            ++counters.unsplit;
+            continue;
+        }
+        if (right_cost < split_cost)
+        {
+            right.push_back(ref);
+            s.right_box = right_grown;
+            --s.left_count;
+            ++counters.unsplit;
+            continue;
+        }
+
+        const reference left_part = clip(ref, s.axis, -infinity, plane);
+        const reference right_part = clip(ref, s.axis, plane, infinity);
+        if (!is_empty(left_part.box))
+        {
+            left.push_back(left_part);
+        }
+        if (!is_empty(right_part.box))
+        {
+            right.push_back(right_part);
+        }
+        if (!is_empty(left_part.box) && !is_empty(right_part.box))
+        {
+            ++counters.references;
+        }
+    }
+}
+
+inline sbvh_builder::reference sbvh_builder::clip(const reference& ref,
+                                                  int axis, double low,
+                                                  double high) const
+{
+    reference part = ref;
+    point3 lo = ref.box.min(), hi = ref.box.max();
+    lo[axis] = std::max(lo[axis], low);
+    hi[axis] = std::min(hi[axis], high);
+
+    // A sphere within the box lies, along each axis, in a slab whose
+    // section of the sphere is at most a disk of the radius left at the
+    // slab face nearest to the center.
+    if (const sphere* s = spheres[ref.index])
+    {
+        const double r = s->radius;
+        for (int a = 0; a < 3 && lo[a] <= hi[a]; ++a)
+        {
+            const double c = s->center[a];
+            const double d = c < lo[a] ? lo[a] - c : c > hi[a] ? c - hi[a] : 0;
+            if (d >= r)
+            {
+                lo[a] = infinity;
+                break;
+            }
+
+            const double section = std::sqrt(r * r - d * d);
+            for (int b = 0; b < 3; ++b)
+            {
+                if (b != a)
+                {
+                    lo[b] = std::max(lo[b], s->center[b] - section);
+                    hi[b] = std::min(hi[b], s->center[b] + section);
+                }
+            }
+        }
+    }
+
+    part.box = aabb(lo, hi);
+
+    return part;
+}
+
+#endif
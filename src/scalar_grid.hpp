@@ -0,0 +1,175 @@
+// Copyright (c) 2020 Chris Ohk
+
+// I am making my contributions/submissions to this project solely in my
+// personal capacity and are not conveying any rights to any intellectual
+// property of any third parties.
+
+// It is based on Ray Tracing: The Rest of Your Life book.
+// References: https://raytracing.github.io
+
+#ifndef RAY_TRACING_SCALAR_GRID_HPP
+#define RAY_TRACING_SCALAR_GRID_HPP
+
+#include "aabb.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// A scalar field sampled on the vertices of a regular grid spanning an
+// axis-aligned box, reconstructed with trilinear interpolation.
+class scalar_grid
+{
+ public:
+    scalar_grid() = default;
+    scalar_grid(const aabb& b, int x, int y, int z)
+        : bounds(b),
+          nx(x),
+          ny(y),
+          nz(z),
+          values(static_cast<std::size_t>(x) * y * z, 0.0f)
+    {
+        // Do nothing
+    }
+
+    bool empty() const
+    {
+        return values.empty();
+    }
+
+    bool contains(const point3& p) const
+    {
+        for (int a = 0; a < 3; ++a)
+        {
+            if (p[a] < bounds.min()[a] || p[a] > bounds.max()[a])
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Position of the vertex (i, j, k).
+    point3 vertex(int i, int j, int k) const
+    {
+        const vec3 extent = bounds.max() - bounds.min();
+
+        return bounds.min() +
+               vec3{extent.x() * i / ffmax(nx - 1, 1),
+                    extent.y() * j / ffmax(ny - 1, 1),
+                    extent.z() * k / ffmax(nz - 1, 1)};
+    }
+
+    float& at(int i, int j, int k)
+    {
+        return values[(static_cast<std::size_t>(k) * ny + j) * nx + i];
+    }
+
+    float at(int i, int j, int k) const
+    {
+        return values[(static_cast<std::size_t>(k) * ny + j) * nx + i];
+    }
+
+    // Trilinear lookup; points outside the box clamp to its faces.
+    double sample(const point3& p) const;
+
+    // Reads a single-channel float32 grid in the Mitsuba .vol format. The
+    // voxels become the vertices of the grid. Returns an empty grid if the
+    // file is missing or not in that format.
+    static scalar_grid load_vol(const std::string& path);
+
+    aabb bounds;
+    int nx = 0, ny = 0, nz = 0;
+    std::vector<float> values;
+};
+
+inline double scalar_grid::sample(const point3& p) const
+{
+    const int n[3] = {nx, ny, nz};
+    int i0[3], i1[3];
+    double f[3];
+
+    for (int a = 0; a < 3; ++a)
+    {
+        const auto extent = bounds.max()[a] - bounds.min()[a];
+        const auto x =
+            extent > 0 ? (p[a] - bounds.min()[a]) / extent * (n[a] - 1) : 0.0;
+        const auto clamped = std::clamp(x, 0.0, static_cast<double>(n[a] - 1));
+        const auto fl = std::floor(clamped);
+
+        i0[a] = static_cast<int>(fl);
+        i1[a] = i0[a] + 1 < n[a] ? i0[a] + 1 : i0[a];
+        f[a] = clamped - fl;
+    }
+
+    const auto lerp = [](double a, double b, double t) {
+        return a + t * (b - a);
+    };
+
+    const auto corner = [&](int dx, int dy, int dz) {
+        return static_cast<double>(at(dx ? i1[0] : i0[0], dy ? i1[1] : i0[1],
+                                      dz ? i1[2] : i0[2]));
+    };
+
+    const auto x00 = lerp(corner(0, 0, 0), corner(1, 0, 0), f[0]);
+    const auto x10 = lerp(corner(0, 1, 0), corner(1, 1, 0), f[0]);
+    const auto x01 = lerp(corner(0, 0, 1), corner(1, 0, 1), f[0]);
+    const auto x11 = lerp(corner(0, 1, 1), corner(1, 1, 1), f[0]);
+
+    return lerp(lerp(x00, x10, f[1]), lerp(x01, x11, f[1]), f[2]);
+}
+
+inline scalar_grid scalar_grid::load_vol(const std::string& path)
+{
+    std::ifstream in(path, std::ios::binary);
+    char magic[4];
+    std::int32_t header[5];
+    float box[6];
+
+    if (!in.read(magic, sizeof(magic)) || magic[0] != 'V' ||
+        magic[1] != 'O' || magic[2] != 'L' || magic[3] != 3 ||
+        !in.read(reinterpret_cast<char*>(header), sizeof(header)) ||
+        !in.read(reinterpret_cast<char*>(box), sizeof(box)))
+    {
+        return scalar_grid{};
+    }
+
+    // header: encoding (1 = float32), x, y and z resolutions, channels.
+    if (header[0] != 1 || header[1] <= 0 || header[2] <= 0 ||
+        header[3] <= 0 || header[4] != 1)
+    {
+        return scalar_grid{};
+    }
+
+    // Check the voxel count against the file before allocating for it.
+    const auto data_start = in.tellg();
+    in.seekg(0, std::ios::end);
+    const auto data_size = static_cast<std::uint64_t>(in.tellg() - data_start);
+    in.seekg(data_start);
+
+    const std::uint64_t voxels = static_cast<std::uint64_t>(header[1]) *
+                                 static_cast<std::uint64_t>(header[2]) *
+                                 static_cast<std::uint64_t>(header[3]);
+    if (!in || voxels > data_size / sizeof(float))
+    {
+        return scalar_grid{};
+    }
+
+    scalar_grid grid(aabb(point3(box[0], box[1], box[2]),
+                          point3(box[3], box[4], box[5])),
+                     header[1], header[2], header[3]);
+
+    if (!in.read(reinterpret_cast<char*>(grid.values.data()),
+                 static_cast<std::streamsize>(grid.values.size() *
+                                              sizeof(float))))
+    {
+        return scalar_grid{};
+    }
+
+    return grid;
+}
+
+#endif
@@ -0,0 +1,58 @@
+// Copyright (c) 2020 Chris Ohk
+
+// I am making my contributions/submissions to this project solely in my
+// personal capacity and are not conveying any rights to any intellectual
+// property of any third parties.
+
+// It is based on Ray Tracing: The Rest of Your Life book.
+// References: https://raytracing.github.io
+
+#ifndef RAY_TRACING_SCENE_HPP
+#define RAY_TRACING_SCENE_HPP
+
+#include "hittable_list.hpp"
+#include "material_table.hpp"
+#include "scene_arena.hpp"
+
+// How the scene compiler builds the BVHs of a scene. Median splits are the
+// default; Morton code builds (see lbvh_builder) take linear time, for
+// scenes that are rebuilt often, and treelet restructuring improves their
+// trees. Spatial splits (see sbvh_builder) build the best trees for scenes
+// with large overlapping objects, and take the longest.
+enum class bvh_build_method
+{
+    median_split,
+    morton,
+    morton_treelets,
+    spatial_split
+};
+
+// How the scene compiler lays out the BVHs it builds: as bvh_nodes, or
+// collapsed into a compressed 8-wide tree (see wide_bvh), which takes much
+// less memory but is bounded over the whole shutter interval.
+enum class bvh_node_format
+{
+    binary,
+    compressed_wide
+};
+
+// Everything the scene builders create: the objects and the materials they
+// refer to by handle, all allocated from the scene's arena. The arena is
+// declared first so that it is destroyed last, after every object in it.
+struct scene
+{
+    scene() = default;
+    scene(scene&&) = default;
+
+    // A defaulted assignment would move the arena first, freeing the blocks
+    // of our old objects while world and materials still refer to them.
+    scene& operator=(scene&&) = delete;
+
+    scene_arena arena;
+    material_table materials;
+    hittable_list world;
+    bvh_build_method bvh_method = bvh_build_method::median_split;
+    bvh_node_format bvh_format = bvh_node_format::binary;
+};
+
+#endif
@@ -0,0 +1,151 @@
+// Copyright (c) 2020 Chris Ohk
+
+// I am making my contributions/submissions to this project solely in my
+// personal capacity and are not conveying any rights to any intellectual
+// property of any third parties.
+
+// It is based on Ray Tracing: The Rest of Your Life book.
+// References: https://raytracing.github.io
+
+#ifndef RAY_TRACING_SCENE_ANIMATOR_HPP
+#define RAY_TRACING_SCENE_ANIMATOR_HPP
+
+#include "bvh.hpp"
+#include "scene.hpp"
+#include "scene_compiler.hpp"
+
+#include <chrono>
+#include <memory>
+
+// Keeps the compiled world of a scene up to date through the frames of an
+// animation, each frame being a shutter interval. The first frame compiles
+// the world. Later ones refit its BVH bottom-up, which takes linear time and
+// keeps the topology; as objects move apart, the tree gets looser, and once
+// its surface area heuristic cost has grown past rebuild_threshold times its
+// cost right after the last build, the world is compiled again instead.
+//
+// Compressed wide BVHs cannot be refit, so scenes using them are compiled
+// again every frame. Each build compiles the world the scene had before the
+// first frame into an arena of its own, which is released with the build it
+// replaces, so long animations run in constant memory. The scene gets that
+// world back when the animator goes away.
+class scene_animator
+{
+ public:
+    struct statistics
+    {
+        int refits = 0;
+        int rebuilds = 0;
+        double refit_seconds = 0.0;
+        double rebuild_seconds = 0.0;
+        // Cost of the tree of the last frame relative to the last build.
+        double growth = 1.0;
+    };
+
+    explicit scene_animator(scene& s, double rebuild_threshold = 1.2)
+        : target(s), threshold(rebuild_threshold)
+    {
+        // Do nothing
+    }
+
+    ~scene_animator();
+
+    scene_animator(const scene_animator&) = delete;
+    scene_animator& operator=(const scene_animator&) = delete;
+
+    // Updates the world for a frame over [time0, time1]. Returns true if it
+    // was rebuilt.
+    bool advance(double time0, double time1);
+
+    const statistics& stats() const
+    {
+        return counters;
+    }
+
+ private:
+    // The top of the compiled world, if it is a BVH.
+    bvh_node* root() const;
+
+    scene& target;
+    double threshold;
+    // The world before the first frame, which every build starts from, and
+    // the arena of the current build.
+    hittable_list source;
+    std::unique_ptr<scene_arena> build_arena;
+    bool compiled = false;
+    double built_cost = 0.0;
+    statistics counters;
+};
+
+inline bool scene_animator::advance(double time0, double time1)
+{
+    using clock = std::chrono::steady_clock;
+    const auto start = clock::now();
+
+    if (compiled && target.bvh_format == bvh_node_format::binary)
+    {
+        bvh_node* const node = root();
+        if (!node)
+        {
+            return false;
+        }
+
+        node->refit(time0, time1);
+        counters.growth = built_cost > 0.0 ? node->sah_cost() / built_cost
+                                           : 1.0;
+        ++counters.refits;
+        counters.refit_seconds +=
+            std::chrono::duration<double>(clock::now() - start).count();
+
+        if (counters.growth <= threshold)
+        {
+            return false;
+        }
+    }
+
+    // Compiling a compiled world again only takes its BVHs apart and
+    // builds them anew. The new world only refers to the source and the new
+    // arena, so the previous build can go once it is replaced.
+    const auto rebuild_start = clock::now();
+    if (!compiled)
+    {
+        source = target.world;
+    }
+
+    auto arena = std::make_unique<scene_arena>();
+    scene_compiler compiler(*arena, time0, time1, target.bvh_method,
+                            target.bvh_format);
+    target.world = compiler.compile(source);
+    build_arena = std::move(arena);
+    compiled = true;
+
+    const bvh_node* const node = root();
+    built_cost = node ? node->sah_cost() : 0.0;
+    counters.growth = 1.0;
+    ++counters.rebuilds;
+    counters.rebuild_seconds +=
+        std::chrono::duration<double>(clock::now() - rebuild_start).count();
+
+    return true;
+}
+
+inline scene_animator::~scene_animator()
+{
+    // The compiled world lives in build_arena, which goes away with us.
+    if (compiled)
+    {
+        target.world = std::move(source);
+    }
+}
+
+inline bvh_node* scene_animator::root() const
+{
+    if (target.world.objects.empty())
+    {
+        return nullptr;
+    }
+
+    return dynamic_cast<bvh_node*>(target.world.objects.front().get());
+}
+
+#endif
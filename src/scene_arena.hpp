@@ -0,0 +1,271 @@
+// Copyright (c) 2020 Chris Ohk
+
+// I am making my contributions/submissions to this project solely in my
+// personal capacity and are not conveying any rights to any intellectual
+// property of any third parties.
+
+// It is based on Ray Tracing: The Rest of Your Life book.
+// References: https://raytracing.github.io
+
+#ifndef RAY_TRACING_SCENE_ARENA_HPP
+#define RAY_TRACING_SCENE_ARENA_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <string>
+#include <typeindex>
+#include <typeinfo>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifdef __GNUG__
+#include <cxxabi.h>
+#endif
+
+// Monotonic storage for the objects of a scene.
+//
+// Every object type gets its own pool of large blocks, so objects of the
+// same type (all the spheres, all the BVH nodes, ...) end up next to each
+// other in memory, and allocating one is a pointer bump. Objects are still
+// handed out as std::shared_ptr (the control block lives next to the object
+// in the pool), they are destroyed as usual when their last owner goes away,
+// but their memory is only released, all at once, when the arena itself is
+// destroyed. The arena must therefore outlive every object made from it.
+// Objects can be made from several threads at once (parallel BVH builds do).
+class scene_arena
+{
+ public:
+    class pool
+    {
+     public:
+        static const std::size_t block_size = 64 * 1024;
+
+        explicit pool(std::string type) : type_name(std::move(type))
+        {
+            // Do nothing
+        }
+
+        void* allocate(std::size_t size, std::size_t alignment);
+
+        const std::string& type() const
+        {
+            return type_name;
+        }
+
+        std::size_t bytes_used() const
+        {
+            return used;
+        }
+
+        std::size_t bytes_reserved() const
+        {
+            return reserved;
+        }
+
+        std::size_t allocations() const
+        {
+            return count;
+        }
+
+     private:
+        struct free_block
+        {
+            void operator()(unsigned char* p) const
+            {
+                std::free(p);
+            }
+        };
+
+        std::string type_name;
+        std::mutex mutex;
+        std::vector<std::unique_ptr<unsigned char, free_block>> blocks;
+        std::size_t offset = 0;
+        std::size_t capacity = 0;
+        std::size_t used = 0;
+        std::size_t reserved = 0;
+        std::size_t count = 0;
+    };
+
+    // Allocator handing out memory from one pool. Rebinding it (as
+    // std::allocate_shared does for the control block) keeps the pool.
+    template <typename T>
+    class allocator
+    {
+     public:
+        using value_type = T;
+
+        explicit allocator(pool* p) : target(p)
+        {
+            // Do nothing
+        }
+
+        template <typename U>
+        allocator(const allocator<U>& other) : target(other.target)
+        {
+            // Do nothing
+        }
+
+        T* allocate(std::size_t n)
+        {
+            return static_cast<T*>(
+                target->allocate(n * sizeof(T), alignof(T)));
+        }
+
+        void deallocate([[maybe_unused]] T* p,
+                        [[maybe_unused]] std::size_t n) noexcept
+        {
+            // Memory is released with the arena.
+        }
+
+        template <typename U>
+        bool operator==(const allocator<U>& other) const
+        {
+            return target == other.target;
+        }
+
+        template <typename U>
+        bool operator!=(const allocator<U>& other) const
+        {
+            return target != other.target;
+        }
+
+     private:
+        template <typename U>
+        friend class allocator;
+
+        pool* target;
+    };
+
+    scene_arena() = default;
+    scene_arena(scene_arena&&) = default;
+    scene_arena& operator=(scene_arena&&) = default;
+    scene_arena(const scene_arena&) = delete;
+    scene_arena& operator=(const scene_arena&) = delete;
+
+    // Constructs a T in the pool for T.
+    template <typename T, typename... Args>
+    std::shared_ptr<T> make(Args&&... args)
+    {
+        return std::allocate_shared<T>(allocator<T>(&pool_for<T>()),
+                                       std::forward<Args>(args)...);
+    }
+
+    std::size_t bytes_used() const;
+
+    // Writes the bytes used by each object type, largest first.
+    void report(std::ostream& out) const;
+
+ private:
+    template <typename T>
+    pool& pool_for()
+    {
+        std::lock_guard<std::mutex> lock(*pools_mutex);
+        auto& p = pools[std::type_index(typeid(T))];
+        if (!p)
+        {
+            p = std::make_unique<pool>(type_name(typeid(T)));
+        }
+
+        return *p;
+    }
+
+    static std::string type_name(const std::type_info& info);
+
+    // Behind a pointer so that the arena stays movable.
+    std::unique_ptr<std::mutex> pools_mutex = std::make_unique<std::mutex>();
+    std::unordered_map<std::type_index, std::unique_ptr<pool>> pools;
+};
+
+inline void* scene_arena::pool::allocate(std::size_t size,
+                                         std::size_t alignment)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::size_t start = (offset + alignment - 1) / alignment * alignment;
+
+    if (blocks.empty() || start + size > capacity)
+    {
+        // Oversized objects get a block of their own.
+        capacity = std::max(block_size, size + alignment);
+        blocks.emplace_back(static_cast<unsigned char*>(std::malloc(capacity)));
+        if (!blocks.back())
+        {
+            throw std::bad_alloc();
+        }
+
+        reserved += capacity;
+        offset = 0;
+
+        // malloc only guarantees fundamental alignment.
+        const auto base = reinterpret_cast<std::uintptr_t>(blocks.back().get());
+        start = (alignment - base % alignment) % alignment;
+    }
+
+    offset = start + size;
+    used += size;
+    ++count;
+
+    return blocks.back().get() + start;
+}
+
+inline std::size_t scene_arena::bytes_used() const
+{
+    std::size_t bytes = 0;
+
+    for (const auto& entry : pools)
+    {
+        bytes += entry.second->bytes_used();
+    }
+
+    return bytes;
+}
+
+inline void scene_arena::report(std::ostream& out) const
+{
+    std::vector<const pool*> sorted;
+    for (const auto& entry : pools)
+    {
+        sorted.push_back(entry.second.get());
+    }
+
+    std::sort(sorted.begin(), sorted.end(), [](const pool* a, const pool* b) {
+        return a->bytes_used() > b->bytes_used();
+    });
+
+    std::size_t total = 0, reserved = 0;
+    for (const pool* p : sorted)
+    {
+        out << "  " << p->type() << ": " << p->allocations() << " objects, "
+            << p->bytes_used() << " bytes\n";
+        total += p->bytes_used();
+        reserved += p->bytes_reserved();
+    }
+
+    out << "  total: " << total << " bytes used, " << reserved
+        << " bytes reserved\n";
+}
+
+inline std::string scene_arena::type_name(const std::type_info& info)
+{
+#ifdef __GNUG__
+    int status = 0;
+    char* demangled =
+        abi::__cxa_demangle(info.name(), nullptr, nullptr, &status);
+    if (status == 0 && demangled)
+    {
+        std::string name = demangled;
+        std::free(demangled);
+        return name;
+    }
+#endif
+
+    return info.name();
+}
+
+#endif
@@ -0,0 +1,443 @@
+// Copyright (c) 2020 Chris Ohk
+
+// I am making my contributions/submissions to this project solely in my
+// personal capacity and are not conveying any rights to any intellectual
+// property of any third parties.
+
+// It is based on Ray Tracing: The Rest of Your Life book.
+// References: https://raytracing.github.io
+
+#ifndef RAY_TRACING_SCENE_COMPILER_HPP
+#define RAY_TRACING_SCENE_COMPILER_HPP
+
+#include "box.hpp"
+#include "bvh.hpp"
+#include "constant_medium.hpp"
+#include "flip_face.hpp"
+#include "hittable_list.hpp"
+#include "instance.hpp"
+#include "lbvh_builder.hpp"
+#include "oriented_box.hpp"
+#include "rotate_y.hpp"
+#include "sbvh_builder.hpp"
+#include "scene.hpp"
+#include "scene_arena.hpp"
+#include "transform.hpp"
+#include "translate.hpp"
+#include "wide_bvh.hpp"
+#include "xy_rect.hpp"
+#include "xz_rect.hpp"
+#include "yz_rect.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+// Rewrites a world as built by the scene builders into the form that is
+// cheapest to trace:
+//
+//  - lists and BVHs are flattened so that one BVH is built over all of
+//    their primitives,
+//  - chains of translate, rotate_y and instance are folded into a single
+//    instance with the combined transform,
+//  - a box under a rotation and translation becomes an oriented_box,
+//  - flip_face is baked into rects, and otherwise pushed down to the
+//    primitive it applies to,
+//  - constant media that aim scattering at lights are kept out of the BVH
+//    and tested after it, so that their samples are spent in front of the
+//    nearest surface and their weights are carried by the top-level list
+//    when one medium overtakes another. Worlds that are traced without
+//    being compiled still leave such media inside their BVHs, whose
+//    traversal keeps only the weight of the nearest hit.
+//
+// Objects under a transform are compiled once into a bottom-level structure
+// shared by every instance that refers to them. The input is left as is;
+// the compiled objects are allocated from the given arena.
+class scene_compiler
+{
+ public:
+    struct statistics
+    {
+        std::size_t primitives = 0;
+        std::size_t lists_flattened = 0;
+        std::size_t bvh_nodes_flattened = 0;
+        std::size_t transforms_folded = 0;
+        std::size_t flips_baked = 0;
+        std::size_t flips_kept = 0;
+        std::size_t instances = 0;
+        std::size_t oriented_boxes = 0;
+        std::size_t shared_reused = 0;
+        // Transform and flip_face wrappers a ray goes through to reach each
+        // primitive, summed over all primitives, before and after.
+        std::size_t hops_before = 0;
+        std::size_t hops_after = 0;
+        // Time spent building BVHs, and the surface area heuristic cost of
+        // the top-level one (see bvh_node::sah_cost).
+        double bvh_seconds = 0.0;
+        double bvh_cost = 0.0;
+        // Memory taken by the nodes of all the BVHs.
+        std::size_t bvh_bytes = 0;
+    };
+
+    scene_compiler(scene_arena& a, double t0, double t1,
+                   bvh_build_method bvh = bvh_build_method::median_split,
+                   bvh_node_format nodes = bvh_node_format::binary)
+        : arena(a), time0(t0), time1(t1), method(bvh), format(nodes)
+    {
+        // Do nothing
+    }
+
+    // Returns the compiled world, a single BVH over the flattened
+    // objects followed by the deferred media.
+    hittable_list compile(const hittable_list& world);
+
+    const statistics& stats() const
+    {
+        return counters;
+    }
+
+    void report(std::ostream& out) const;
+
+ private:
+    using object_list = std::vector<std::shared_ptr<hittable>>;
+
+    void flatten(const std::shared_ptr<hittable>& object, bool flip,
+                 std::size_t hops, object_list& out);
+    void add_leaf(const std::shared_ptr<hittable>& object, bool flip,
+                  std::size_t hops, object_list& out);
+    std::shared_ptr<hittable> compile_shared(
+        const std::shared_ptr<hittable>& object, bool flip, std::size_t hops);
+    std::shared_ptr<hittable> build(object_list& objects);
+
+    template <typename Rect>
+    bool bake_flip(const std::shared_ptr<hittable>& object, object_list& out);
+
+    static transform rotation_of(const rotate_y& r);
+
+    scene_arena& arena;
+    double time0, time1;
+    bvh_build_method method;
+    bvh_node_format format;
+    // Compiled bottom-level structures, by source object and orientation.
+    std::map<std::pair<const hittable*, bool>, std::shared_ptr<hittable>>
+        compiled;
+    statistics counters;
+};
+
+inline hittable_list scene_compiler::compile(const hittable_list& world)
+{
+    object_list objects;
+    for (const auto& object : world.objects)
+    {
+        flatten(object, false, 0, objects);
+    }
+
+    const auto media =
+        std::stable_partition(objects.begin(), objects.end(), [](auto& o) {
+            const auto m = dynamic_cast<const constant_medium*>(o.get());
+            return !m || !m->lights;
+        });
+    object_list deferred(std::make_move_iterator(media),
+                         std::make_move_iterator(objects.end()));
+    objects.erase(media, objects.end());
+
+    hittable_list result;
+    if (auto root = build(objects))
+    {
+        if (const auto node = dynamic_cast<const bvh_node*>(root.get()))
+        {
+            counters.bvh_cost = node->sah_cost();
+        }
+        else if (const auto wide = dynamic_cast<const wide_bvh*>(root.get()))
+        {
+            counters.bvh_cost = wide->sah_cost();
+        }
+        result.add(std::move(root));
+    }
+
+    for (auto& medium : deferred)
+    {
+        result.add(std::move(medium));
+    }
+
+    return result;
+}
+
+inline void scene_compiler::flatten(const std::shared_ptr<hittable>& object,
+                                    bool flip, std::size_t hops,
+                                    object_list& out)
+{
+    if (const auto list = dynamic_cast<const hittable_list*>(object.get()))
+    {
+        ++counters.lists_flattened;
+        for (const auto& child : list->objects)
+        {
+            flatten(child, flip, hops, out);
+        }
+        return;
+    }
+
+    if (const auto node = dynamic_cast<const bvh_node*>(object.get()))
+    {
+        ++counters.bvh_nodes_flattened;
+        flatten(node->left, flip, hops, out);
+        // Single-object nodes point both children at the same object.
+        if (node->right != node->left)
+        {
+            flatten(node->right, flip, hops, out);
+        }
+        return;
+    }
+
+    if (const auto wide = dynamic_cast<const wide_bvh*>(object.get()))
+    {
+        for (const auto& child : wide->objects())
+        {
+            flatten(child, flip, hops, out);
+        }
+        return;
+    }
+
+    // Walk down the chain of wrappers. flip_face commutes with transforms
+    // (they preserve the side of the surface the ray comes from), so it is
+    // folded along the way.
+    std::shared_ptr<hittable> inner = object;
+    transform xform;
+    std::size_t chain = 0;
+
+    while (true)
+    {
+        if (const auto t = dynamic_cast<const translate*>(inner.get()))
+        {
+            xform = xform * transform::translation(t->offset);
+            inner = t->ptr;
+        }
+        else if (const auto r = dynamic_cast<const rotate_y*>(inner.get()))
+        {
+            xform = xform * rotation_of(*r);
+            inner = r->ptr;
+        }
+        else if (const auto i = dynamic_cast<const instance*>(inner.get()))
+        {
+            xform = xform * i->xform;
+            inner = i->ptr;
+        }
+        else if (const auto f = dynamic_cast<const flip_face*>(inner.get()))
+        {
+            flip = !flip;
+            inner = f->ptr;
+            ++chain;
+            continue;
+        }
+        else
+        {
+            break;
+        }
+
+        ++counters.transforms_folded;
+        ++chain;
+    }
+
+    if (xform.is_identity())
+    {
+        if (inner == object)
+        {
+            add_leaf(inner, flip, hops, out);
+        }
+        else
+        {
+            flatten(inner, flip, hops + chain, out);
+        }
+        return;
+    }
+
+    const auto b = dynamic_cast<const box*>(inner.get());
+    if (b && !flip && xform.is_rigid())
+    {
+        ++counters.primitives;
+        ++counters.oriented_boxes;
+        counters.hops_before += hops + chain;
+        out.push_back(
+            arena.make<oriented_box>(b->box_min, b->box_max, xform, b->mp));
+        return;
+    }
+
+    auto shared = compile_shared(inner, flip, hops + chain);
+    if (shared)
+    {
+        out.push_back(arena.make<instance>(std::move(shared), xform));
+        ++counters.instances;
+    }
+}
+
+inline void scene_compiler::add_leaf(const std::shared_ptr<hittable>& object,
+                                     bool flip, std::size_t hops,
+                                     object_list& out)
+{
+    ++counters.primitives;
+    counters.hops_before += hops;
+
+    if (!flip)
+    {
+        out.push_back(object);
+        return;
+    }
+
+    if (bake_flip<xy_rect>(object, out) || bake_flip<xz_rect>(object, out) ||
+        bake_flip<yz_rect>(object, out))
+    {
+        ++counters.flips_baked;
+        return;
+    }
+
+    out.push_back(arena.make<flip_face>(object));
+    ++counters.flips_kept;
+    ++counters.hops_after;
+}
+
+template <typename Rect>
+bool scene_compiler::bake_flip(const std::shared_ptr<hittable>& object,
+                               object_list& out)
+{
+    const auto rect = dynamic_cast<const Rect*>(object.get());
+    if (!rect)
+    {
+        return false;
+    }
+
+    auto flipped = arena.make<Rect>(*rect);
+    flipped->flipped = !rect->flipped;
+    out.push_back(std::move(flipped));
+
+    return true;
+}
+
+inline std::shared_ptr<hittable> scene_compiler::compile_shared(
+    const std::shared_ptr<hittable>& object, bool flip, std::size_t hops)
+{
+    const auto key = std::make_pair(static_cast<const hittable*>(object.get()),
+                                    flip);
+    const auto iter = compiled.find(key);
+    if (iter != compiled.end())
+    {
+        ++counters.shared_reused;
+        return iter->second;
+    }
+
+    object_list objects;
+    const std::size_t primitives = counters.primitives;
+    flatten(object, flip, hops, objects);
+    // Every primitive below is reached through one instance.
+    counters.hops_after += counters.primitives - primitives;
+
+    auto result = build(objects);
+    compiled.emplace(key, result);
+
+    return result;
+}
+
+inline std::shared_ptr<hittable> scene_compiler::build(object_list& objects)
+{
+    if (objects.empty())
+    {
+        return nullptr;
+    }
+
+    if (objects.size() == 1)
+    {
+        return objects.front();
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    std::shared_ptr<hittable> result;
+
+    // A binary tree that is only collapsed into a wide one is freed once
+    // that is done, rather than staying in the arena with the scene.
+    scene_arena* const nodes =
+        format == bvh_node_format::compressed_wide ? nullptr : &arena;
+
+    if (method == bvh_build_method::median_split)
+    {
+        result = nodes ? nodes->make<bvh_node>(objects, 0, objects.size(),
+                                               time0, time1, nodes)
+                       : std::make_shared<bvh_node>(objects, 0, objects.size(),
+                                                    time0, time1);
+    }
+    else if (method == bvh_build_method::spatial_split)
+    {
+        result = sbvh_builder().build(objects, time0, time1, nodes);
+    }
+    else
+    {
+        const int passes = method == bvh_build_method::morton_treelets ? 1 : 0;
+        result = lbvh_builder(63, passes).build(objects, time0, time1, nodes);
+    }
+
+    if (const auto node = dynamic_cast<const bvh_node*>(result.get()))
+    {
+        if (format == bvh_node_format::compressed_wide)
+        {
+            auto wide = arena.make<wide_bvh>(*node, time0, time1);
+            counters.bvh_bytes += wide->memory_bytes();
+            result = std::move(wide);
+        }
+        else
+        {
+            counters.bvh_bytes += node->node_count() * sizeof(bvh_node);
+        }
+    }
+
+    counters.bvh_seconds += std::chrono::duration<double>(
+                                std::chrono::steady_clock::now() - start)
+                                .count();
+
+    return result;
+}
+
+inline transform scene_compiler::rotation_of(const rotate_y& r)
+{
+    // rotate_y only keeps the sine and cosine of its angle.
+    transform t;
+
+    t.m[0][0] = t.m[2][2] = r.cos_theta;
+    t.m[0][2] = r.sin_theta;
+    t.m[2][0] = -r.sin_theta;
+
+    t.inv[0][0] = t.inv[2][2] = r.cos_theta;
+    t.inv[0][2] = -r.sin_theta;
+    t.inv[2][0] = r.sin_theta;
+
+    return t;
+}
+
+inline void scene_compiler::report(std::ostream& out) const
+{
+    const auto per_primitive = [&](std::size_t hops) {
+        return counters.primitives
+                   ? static_cast<double>(hops) / counters.primitives
+                   : 0.0;
+    };
+
+    out << "  " << counters.primitives << " primitives, "
+        << counters.instances << " instances (" << counters.shared_reused
+        << " sharing a compiled object), " << counters.oriented_boxes
+        << " oriented boxes\n"
+        << "  flattened " << counters.lists_flattened << " lists and "
+        << counters.bvh_nodes_flattened << " BVH nodes\n"
+        << "  folded " << counters.transforms_folded << " transforms, baked "
+        << counters.flips_baked << " flip_face (" << counters.flips_kept
+        << " kept)\n"
+        << "  wrapper hops per primitive: "
+        << per_primitive(counters.hops_before) << " before, "
+        << per_primitive(counters.hops_after) << " after\n"
+        << "  BVH build: " << counters.bvh_seconds * 1000.0
+        << " ms, SAH cost " << counters.bvh_cost << ", "
+        << per_primitive(counters.bvh_bytes) << " bytes per primitive\n";
+}
+
+#endif
@@ -11,19 +11,20 @@
 #define RAY_TRACING_SPHERE_HPP
 
 #include "hittable.hpp"
+#include "onb.hpp"
 #include "vec3.hpp"
 
-#include <utility>
-
 void get_sphere_uv(const vec3& p, double& u, double& v);
+void get_sphere_partials(const vec3& p, double radius, vec3& dpdu,
+                         vec3& dpdv);
 vec3 random_to_sphere(double radius, double distance_squared);
 
 class sphere final : public hittable
 {
  public:
     sphere() = default;
-    sphere(vec3 cen, double r, std::shared_ptr<material> m)
-        : center(cen), radius(r), mat_ptr(std::move(m))
+    sphere(vec3 cen, double r, material_handle m)
+        : center(cen), radius(r), mat(m)
     {
         // Do nothing
     }
@@ -38,7 +39,7 @@ class sphere final : public hittable
 
     vec3 center;
     double radius{ 0.0 };
-    std::shared_ptr<material> mat_ptr;
+    material_handle mat{0};
 };
 
 inline bool sphere::hit(const ray& r, double t_min, double t_max,
@@ -63,7 +64,9 @@ inline bool sphere::hit(const ray& r, double t_min, double t_max,
             const vec3 outward_normal = (rec.p - center) / radius;
             rec.set_face_normal(r, outward_normal);
             get_sphere_uv((rec.p - center) / radius, rec.u, rec.v);
-            rec.mat_ptr = mat_ptr;
+            get_sphere_partials((rec.p - center) / radius, radius, rec.dpdu,
+                                rec.dpdv);
+            rec.mat = mat;
 
             return true;
         }
@@ -78,7 +81,9 @@ inline bool sphere::hit(const ray& r, double t_min, double t_max,
             const vec3 outward_normal = (rec.p - center) / radius;
             rec.set_face_normal(r, outward_normal);
             get_sphere_uv((rec.p - center) / radius, rec.u, rec.v);
-            rec.mat_ptr = mat_ptr;
+            get_sphere_partials((rec.p - center) / radius, radius, rec.dpdu,
+                                rec.dpdv);
+            rec.mat = mat;
 
             return true;
         }
@@ -131,6 +136,27 @@ inline void get_sphere_uv(const vec3& p, double& u, double& v)
     v = (theta + pi / 2) / pi;
 }
 
+inline void get_sphere_partials(const vec3& p, double radius, vec3& dpdu,
+                                vec3& dpdv)
+{
+    // p: a given point on the sphere of radius one, centered at the origin.
+    // Derivatives follow the mapping in get_sphere_uv():
+    // du/dphi = -1 / (2 * pi) and dv/dtheta = 1 / pi.
+    const auto rho = sqrt(p.x() * p.x() + p.z() * p.z());
+    dpdu = 2 * pi * radius * vec3{p.z(), 0, -p.x()};
+
+    if (rho > 0.0)
+    {
+        dpdv = pi * radius *
+               vec3{-p.y() * p.x() / rho, rho, -p.y() * p.z() / rho};
+    }
+    else
+    {
+        // Degenerate at the poles; any tangent direction will do.
+        dpdv = pi * radius * vec3{1, 0, 0};
+    }
+}
+
 inline vec3 random_to_sphere(double radius, double distance_squared)
 {
     const auto r1 = random_double();
@@ -0,0 +1,245 @@
+// Copyright (c) 2020 Chris Ohk
+
+// I am making my contributions/submissions to this project solely in my
+// personal capacity and are not conveying any rights to any intellectual
+// property of any third parties.
+
+// It is based on Ray Tracing: The Rest of Your Life book.
+// References: https://raytracing.github.io
+
+#ifndef RAY_TRACING_TCP_CONNECTION_HPP
+#define RAY_TRACING_TCP_CONNECTION_HPP
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+// A stream socket with a receive buffer, closed on destruction. Text goes
+// over it as '\n'-terminated lines and images as float arrays in network
+// byte order. It can be read from blocking (read_line, read_floats) or, after
+// poll() says there is data, with one fill() and the take_*() functions.
+class tcp_connection
+{
+ public:
+    tcp_connection() = default;
+    explicit tcp_connection(int descriptor) : fd(descriptor)
+    {
+        // Images go out in one write; do not wait for more data.
+        const int enable = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    }
+
+    tcp_connection(const tcp_connection&) = delete;
+    tcp_connection& operator=(const tcp_connection&) = delete;
+
+    tcp_connection(tcp_connection&& other) noexcept
+        : fd(std::exchange(other.fd, -1)), buffer(std::move(other.buffer))
+    {
+        // Do nothing
+    }
+
+    tcp_connection& operator=(tcp_connection&& other) noexcept
+    {
+        std::swap(fd, other.fd);
+        std::swap(buffer, other.buffer);
+        return *this;
+    }
+
+    ~tcp_connection()
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+
+    // Returns an invalid connection if host:port cannot be reached.
+    static tcp_connection connect_to(const std::string& host, int port);
+
+    bool valid() const
+    {
+        return fd >= 0;
+    }
+
+    int descriptor() const
+    {
+        return fd;
+    }
+
+    bool send_line(const std::string& line) const;
+    bool send_floats(const std::vector<float>& values) const;
+
+    // Reads whatever is available into the buffer, blocking if nothing is.
+    // Returns false once the peer is gone.
+    bool fill();
+
+    // Take a complete line (without its '\n') or count floats from the
+    // buffer, if it holds them already.
+    bool take_line(std::string& line);
+    bool take_floats(std::size_t count, std::vector<float>& values);
+
+    bool read_line(std::string& line);
+    bool read_floats(std::size_t count, std::vector<float>& values);
+
+ private:
+    bool send_all(const char* data, std::size_t size) const;
+
+    int fd = -1;
+    std::string buffer;
+};
+
+inline tcp_connection tcp_connection::connect_to(const std::string& host,
+                                                 int port)
+{
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addresses = nullptr;
+
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints,
+                    &addresses) != 0)
+    {
+        return tcp_connection{};
+    }
+
+    int descriptor = -1;
+    for (auto a = addresses; a && descriptor < 0; a = a->ai_next)
+    {
+        descriptor = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (descriptor >= 0 && connect(descriptor, a->ai_addr,
+                                       a->ai_addrlen) != 0)
+        {
+            close(descriptor);
+            descriptor = -1;
+        }
+    }
+
+    freeaddrinfo(addresses);
+
+    return descriptor >= 0 ? tcp_connection{descriptor} : tcp_connection{};
+}
+
+inline bool tcp_connection::send_all(const char* data, std::size_t size) const
+{
+    while (size > 0)
+    {
+        const auto sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent <= 0)
+        {
+            return false;
+        }
+
+        data += sent;
+        size -= static_cast<std::size_t>(sent);
+    }
+
+    return true;
+}
+
+inline bool tcp_connection::send_line(const std::string& line) const
+{
+    const std::string message = line + '\n';
+    return send_all(message.data(), message.size());
+}
+
+inline bool tcp_connection::send_floats(const std::vector<float>& values) const
+{
+    std::vector<std::uint32_t> words(values.size());
+    for (std::size_t i = 0; i < values.size(); ++i)
+    {
+        std::uint32_t bits;
+        std::memcpy(&bits, &values[i], sizeof(bits));
+        words[i] = htonl(bits);
+    }
+
+    return send_all(reinterpret_cast<const char*>(words.data()),
+                    words.size() * sizeof(std::uint32_t));
+}
+
+inline bool tcp_connection::fill()
+{
+    char chunk[65536];
+    const auto count = recv(fd, chunk, sizeof(chunk), 0);
+    if (count <= 0)
+    {
+        return false;
+    }
+
+    buffer.append(chunk, static_cast<std::size_t>(count));
+
+    return true;
+}
+
+inline bool tcp_connection::take_line(std::string& line)
+{
+    const auto end = buffer.find('\n');
+    if (end == std::string::npos)
+    {
+        return false;
+    }
+
+    line = buffer.substr(0, end);
+    buffer.erase(0, end + 1);
+
+    return true;
+}
+
+inline bool tcp_connection::take_floats(std::size_t count,
+                                        std::vector<float>& values)
+{
+    const auto size = count * sizeof(std::uint32_t);
+    if (buffer.size() < size)
+    {
+        return false;
+    }
+
+    values.resize(count);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        std::uint32_t bits;
+        std::memcpy(&bits, buffer.data() + i * sizeof(bits), sizeof(bits));
+        bits = ntohl(bits);
+        std::memcpy(&values[i], &bits, sizeof(bits));
+    }
+    buffer.erase(0, size);
+
+    return true;
+}
+
+inline bool tcp_connection::read_line(std::string& line)
+{
+    while (!take_line(line))
+    {
+        if (!fill())
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+inline bool tcp_connection::read_floats(std::size_t count,
+                                        std::vector<float>& values)
+{
+    while (!take_floats(count, values))
+    {
+        if (!fill())
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+#endif
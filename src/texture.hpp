@@ -18,6 +18,15 @@ class texture
     virtual ~texture() = default;
 
     virtual color value(double u, double v, const point3& p) const = 0;
+
+    // Looks up the texture averaged over a footprint of (du, dv) in texture
+    // space. Textures that cannot prefilter fall back to a point lookup.
+    virtual color filtered_value(double u, double v, const point3& p,
+                                 [[maybe_unused]] double du,
+                                 [[maybe_unused]] double dv) const
+    {
+        return value(u, v, p);
+    }
 };
 
 #endif
\ No newline at end of file
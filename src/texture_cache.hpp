@@ -0,0 +1,342 @@
+// Copyright (c) 2020 Chris Ohk
+
+// I am making my contributions/submissions to this project solely in my
+// personal capacity and are not conveying any rights to any intellectual
+// property of any third parties.
+
+// It is based on Ray Tracing: The Rest of Your Life book.
+// References: https://raytracing.github.io
+
+#ifndef RAY_TRACING_TEXTURE_CACHE_HPP
+#define RAY_TRACING_TEXTURE_CACHE_HPP
+
+#include "mipmap.hpp"
+
+// Disable pedantic warnings for this external library.
+#ifdef _MSC_VER
+// Microsoft Visual C++ Compiler
+#pragma warning(push, 0)
+#endif
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "../external/stb_image.h"
+
+// Restore warning levels.
+#ifdef _MSC_VER
+// Microsoft Visual C++ Compiler
+#pragma warning(pop)
+#endif
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Process-wide store of decoded image textures.
+//
+// Files are identified by path, so every image_texture referring to the same
+// file shares one decoded mip pyramid. Nothing is decoded until the first
+// lookup, and once the resident pyramids exceed the memory budget the least
+// recently used ones are dropped (they are decoded again on their next use).
+//
+// Pre-tiled .rtmip files (see texture-converter) are memory-mapped instead
+// of decoded: they load in constant time and their pages are faulted in by
+// the operating system, so they do not count against the memory budget.
+//
+// Renders hold a pin for their duration: while any pin is held nothing is
+// evicted, so image_texture resolves its handle to a plain pointer once per
+// pin and looks texels up without touching the cache.
+class texture_cache
+{
+ public:
+    using handle = std::size_t;
+
+    static const std::size_t default_memory_budget = std::size_t{1} << 30;
+
+    struct statistics
+    {
+        std::size_t loads = 0;
+        std::size_t evictions = 0;
+        std::size_t resident_bytes = 0;
+    };
+
+    static texture_cache& instance()
+    {
+        static texture_cache cache;
+        return cache;
+    }
+
+    // Defers evictions from construction to destruction.
+    class pin
+    {
+     public:
+        pin() : cache(texture_cache::instance())
+        {
+            cache.acquire_pin();
+        }
+
+        ~pin()
+        {
+            cache.release_pin();
+        }
+
+        pin(const pin&) = delete;
+        pin& operator=(const pin&) = delete;
+
+     private:
+        texture_cache& cache;
+    };
+
+    texture_cache(const texture_cache&) = delete;
+    texture_cache& operator=(const texture_cache&) = delete;
+
+    // Returns the handle of the file, registering it on first use.
+    // This does not touch the file.
+    handle register_file(const std::string& path);
+
+    // Returns the decoded pyramid of the file, loading it if necessary.
+    // Returns an empty pyramid if the file could not be loaded. The file is
+    // decoded without holding the lock; concurrent fetches of the same file
+    // wait for that decode instead of starting their own.
+    std::shared_ptr<const mipmap> fetch(handle h);
+
+    // Returns a number identifying the current pin, or 0 if none is held.
+    // Pyramids fetched under one pin stay resident until that number
+    // changes.
+    std::uint64_t pin_generation() const
+    {
+        return current_pin.load(std::memory_order_acquire);
+    }
+
+    void set_memory_budget(std::size_t bytes);
+
+    statistics stats() const;
+
+    // Decodes an image file (JPEG, PNG, ...) into a new pyramid, or maps it
+    // if it is a .rtmip file.
+    static mipmap load(const std::string& path);
+
+    // Decodes an image file with stb_image and builds its pyramid.
+    static mipmap decode(const std::string& path);
+
+ private:
+    struct entry
+    {
+        std::string path;
+        std::shared_ptr<const mipmap> data;
+        std::size_t bytes = 0;
+        bool failed = false;
+        bool loading = false;
+        std::list<handle>::iterator lru_pos;
+    };
+
+    texture_cache() = default;
+
+    void acquire_pin();
+    void release_pin();
+
+    void evict(handle keep);
+
+    mutable std::mutex lock;
+    std::condition_variable loaded;
+    std::unordered_map<std::string, handle> handles;
+    std::vector<entry> entries;
+    // Resident entries, most recently used first.
+    std::list<handle> lru;
+    std::size_t memory_budget = default_memory_budget;
+    statistics counters;
+    std::size_t pins = 0;
+    std::uint64_t pin_count = 0;
+    std::atomic<std::uint64_t> current_pin{0};
+};
+
+inline texture_cache::handle texture_cache::register_file(
+    const std::string& path)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    const auto iter = handles.find(path);
+    if (iter != handles.end())
+    {
+        return iter->second;
+    }
+
+    const handle h = entries.size();
+    entries.emplace_back();
+    entries.back().path = path;
+    entries.back().lru_pos = lru.end();
+    handles.emplace(path, h);
+
+    return h;
+}
+
+inline std::shared_ptr<const mipmap> texture_cache::fetch(handle h)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    loaded.wait(guard, [&] { return !entries[h].loading; });
+
+    if (entries[h].data)
+    {
+        // Move to the front of the LRU list.
+        lru.splice(lru.begin(), lru, entries[h].lru_pos);
+        return entries[h].data;
+    }
+
+    if (entries[h].failed)
+    {
+        static const auto empty = std::make_shared<const mipmap>();
+        return empty;
+    }
+
+    // Decode without the lock so that lookups of other files go on. The
+    // entry may move while we are unlocked, so look it up again afterwards.
+    entries[h].loading = true;
+    const std::string path = entries[h].path;
+    guard.unlock();
+
+    auto data = std::make_shared<const mipmap>(load(path));
+
+    guard.lock();
+    entry& e = entries[h];
+    e.loading = false;
+    ++counters.loads;
+    loaded.notify_all();
+
+    if (data->empty())
+    {
+        e.failed = true;
+        return data;
+    }
+
+    e.data = std::move(data);
+    e.bytes = e.data->memory_size();
+    lru.push_front(h);
+    e.lru_pos = lru.begin();
+    counters.resident_bytes += e.bytes;
+
+    evict(h);
+
+    return e.data;
+}
+
+inline void texture_cache::set_memory_budget(std::size_t bytes)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    memory_budget = bytes;
+    evict(entries.size());
+}
+
+inline texture_cache::statistics texture_cache::stats() const
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    return counters;
+}
+
+inline void texture_cache::acquire_pin()
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    if (pins++ == 0)
+    {
+        current_pin.store(++pin_count, std::memory_order_release);
+    }
+}
+
+inline void texture_cache::release_pin()
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    if (--pins == 0)
+    {
+        current_pin.store(0, std::memory_order_release);
+        evict(entries.size());
+    }
+}
+
+inline mipmap texture_cache::load(const std::string& path)
+{
+    const std::string extension = ".rtmip";
+
+    if (path.size() >= extension.size() &&
+        path.compare(path.size() - extension.size(), extension.size(),
+                     extension) == 0)
+    {
+        mipmap result = mipmap::map_file(path);
+        if (result.empty())
+        {
+            std::cerr << "ERROR: Could not map texture file '" << path
+                      << "'.\n";
+        }
+
+        return result;
+    }
+
+    return decode(path);
+}
+
+inline mipmap texture_cache::decode(const std::string& path)
+{
+    const int bytes_per_pixel = mipmap::channels;
+    auto components_per_pixel = bytes_per_pixel;
+    int width = 0, height = 0;
+
+    unsigned char* data =
+        stbi_load(path.c_str(), &width, &height, &components_per_pixel,
+                  components_per_pixel);
+
+    if (!data)
+    {
+        std::cerr << "ERROR: Could not load texture image file '" << path
+                  << "'.\n";
+        return mipmap{};
+    }
+
+    // Keep the texels as floats so that averaging them into the coarser
+    // mip levels does not lose precision.
+    const auto color_scale = 1.0f / 255.0f;
+    std::vector<float> texels(static_cast<std::size_t>(width) * height *
+                              bytes_per_pixel);
+
+    for (std::size_t i = 0; i < texels.size(); ++i)
+    {
+        texels[i] = color_scale * data[i];
+    }
+
+    stbi_image_free(data);
+
+    return mipmap{width, height, std::move(texels)};
+}
+
+inline void texture_cache::evict(handle keep)
+{
+    // Drop least recently used pyramids until we fit in the budget. Lookups
+    // still holding a pointer to an evicted pyramid keep it alive until they
+    // are done with it. Nothing is dropped while a pin is held.
+    while (pins == 0 && counters.resident_bytes > memory_budget &&
+           !lru.empty())
+    {
+        const handle victim = lru.back();
+        if (victim == keep)
+        {
+            break;
+        }
+
+        entry& e = entries[victim];
+        lru.pop_back();
+        e.data.reset();
+        e.lru_pos = lru.end();
+        counters.resident_bytes -= e.bytes;
+        e.bytes = 0;
+        ++counters.evictions;
+    }
+}
+
+#endif
@@ -0,0 +1,54 @@
+// Copyright (c) 2020 Chris Ohk
+
+// I am making my contributions/submissions to this project solely in my
+// personal capacity and are not conveying any rights to any intellectual
+// property of any third parties.
+
+// It is based on Ray Tracing: The Rest of Your Life book.
+// References: https://raytracing.github.io
+
+// Converts images into the tiled, mipmapped .rtmip format so that the
+// renderer can memory-map them instead of decoding them at startup.
+
+#include "texture_cache.hpp"
+
+#include <iostream>
+#include <string>
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3 || argc % 2 == 0)
+    {
+        std::cerr << "Usage: " << argv[0]
+                  << " <input image> <output.rtmip> [<input> <output> ...]\n";
+        return 1;
+    }
+
+    int failures = 0;
+
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        const std::string input = argv[i];
+        const std::string output = argv[i + 1];
+
+        const mipmap pyramid = texture_cache::decode(input);
+        if (pyramid.empty())
+        {
+            ++failures;
+            continue;
+        }
+
+        if (!pyramid.save(output))
+        {
+            std::cerr << "ERROR: Could not write '" << output << "'.\n";
+            ++failures;
+            continue;
+        }
+
+        std::cerr << input << " -> " << output << " (" << pyramid.width(0)
+                  << 'x' << pyramid.height(0) << ", " << pyramid.levels()
+                  << " levels)\n";
+    }
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,373 @@
+// Copyright (c) 2020 Chris Ohk
+
+// I am making my contributions/submissions to this project solely in my
+// personal capacity and are not conveying any rights to any intellectual
+// property of any third parties.
+
+// It is based on Ray Tracing: The Rest of Your Life book.
+// References: https://raytracing.github.io
+
+#ifndef RAY_TRACING_THREAD_POOL_HPP
+#define RAY_TRACING_THREAD_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// A fixed set of worker threads running queued tasks. Threads waiting on a
+// task_group run queued tasks meanwhile, so tasks can fork and join more
+// tasks without tying up the workers.
+class thread_pool
+{
+ public:
+    // workers: threads besides the ones that wait on task groups, so 0 runs
+    // everything on the waiting thread.
+    explicit thread_pool(std::size_t workers);
+    ~thread_pool();
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    // The pool shared by the renderer, with a worker per hardware thread
+    // besides the main one.
+    static thread_pool& shared();
+
+    void submit(std::function<void()> task);
+
+    // Runs one queued task on the calling thread. Returns false if there
+    // was none.
+    bool run_one();
+
+    // Runs queued tasks on the calling thread until done() holds, sleeping
+    // while there are none. Whoever makes done() true calls notify().
+    template <typename Predicate>
+    void run_until(Predicate done);
+    void notify();
+
+    std::size_t workers() const
+    {
+        return threads.size();
+    }
+
+ private:
+    void work();
+
+    std::mutex mutex;
+    std::condition_variable available;
+    std::condition_variable changed;
+    std::deque<std::function<void()>> tasks;
+    std::vector<std::thread> threads;
+    bool stopping = false;
+};
+
+// Tasks run on a pool and waited for together.
+class task_group
+{
+ public:
+    explicit task_group(thread_pool& p) : pool(p)
+    {
+        // Do nothing
+    }
+
+    ~task_group()
+    {
+        wait();
+    }
+
+    template <typename Task>
+    void run(Task&& task)
+    {
+        ++pending;
+        auto& p = pool;
+        p.submit([this, &p, task = std::forward<Task>(task)]() mutable {
+            task();
+            // The group may be gone as soon as pending drops to 0.
+            --pending;
+            p.notify();
+        });
+    }
+
+    // Returns once every task run so far has finished, running queued tasks
+    // (of any group) in the meantime.
+    void wait()
+    {
+        pool.run_until([this] { return pending == 0; });
+    }
+
+ private:
+    thread_pool& pool;
+    std::atomic<std::size_t> pending{0};
+};
+
+inline thread_pool::thread_pool(std::size_t workers)
+{
+    threads.reserve(workers);
+    for (std::size_t i = 0; i < workers; ++i)
+    {
+        threads.emplace_back([this] { work(); });
+    }
+}
+
+inline thread_pool::~thread_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+
+    available.notify_all();
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+}
+
+inline thread_pool& thread_pool::shared()
+{
+    static thread_pool pool(
+        std::max(1u, std::thread::hardware_concurrency()) - 1);
+    return pool;
+}
+
+inline void thread_pool::submit(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+    }
+
+    available.notify_one();
+    changed.notify_all();
+}
+
+inline bool thread_pool::run_one()
+{
+    std::function<void()> task;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (tasks.empty())
+        {
+            return false;
+        }
+
+        task = std::move(tasks.front());
+        tasks.pop_front();
+    }
+
+    task();
+
+    return true;
+}
+
+template <typename Predicate>
+void thread_pool::run_until(Predicate done)
+{
+    while (!done())
+    {
+        if (run_one())
+        {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&] { return done() || !tasks.empty(); });
+    }
+}
+
+inline void thread_pool::notify()
+{
+    // Taking the lock orders this after a waiter's check of its predicate,
+    // so the wakeup cannot fall between the check and the wait.
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+    }
+
+    changed.notify_all();
+}
+
+inline void thread_pool::work()
+{
+    while (true)
+    {
+        std::function<void()> task;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            available.wait(lock, [this] { return stopping || !tasks.empty(); });
+            if (tasks.empty())
+            {
+                return;
+            }
+
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+
+        task();
+    }
+}
+
+// std::partition split over the threads of the pool: each thread
+// partitions a piece of the range in place, then the elements left on the
+// wrong side of the overall split point are swapped across it, each thread
+// taking a share of the swaps. Small ranges go to std::partition.
+template <typename Iterator, typename Predicate>
+Iterator parallel_partition(Iterator first, Iterator last, Predicate pred,
+                            thread_pool& pool)
+{
+    const std::size_t pieces = pool.workers() + 1;
+    const auto size = static_cast<std::size_t>(last - first);
+
+    if (pieces < 2 || size < pieces * 8192)
+    {
+        return std::partition(first, last, pred);
+    }
+
+    const auto piece_begin = [&](std::size_t p) {
+        return first + static_cast<std::ptrdiff_t>(size * p / pieces);
+    };
+    const auto for_each_piece = [&](const auto& task) {
+        task_group group(pool);
+        for (std::size_t p = 1; p < pieces; ++p)
+        {
+            group.run([&task, p] { task(p); });
+        }
+        task(0);
+        group.wait();
+    };
+
+    std::vector<Iterator> splits(pieces);
+    for_each_piece([&](std::size_t p) {
+        splits[p] = std::partition(piece_begin(p), piece_begin(p + 1), pred);
+    });
+
+    std::ptrdiff_t total = 0;
+    for (std::size_t p = 0; p < pieces; ++p)
+    {
+        total += splits[p] - piece_begin(p);
+    }
+    const Iterator middle = first + total;
+
+    // The runs of rejected elements before middle and of accepted ones
+    // after it, in order. There are as many elements in either.
+    struct run
+    {
+        Iterator begin;
+        std::ptrdiff_t offset;
+    };
+    std::vector<run> rejected, accepted;
+    std::ptrdiff_t rejected_count = 0, accepted_count = 0;
+
+    for (std::size_t p = 0; p < pieces; ++p)
+    {
+        const Iterator rejected_end = std::min(piece_begin(p + 1), middle);
+        if (splits[p] < rejected_end)
+        {
+            rejected.push_back({splits[p], rejected_count});
+            rejected_count += rejected_end - splits[p];
+        }
+
+        const Iterator accepted_begin = std::max(piece_begin(p), middle);
+        if (accepted_begin < splits[p])
+        {
+            accepted.push_back({accepted_begin, accepted_count});
+            accepted_count += splits[p] - accepted_begin;
+        }
+    }
+
+    // Position of the i-th element of the runs.
+    const auto locate = [](const std::vector<run>& runs, std::ptrdiff_t i) {
+        const auto r = std::upper_bound(
+                           runs.begin(), runs.end(), i,
+                           [](std::ptrdiff_t value, const run& x) {
+                               return value < x.offset;
+                           }) -
+                       1;
+        return r->begin + (i - r->offset);
+    };
+
+    for_each_piece([&](std::size_t p) {
+        const auto from = static_cast<std::ptrdiff_t>(
+            static_cast<std::size_t>(rejected_count) * p / pieces);
+        const auto to = static_cast<std::ptrdiff_t>(
+            static_cast<std::size_t>(rejected_count) * (p + 1) / pieces);
+
+        for (auto i = from; i < to; ++i)
+        {
+            std::iter_swap(locate(rejected, i), locate(accepted, i));
+        }
+    });
+
+    return middle;
+}
+
+// std::nth_element split over the threads of the pool. Two splitters taken
+// from a sorted sample of the range bracket the nth element with high
+// probability; the range is partitioned around them in parallel, and only
+// the few elements between them are left to std::nth_element.
+template <typename Iterator, typename Compare>
+void parallel_nth_element(Iterator first, Iterator nth, Iterator last,
+                          Compare compare, thread_pool& pool)
+{
+    using value_type = typename std::iterator_traits<Iterator>::value_type;
+
+    const std::size_t sample_size = 1024;
+    const std::size_t margin = 64;
+
+    while (pool.workers() > 0 &&
+           static_cast<std::size_t>(last - first) >= 16 * sample_size)
+    {
+        const auto size = static_cast<std::size_t>(last - first);
+        std::vector<value_type> sample;
+        sample.reserve(sample_size);
+        for (std::size_t i = 0; i < sample_size; ++i)
+        {
+            sample.push_back(
+                first[static_cast<std::ptrdiff_t>(size * i / sample_size)]);
+        }
+        std::sort(sample.begin(), sample.end(), compare);
+
+        // The splitters are elements of the range, so each side excludes
+        // at least one element and the loop ends.
+        const auto rank = static_cast<std::size_t>(nth - first) *
+                          sample_size / size;
+        const value_type& low = sample[rank > margin ? rank - margin : 0];
+        const value_type& high =
+            sample[std::min(rank + margin, sample_size - 1)];
+
+        const Iterator middle_begin = parallel_partition(
+            first, last,
+            [&](const value_type& x) { return compare(x, low); }, pool);
+        if (nth < middle_begin)
+        {
+            last = middle_begin;
+            continue;
+        }
+
+        const Iterator middle_end = parallel_partition(
+            middle_begin, last,
+            [&](const value_type& x) { return !compare(high, x); }, pool);
+        if (nth >= middle_end)
+        {
+            first = middle_end;
+            continue;
+        }
+
+        first = middle_begin;
+        last = middle_end;
+        break;
+    }
+
+    std::nth_element(first, nth, last, compare);
+}
+
+#endif
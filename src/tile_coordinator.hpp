@@ -0,0 +1,434 @@
+// Copyright (c) 2020 Chris Ohk
+
+// I am making my contributions/submissions to this project solely in my
+// personal capacity and are not conveying any rights to any intellectual
+// property of any third parties.
+
+// It is based on Ray Tracing: The Rest of Your Life book.
+// References: https://raytracing.github.io
+
+#ifndef RAY_TRACING_TILE_COORDINATOR_HPP
+#define RAY_TRACING_TILE_COORDINATOR_HPP
+
+#include "render_queue.hpp"
+#include "tcp_connection.hpp"
+
+#include <poll.h>
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <list>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Renders one image with worker processes connected over TCP. The image is
+// split into tiles, handed out one at a time to whichever worker is idle.
+// The tile of a worker that disconnects goes back to the queue; that of a
+// worker that stays silent for longer than the timeout is queued once more
+// as a copy, while the worker keeps its connection and may still finish it.
+// Once no tile is left to hand out, idle workers also get a copy of a tile
+// that has been running for much longer than tiles usually take; whichever
+// copy finishes first is kept.
+//
+// Coordinator to worker, one line each:
+//   job <render_job::describe()>         once, when the worker connects
+//   tile <index> <x0> <y0> <x1> <y1>     render pixels [x0, x1) x [y0, y1)
+//   done                                 the image is complete
+// Worker to coordinator:
+//   result <index>                       followed by the mean radiance of
+//                                        the tile pixels as 3 floats each,
+//                                        rows from y0 up, as tcp_connection
+//                                        sends them
+class tile_coordinator
+{
+ public:
+    struct statistics
+    {
+        std::size_t workers = 0;
+        std::size_t workers_lost = 0;
+        std::size_t tiles_requeued = 0;
+        std::size_t tiles_duplicated = 0;
+        std::size_t duplicates_discarded = 0;
+    };
+
+    tile_coordinator(const render_job& job, int tile_size,
+                     double worker_timeout_seconds);
+
+    // Listens on port, or on any free port for 0. Returns false on failure.
+    bool listen_on(int port);
+
+    int port() const
+    {
+        return bound_port;
+    }
+
+    // Hands out tiles until the image is complete. Returns false if it gave
+    // up because no worker was connected and workers_may_come, if given,
+    // said that none would connect any more.
+    bool run(std::ostream& log,
+             const std::function<bool()>& workers_may_come = nullptr);
+
+    // Mean radiance of each pixel, 3 floats per pixel, rows from the bottom
+    // of the image (camera v = 0) up.
+    const std::vector<float>& image() const
+    {
+        return pixels;
+    }
+
+    const statistics& stats() const
+    {
+        return counters;
+    }
+
+ private:
+    using clock = std::chrono::steady_clock;
+
+    struct tile
+    {
+        tile(int left, int bottom, int right, int top)
+            : x0(left), y0(bottom), x1(right), y1(top)
+        {
+            // Do nothing
+        }
+
+        int x0, y0, x1, y1;
+        bool done = false;
+        // Whether it is in pending, waiting to be handed out.
+        bool queued = true;
+        int in_flight = 0;
+        clock::time_point started;
+    };
+
+    struct worker
+    {
+        explicit worker(tcp_connection connection)
+            : link(std::move(connection))
+        {
+            // Do nothing
+        }
+
+        tcp_connection link;
+        int tile = -1;
+        clock::time_point started;
+        // Whether its tile has been queued again for taking too long.
+        bool overdue = false;
+        // Index of the result whose pixels are expected next, or -1.
+        int result = -1;
+    };
+
+    // Reads the messages in the worker's buffer. Returns false on a
+    // protocol error.
+    bool receive(worker& w);
+    void assign(worker& w);
+    void drop(worker& w);
+
+    std::string description;
+    int width, height;
+    double timeout;
+    int listener = -1;
+    int bound_port = 0;
+
+    std::vector<tile> tiles;
+    std::deque<int> pending;
+    std::size_t tiles_left = 0;
+    double time_spent = 0.0;
+    std::size_t tiles_timed = 0;
+
+    std::list<worker> workers;
+    std::vector<float> pixels;
+    statistics counters;
+};
+
+inline tile_coordinator::tile_coordinator(const render_job& job,
+                                          int tile_size,
+                                          double worker_timeout_seconds)
+    : description(job.describe()),
+      width(job.width),
+      height(job.height),
+      timeout(worker_timeout_seconds),
+      pixels(static_cast<std::size_t>(job.width) * job.height * 3, 0.0f)
+{
+    // From the top of the image down, as it is usually looked at.
+    for (int y1 = height; y1 > 0; y1 -= tile_size)
+    {
+        for (int x0 = 0; x0 < width; x0 += tile_size)
+        {
+            tiles.emplace_back(x0, std::max(0, y1 - tile_size),
+                               std::min(width, x0 + tile_size), y1);
+            pending.push_back(static_cast<int>(tiles.size()) - 1);
+        }
+    }
+
+    tiles_left = tiles.size();
+}
+
+inline bool tile_coordinator::listen_on(int port)
+{
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0)
+    {
+        return false;
+    }
+
+    const int enable = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(static_cast<std::uint16_t>(port));
+    socklen_t length = sizeof(address);
+
+    if (bind(listener, reinterpret_cast<const sockaddr*>(&address),
+             sizeof(address)) != 0 ||
+        ::listen(listener, 64) != 0 ||
+        getsockname(listener, reinterpret_cast<sockaddr*>(&address),
+                    &length) != 0)
+    {
+        close(listener);
+        listener = -1;
+        return false;
+    }
+
+    bound_port = ntohs(address.sin_port);
+
+    return true;
+}
+
+inline bool tile_coordinator::run(
+    std::ostream& log, const std::function<bool()>& workers_may_come)
+{
+    std::vector<pollfd> watched;
+
+    while (tiles_left > 0)
+    {
+        watched.assign(1, pollfd{listener, POLLIN, 0});
+        for (const auto& w : workers)
+        {
+            watched.push_back(pollfd{w.link.descriptor(), POLLIN, 0});
+        }
+
+        // Wake up now and then to look for timeouts and stragglers.
+        poll(watched.data(), watched.size(), 100);
+
+        const auto now = clock::now();
+        auto entry = watched.begin() + 1;
+
+        for (auto w = workers.begin(); w != workers.end(); ++entry)
+        {
+            const bool readable = entry->revents & (POLLIN | POLLHUP | POLLERR);
+            if (readable && !(w->link.fill() && receive(*w)))
+            {
+                log << "Worker lost"
+                    << (w->tile >= 0 ? ", requeueing its tile\n" : "\n");
+                drop(*w);
+                w = workers.erase(w);
+                continue;
+            }
+
+            // A silent worker may only be slow: it keeps its connection,
+            // and its tile goes to the next idle worker as well.
+            if (w->tile >= 0 && !w->overdue &&
+                std::chrono::duration<double>(now - w->started).count() >
+                    timeout)
+            {
+                w->overdue = true;
+                tile& t = tiles[w->tile];
+                if (!t.done && !t.queued && t.in_flight == 1)
+                {
+                    log << "Worker timed out, handing its tile out again\n";
+                    t.queued = true;
+                    pending.push_front(w->tile);
+                    ++counters.tiles_duplicated;
+                }
+            }
+
+            ++w;
+        }
+
+        // After the workers watched above, which it would add to.
+        if (watched[0].revents & POLLIN)
+        {
+            const int client = accept(listener, nullptr, nullptr);
+            if (client >= 0)
+            {
+                workers.emplace_back(tcp_connection{client});
+                ++counters.workers;
+                if (!workers.back().link.send_line("job " + description))
+                {
+                    workers.pop_back();
+                }
+            }
+        }
+
+        for (auto& w : workers)
+        {
+            if (w.tile < 0 && tiles_left > 0)
+            {
+                assign(w);
+            }
+        }
+
+        if (workers.empty() && workers_may_come && !workers_may_come())
+        {
+            log << "ERROR: No workers left, " << tiles_left
+                << " tiles not rendered.\n";
+            break;
+        }
+    }
+
+    for (const auto& w : workers)
+    {
+        w.link.send_line("done");
+    }
+    workers.clear();
+    close(listener);
+    listener = -1;
+
+    return tiles_left == 0;
+}
+
+inline bool tile_coordinator::receive(worker& w)
+{
+    std::string line;
+
+    while (true)
+    {
+        if (w.result < 0)
+        {
+            if (!w.link.take_line(line))
+            {
+                return true;
+            }
+
+            std::istringstream in(line);
+            std::string verb;
+            if (!(in >> verb >> w.result) || verb != "result" ||
+                w.result != w.tile)
+            {
+                return false;
+            }
+        }
+
+        tile& t = tiles[w.result];
+        const int tile_width = t.x1 - t.x0;
+        std::vector<float> values;
+        if (!w.link.take_floats(
+                static_cast<std::size_t>(tile_width) * (t.y1 - t.y0) * 3,
+                values))
+        {
+            return true;
+        }
+
+        --t.in_flight;
+        w.result = w.tile = -1;
+
+        if (t.done)
+        {
+            ++counters.duplicates_discarded;
+            continue;
+        }
+
+        for (int y = t.y0; y < t.y1; ++y)
+        {
+            std::copy_n(values.begin() + (y - t.y0) * tile_width * 3,
+                        tile_width * 3,
+                        pixels.begin() + (static_cast<std::size_t>(y) * width +
+                                          t.x0) * 3);
+        }
+
+        t.done = true;
+        --tiles_left;
+        time_spent +=
+            std::chrono::duration<double>(clock::now() - w.started).count();
+        ++tiles_timed;
+    }
+}
+
+inline void tile_coordinator::assign(worker& w)
+{
+    const auto now = clock::now();
+    int index = -1;
+
+    // A tile queued again for taking too long may have finished since.
+    while (!pending.empty() && tiles[pending.front()].done)
+    {
+        tiles[pending.front()].queued = false;
+        pending.pop_front();
+    }
+
+    if (!pending.empty())
+    {
+        index = pending.front();
+        pending.pop_front();
+        tiles[index].queued = false;
+    }
+    else if (tiles_timed > 0)
+    {
+        // A straggler: the single copy running for the longest, if that is
+        // well over the usual time for a tile.
+        const double usual = time_spent / tiles_timed;
+        double longest = 3.0 * usual;
+
+        for (std::size_t i = 0; i < tiles.size(); ++i)
+        {
+            const double elapsed =
+                std::chrono::duration<double>(now - tiles[i].started).count();
+            if (!tiles[i].done && tiles[i].in_flight == 1 && elapsed > longest)
+            {
+                index = static_cast<int>(i);
+                longest = elapsed;
+            }
+        }
+
+        if (index >= 0)
+        {
+            ++counters.tiles_duplicated;
+        }
+    }
+
+    if (index < 0)
+    {
+        return;
+    }
+
+    tile& t = tiles[index];
+    std::ostringstream message;
+    message << "tile " << index << ' ' << t.x0 << ' ' << t.y0 << ' ' << t.x1
+            << ' ' << t.y1;
+
+    if (t.in_flight++ == 0)
+    {
+        t.started = now;
+    }
+    w.tile = index;
+    w.started = now;
+    w.overdue = false;
+
+    // A failed send shows up as a lost worker at the next poll.
+    w.link.send_line(message.str());
+}
+
+inline void tile_coordinator::drop(worker& w)
+{
+    ++counters.workers_lost;
+
+    if (w.tile < 0)
+    {
+        return;
+    }
+
+    tile& t = tiles[w.tile];
+    if (--t.in_flight == 0 && !t.done && !t.queued)
+    {
+        pending.push_front(w.tile);
+        ++counters.tiles_requeued;
+    }
+}
+
+#endif
@@ -0,0 +1,276 @@
+// Copyright (c) 2020 Chris Ohk
+
+// I am making my contributions/submissions to this project solely in my
+// personal capacity and are not conveying any rights to any intellectual
+// property of any third parties.
+
+// It is based on Ray Tracing: The Rest of Your Life book.
+// References: https://raytracing.github.io
+
+#ifndef RAY_TRACING_TRANSFORM_HPP
+#define RAY_TRACING_TRANSFORM_HPP
+
+#include "aabb.hpp"
+#include "common.hpp"
+
+// An invertible affine transform, stored as the upper 3x4 part of a 4x4
+// matrix together with its inverse so that both directions cost the same.
+class transform
+{
+ public:
+    // The identity.
+    transform();
+
+    static transform translation(const vec3& offset);
+    static transform scaling(const vec3& factors);
+    static transform rotation_x(double angle);
+    static transform rotation_y(double angle);
+    static transform rotation_z(double angle);
+
+    // Applies rhs first, then this transform.
+    transform operator*(const transform& rhs) const;
+
+    transform inverse() const
+    {
+        return transform{inv, m};
+    }
+
+    point3 apply_point(const point3& p) const
+    {
+        return multiply(m, p, 1.0);
+    }
+
+    vec3 apply_vector(const vec3& v) const
+    {
+        return multiply(m, v, 0.0);
+    }
+
+    point3 apply_inverse_point(const point3& p) const
+    {
+        return multiply(inv, p, 1.0);
+    }
+
+    vec3 apply_inverse_vector(const vec3& v) const
+    {
+        return multiply(inv, v, 0.0);
+    }
+
+    // Normals transform by the inverse transpose. The result is not
+    // normalized.
+    vec3 apply_normal(const vec3& n) const;
+
+    // Bounds of the transformed box.
+    aabb apply_box(const aabb& box) const;
+
+    bool is_identity() const;
+
+    // True if the transform only rotates and translates.
+    bool is_rigid() const;
+
+    double m[3][4];
+    double inv[3][4];
+
+ private:
+    transform(const double (&matrix)[3][4], const double (&inverse)[3][4]);
+
+    static vec3 multiply(const double (&a)[3][4], const vec3& v, double w)
+    {
+        return vec3{a[0][0] * v[0] + a[0][1] * v[1] + a[0][2] * v[2] +
+                        a[0][3] * w,
+                    a[1][0] * v[0] + a[1][1] * v[1] + a[1][2] * v[2] +
+                        a[1][3] * w,
+                    a[2][0] * v[0] + a[2][1] * v[1] + a[2][2] * v[2] +
+                        a[2][3] * w};
+    }
+
+    static void compose(const double (&a)[3][4], const double (&b)[3][4],
+                        double (&out)[3][4]);
+};
+
+inline transform::transform()
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        for (int j = 0; j < 4; ++j)
+        {
+            m[i][j] = inv[i][j] = (i == j) ? 1.0 : 0.0;
+        }
+    }
+}
+
+inline transform::transform(const double (&matrix)[3][4],
+                            const double (&inverse)[3][4])
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        for (int j = 0; j < 4; ++j)
+        {
+            m[i][j] = matrix[i][j];
+            inv[i][j] = inverse[i][j];
+        }
+    }
+}
+
+inline transform transform::translation(const vec3& offset)
+{
+    transform t;
+
+    for (int i = 0; i < 3; ++i)
+    {
+        t.m[i][3] = offset[i];
+        t.inv[i][3] = -offset[i];
+    }
+
+    return t;
+}
+
+inline transform transform::scaling(const vec3& factors)
+{
+    transform t;
+
+    for (int i = 0; i < 3; ++i)
+    {
+        t.m[i][i] = factors[i];
+        t.inv[i][i] = 1.0 / factors[i];
+    }
+
+    return t;
+}
+
+inline transform transform::rotation_x(double angle)
+{
+    const auto radians = degrees_to_radians(angle);
+    const auto sin_theta = sin(radians);
+    const auto cos_theta = cos(radians);
+    transform t;
+
+    t.m[1][1] = t.m[2][2] = cos_theta;
+    t.m[1][2] = -sin_theta;
+    t.m[2][1] = sin_theta;
+
+    // Rotations are orthonormal: the inverse is the transpose.
+    t.inv[1][1] = t.inv[2][2] = cos_theta;
+    t.inv[1][2] = sin_theta;
+    t.inv[2][1] = -sin_theta;
+
+    return t;
+}
+
+inline transform transform::rotation_y(double angle)
+{
+    // Same convention as rotate_y.
+    const auto radians = degrees_to_radians(angle);
+    const auto sin_theta = sin(radians);
+    const auto cos_theta = cos(radians);
+    transform t;
+
+    t.m[0][0] = t.m[2][2] = cos_theta;
+    t.m[0][2] = sin_theta;
+    t.m[2][0] = -sin_theta;
+
+    t.inv[0][0] = t.inv[2][2] = cos_theta;
+    t.inv[0][2] = -sin_theta;
+    t.inv[2][0] = sin_theta;
+
+    return t;
+}
+
+inline transform transform::rotation_z(double angle)
+{
+    const auto radians = degrees_to_radians(angle);
+    const auto sin_theta = sin(radians);
+    const auto cos_theta = cos(radians);
+    transform t;
+
+    t.m[0][0] = t.m[1][1] = cos_theta;
+    t.m[0][1] = -sin_theta;
+    t.m[1][0] = sin_theta;
+
+    t.inv[0][0] = t.inv[1][1] = cos_theta;
+    t.inv[0][1] = sin_theta;
+    t.inv[1][0] = -sin_theta;
+
+    return t;
+}
+
+inline void transform::compose(const double (&a)[3][4],
+                               const double (&b)[3][4], double (&out)[3][4])
+{
+    // out = a * b, with the implicit last row (0, 0, 0, 1).
+    for (int i = 0; i < 3; ++i)
+    {
+        for (int j = 0; j < 4; ++j)
+        {
+            out[i][j] = a[i][0] * b[0][j] + a[i][1] * b[1][j] +
+                        a[i][2] * b[2][j] + (j == 3 ? a[i][3] : 0.0);
+        }
+    }
+}
+
+inline transform transform::operator*(const transform& rhs) const
+{
+    double matrix[3][4], inverse[3][4];
+    compose(m, rhs.m, matrix);
+    compose(rhs.inv, inv, inverse);
+
+    return transform{matrix, inverse};
+}
+
+inline vec3 transform::apply_normal(const vec3& n) const
+{
+    return vec3{inv[0][0] * n[0] + inv[1][0] * n[1] + inv[2][0] * n[2],
+                inv[0][1] * n[0] + inv[1][1] * n[1] + inv[2][1] * n[2],
+                inv[0][2] * n[0] + inv[1][2] * n[1] + inv[2][2] * n[2]};
+}
+
+inline aabb transform::apply_box(const aabb& box) const
+{
+    // Start from the transformed center and grow by the absolute value of
+    // the linear part applied to the half extents.
+    const point3 center = 0.5 * (box.min() + box.max());
+    const vec3 half = 0.5 * (box.max() - box.min());
+    const point3 c = apply_point(center);
+    vec3 extent;
+
+    for (int i = 0; i < 3; ++i)
+    {
+        extent[i] = fabs(m[i][0]) * half[0] + fabs(m[i][1]) * half[1] +
+                    fabs(m[i][2]) * half[2];
+    }
+
+    return aabb(c - extent, c + extent);
+}
+
+inline bool transform::is_identity() const
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        for (int j = 0; j < 4; ++j)
+        {
+            if (m[i][j] != ((i == j) ? 1.0 : 0.0))
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+inline bool transform::is_rigid() const
+{
+    // The columns of the linear part must be orthonormal, and it must not
+    // mirror.
+    const vec3 c0{m[0][0], m[1][0], m[2][0]};
+    const vec3 c1{m[0][1], m[1][1], m[2][1]};
+    const vec3 c2{m[0][2], m[1][2], m[2][2]};
+    const auto eps = 1e-9;
+
+    return fabs(c0.length_squared() - 1) < eps &&
+           fabs(c1.length_squared() - 1) < eps &&
+           fabs(c2.length_squared() - 1) < eps && fabs(dot(c0, c1)) < eps &&
+           fabs(dot(c0, c2)) < eps && fabs(dot(c1, c2)) < eps &&
+           dot(cross(c0, c1), c2) > 0;
+}
+
+#endif
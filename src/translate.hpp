@@ -34,14 +34,23 @@ class translate final : public hittable
 inline bool translate::hit(const ray& r, double t_min, double t_max,
                            hit_record& rec) const
 {
-    const ray moved_r{r.origin() - offset, r.direction(), r.time()};
+    ray moved_r{r.origin() - offset, r.direction(), r.time()};
+    if (r.has_differentials)
+    {
+        moved_r.set_differentials(r.rx_origin - offset, r.rx_direction,
+                                  r.ry_origin - offset, r.ry_direction);
+    }
+
     if (!ptr->hit(moved_r, t_min, t_max, rec))
     {
         return false;
     }
 
+    // The normal already faces the ray and front_face is left as the object
+    // set it, which media rely on to tell entries from exits.
     rec.p += offset;
-    rec.set_face_normal(moved_r, rec.normal);
+    // A medium tracks light in its own space (see hit_record::medium).
+    rec.medium = nullptr;
 
     return true;
 }
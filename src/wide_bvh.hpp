@@ -0,0 +1,559 @@
+// Copyright (c) 2020 Chris Ohk
+
+// I am making my contributions/submissions to this project solely in my
+// personal capacity and are not conveying any rights to any intellectual
+// property of any third parties.
+
+// It is based on Ray Tracing: The Rest of Your Life book.
+// References: https://raytracing.github.io
+
+#ifndef RAY_TRACING_WIDE_BVH_HPP
+#define RAY_TRACING_WIDE_BVH_HPP
+
+#include "bvh.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+// A compressed 8-wide BVH (Ylitie et al. 2017), collapsed from a bvh_node
+// tree. Each node stores the bounds of up to 8 children as 8-bit offsets on
+// a grid over the node's own box, a power of two apart on each axis, so a
+// node takes 76 bytes where a bvh_node takes a few hundred per 2 children.
+// The traversal decodes and slab-tests the 8 children together, in float;
+// the lanes are independent, so the compiler is free to map them onto SIMD
+// registers.
+//
+// Once collapsed, the nodes are laid out in treelets of about treelet_bytes
+// (Aila and Karras 2010): starting from its root, a treelet takes in the
+// sibling groups rays are most likely to visit, as estimated by their area,
+// and the groups left out start the treelets laid out next, hottest first.
+// A ray going down the tree then stays within a few blocks of memory for
+// several levels.
+//
+// Nodes are bounded over the whole build interval: the tree is looser than
+// a bvh_node one for moving objects, and cannot be refit.
+class wide_bvh final : public hittable
+{
+ public:
+    static const int width = 8;
+    static const std::size_t default_treelet_bytes = 4096;
+
+    struct node
+    {
+        // Child i spans origin + [lo, hi][a][i] * 2^exponent[a] on axis a.
+        float origin[3];
+        // Children [0, inner_count) are the nodes from child_base on, the
+        // others are the primitives from primitive_base on.
+        std::uint32_t child_base;
+        std::uint32_t primitive_base;
+        std::int8_t exponent[3];
+        std::uint8_t inner_count;
+        std::uint8_t child_count;
+        std::uint8_t lo[3][width];
+        std::uint8_t hi[3][width];
+    };
+
+    // Collapses the tree under binary, bounded over [time0, time1]. The
+    // primitives are shared, the bvh_nodes are not needed afterwards.
+    // treelet_bytes: 0 keeps the nodes in depth-first order.
+    wide_bvh(const bvh_node& binary, double time0, double time1,
+             std::size_t treelet_bytes = default_treelet_bytes);
+
+    bool hit(const ray& r, double t_min, double t_max,
+             hit_record& rec) const override;
+    bool bounding_box([[maybe_unused]] double t0, [[maybe_unused]] double t1,
+                      aabb& output_box) const override
+    {
+        output_box = bounds;
+        return true;
+    }
+
+    // Surface area heuristic cost relative to the area of the root, with
+    // the same costs as bvh_node::sah_cost.
+    double sah_cost() const;
+    // Bytes taken by the nodes and the primitive references.
+    std::size_t memory_bytes() const;
+
+    const std::vector<std::shared_ptr<hittable>>& objects() const
+    {
+        return owners;
+    }
+
+ private:
+    struct slot
+    {
+        std::shared_ptr<hittable> object;
+        aabb box;
+        const bvh_node* inner;
+    };
+
+    // Stack entries: a node index, or a primitive index with leaf_flag set,
+    // and the distance at which the ray enters its bounds.
+    struct entry
+    {
+        float t;
+        std::uint32_t item;
+    };
+
+    static const std::uint32_t leaf_flag = 0x80000000u;
+    // A node pushes at most width - 1 more entries than it pops, and the
+    // collapsed tree is no deeper than the bvh_node one (see bvh_node::hit).
+    static const int stack_size = (width - 1) * 128 + 1;
+
+    void collapse(std::uint32_t index, const bvh_node& source, double time0,
+                  double time1);
+    static void quantize(node& n, const slot* children, int count);
+    void reorder(std::size_t treelet_bytes);
+    static float power_of_two(int exponent);
+    aabb child_box(const node& n, int i) const;
+    double subtree_cost(std::uint32_t index, double area) const;
+
+    std::vector<node> nodes;
+    std::vector<bvh_node::child> primitives;
+    // Owners of the primitives, in the same order.
+    std::vector<std::shared_ptr<hittable>> owners;
+    aabb bounds;
+};
+
+inline wide_bvh::wide_bvh(const bvh_node& binary, double time0, double time1,
+                          std::size_t treelet_bytes)
+{
+    binary.bounding_box(time0, time1, bounds);
+    nodes.resize(1);
+    collapse(0, binary, time0, time1);
+
+    if (treelet_bytes > 0)
+    {
+        reorder(treelet_bytes);
+    }
+}
+
+inline void wide_bvh::collapse(std::uint32_t index, const bvh_node& source,
+                               double time0, double time1)
+{
+    slot children[width];
+    int count = 0;
+
+    const auto add = [&](const bvh_node& parent) {
+        for (const auto* object : {&parent.left, &parent.right})
+        {
+            // Single-object nodes point both children at the same object.
+            if (object == &parent.right && parent.right == parent.left)
+            {
+                break;
+            }
+
+            slot& s = children[count++];
+            s.object = *object;
+            s.object->bounding_box(time0, time1, s.box);
+            s.inner = dynamic_cast<const bvh_node*>(object->get());
+        }
+    };
+
+    // Open the inner child with the largest area until the node is full,
+    // which removes the nodes rays are most likely to visit.
+    add(source);
+    while (count < width)
+    {
+        int best = -1;
+        for (int i = 0; i < count; ++i)
+        {
+            if (children[i].inner &&
+                (best < 0 || children[i].box.surface_area() >
+                                 children[best].box.surface_area()))
+            {
+                best = i;
+            }
+        }
+
+        if (best < 0)
+        {
+            break;
+        }
+
+        const bvh_node& opened = *children[best].inner;
+        children[best] = std::move(children[--count]);
+        add(opened);
+    }
+
+    const auto inner_end =
+        std::stable_partition(children, children + count,
+                              [](const slot& s) { return s.inner; });
+    const auto inner_count = static_cast<int>(inner_end - children);
+
+    {
+        node& n = nodes[index];
+        quantize(n, children, count);
+        n.inner_count = static_cast<std::uint8_t>(inner_count);
+        n.child_count = static_cast<std::uint8_t>(count);
+        n.child_base = static_cast<std::uint32_t>(nodes.size());
+        n.primitive_base = static_cast<std::uint32_t>(primitives.size());
+    }
+
+    // Siblings are next to each other; resizing invalidates n.
+    const auto child_base = static_cast<std::uint32_t>(nodes.size());
+    nodes.resize(nodes.size() + inner_count);
+
+    for (int i = inner_count; i < count; ++i)
+    {
+        primitives.push_back(bvh_node::make_child(children[i].object.get()));
+        owners.push_back(std::move(children[i].object));
+    }
+
+    for (int i = 0; i < inner_count; ++i)
+    {
+        collapse(child_base + i, *children[i].inner, time0, time1);
+    }
+}
+
+inline void wide_bvh::reorder(std::size_t treelet_bytes)
+{
+    // The inner children of a node must stay next to each other, so groups
+    // of siblings are laid out as a whole. A group is as hot as its largest
+    // member.
+    struct group
+    {
+        double area;
+        std::uint32_t parent;
+    };
+
+    const auto colder = [](const group& a, const group& b) {
+        return a.area < b.area;
+    };
+    const auto group_of = [&](std::uint32_t parent) {
+        const node& n = nodes[parent];
+        double area = 0.0;
+        for (int i = 0; i < n.inner_count; ++i)
+        {
+            area = std::max(area, child_box(n, i).surface_area());
+        }
+
+        return group{area, parent};
+    };
+
+    const std::size_t capacity =
+        std::max<std::size_t>(1, treelet_bytes / sizeof(node));
+    std::vector<std::uint32_t> order{0};
+    order.reserve(nodes.size());
+    // Roots of the treelets still to lay out, the next one last.
+    std::vector<group> seeds;
+    if (nodes[0].inner_count > 0)
+    {
+        seeds.push_back(group_of(0));
+    }
+
+    std::vector<group> frontier, left_out;
+    while (!seeds.empty())
+    {
+        frontier.assign(1, seeds.back());
+        seeds.pop_back();
+        left_out.clear();
+        std::size_t used = 0;
+
+        while (!frontier.empty())
+        {
+            std::pop_heap(frontier.begin(), frontier.end(), colder);
+            const group g = frontier.back();
+            frontier.pop_back();
+
+            const node& parent = nodes[g.parent];
+            if (used > 0 && used + parent.inner_count > capacity)
+            {
+                left_out.push_back(g);
+                continue;
+            }
+
+            for (std::uint32_t i = 0; i < parent.inner_count; ++i)
+            {
+                const auto child = parent.child_base + i;
+                order.push_back(child);
+                if (nodes[child].inner_count > 0)
+                {
+                    frontier.push_back(group_of(child));
+                    std::push_heap(frontier.begin(), frontier.end(), colder);
+                }
+            }
+            used += parent.inner_count;
+        }
+
+        std::sort(left_out.begin(), left_out.end(), colder);
+        seeds.insert(seeds.end(), left_out.begin(), left_out.end());
+    }
+
+    // Renumber the nodes, and lay out the primitives in the same order.
+    std::vector<std::uint32_t> position(nodes.size());
+    for (std::size_t i = 0; i < order.size(); ++i)
+    {
+        position[order[i]] = static_cast<std::uint32_t>(i);
+    }
+
+    std::vector<node> new_nodes;
+    std::vector<bvh_node::child> new_primitives;
+    std::vector<std::shared_ptr<hittable>> new_owners;
+    new_nodes.reserve(nodes.size());
+    new_primitives.reserve(primitives.size());
+    new_owners.reserve(owners.size());
+
+    for (const auto index : order)
+    {
+        node n = nodes[index];
+        if (n.inner_count > 0)
+        {
+            n.child_base = position[n.child_base];
+        }
+
+        const std::uint32_t first = n.primitive_base;
+        const std::uint32_t leaves = n.child_count - n.inner_count;
+        n.primitive_base = static_cast<std::uint32_t>(new_primitives.size());
+        for (auto i = first; i < first + leaves; ++i)
+        {
+            new_primitives.push_back(primitives[i]);
+            new_owners.push_back(std::move(owners[i]));
+        }
+
+        new_nodes.push_back(n);
+    }
+
+    nodes = std::move(new_nodes);
+    primitives = std::move(new_primitives);
+    owners = std::move(new_owners);
+}
+
+inline float wide_bvh::power_of_two(int exponent)
+{
+    // Exponents are kept in the range of normal floats.
+    const std::uint32_t bits = static_cast<std::uint32_t>(exponent + 127)
+                               << 23;
+    float result;
+    std::memcpy(&result, &bits, sizeof(result));
+
+    return result;
+}
+
+inline void wide_bvh::quantize(node& n, const slot* children, int count)
+{
+    std::memset(&n, 0, sizeof(n));
+
+    aabb box = children[0].box;
+    for (int i = 1; i < count; ++i)
+    {
+        box = surrounding_box(box, children[i].box);
+    }
+
+    for (int a = 0; a < 3; ++a)
+    {
+        // Bounds are rounded outwards, as decoded by the traversal, so that
+        // the quantized boxes contain the real ones.
+        float origin = static_cast<float>(box.min()[a]);
+        if (origin > box.min()[a])
+        {
+            origin = std::nextafter(origin, -HUGE_VALF);
+        }
+
+        int exponent;
+        std::frexp((box.max()[a] - origin) / 255.0, &exponent);
+        exponent = std::clamp(exponent, -126, 127);
+
+        const auto decode = [&](int q) {
+            return origin + static_cast<float>(q) * power_of_two(exponent);
+        };
+
+        bool fits = false;
+        while (!fits)
+        {
+            fits = true;
+            for (int i = 0; i < count && fits; ++i)
+            {
+                const auto scale = static_cast<double>(power_of_two(exponent));
+                auto lo = std::clamp(static_cast<int>(std::floor(
+                                         (children[i].box.min()[a] - origin) /
+                                         scale)),
+                                     0, 255);
+                auto hi = std::clamp(static_cast<int>(std::ceil(
+                                         (children[i].box.max()[a] - origin) /
+                                         scale)),
+                                     0, 255);
+
+                while (lo > 0 && decode(lo) > children[i].box.min()[a])
+                {
+                    --lo;
+                }
+                while (hi < 255 && decode(hi) < children[i].box.max()[a])
+                {
+                    ++hi;
+                }
+
+                fits = decode(hi) >= children[i].box.max()[a];
+                n.lo[a][i] = static_cast<std::uint8_t>(lo);
+                n.hi[a][i] = static_cast<std::uint8_t>(hi);
+            }
+
+            if (!fits)
+            {
+                ++exponent;
+            }
+        }
+
+        n.origin[a] = origin;
+        n.exponent[a] = static_cast<std::int8_t>(exponent);
+    }
+}
+
+inline bool wide_bvh::hit(const ray& r, double t_min, double t_max,
+                          hit_record& rec) const
+{
+    if (!bounds.hit(r, t_min, t_max))
+    {
+        return false;
+    }
+
+    // Direction components too small to invert are nudged away from zero,
+    // which keeps infinities and NaNs out of the slab tests.
+    float origin[3], inverse[3];
+    for (int a = 0; a < 3; ++a)
+    {
+        const auto d = r.direction()[a];
+        origin[a] = static_cast<float>(r.origin()[a]);
+        inverse[a] = static_cast<float>(
+            1.0 / (std::fabs(d) > 1e-30 ? d : std::copysign(1e-30, d)));
+    }
+
+    // Float rounding in the slab test is absorbed by widening the far
+    // distance slightly (as in pbrt).
+    const float far_scale = 1.0f + 2.0f * 3.0f * 0x1p-24f;
+
+    entry stack[stack_size];
+    int top = 0;
+    stack[top++] = {static_cast<float>(t_min), 0};
+    bool hit_anything = false;
+
+    while (top > 0)
+    {
+        const entry e = stack[--top];
+        if (e.t > t_max)
+        {
+            continue;
+        }
+
+        if (e.item & leaf_flag)
+        {
+            if (bvh_node::hit_child(primitives[e.item & ~leaf_flag], r, t_min,
+                                    t_max, rec))
+            {
+                hit_anything = true;
+                t_max = rec.t;
+            }
+            continue;
+        }
+
+        // One loop over the lanes with the axes unrolled, which the
+        // vectorizer handles better than a loop nest.
+        const node& n = nodes[e.item];
+        float scale[3], base[3];
+        for (int a = 0; a < 3; ++a)
+        {
+            scale[a] = power_of_two(n.exponent[a]) * inverse[a];
+            base[a] = (n.origin[a] - origin[a]) * inverse[a];
+        }
+
+        const auto near_limit = static_cast<float>(t_min);
+        const auto far_limit = static_cast<float>(t_max);
+        float t_near[width], t_far[width];
+
+        for (int i = 0; i < width; ++i)
+        {
+            const float x0 = base[0] + n.lo[0][i] * scale[0];
+            const float x1 = base[0] + n.hi[0][i] * scale[0];
+            const float y0 = base[1] + n.lo[1][i] * scale[1];
+            const float y1 = base[1] + n.hi[1][i] * scale[1];
+            const float z0 = base[2] + n.lo[2][i] * scale[2];
+            const float z1 = base[2] + n.hi[2][i] * scale[2];
+
+            t_near[i] = std::max(std::max(std::min(x0, x1), std::min(y0, y1)),
+                                 std::max(std::min(z0, z1), near_limit));
+            t_far[i] = std::min(std::min(std::max(x0, x1), std::max(y0, y1)),
+                                std::min(std::max(z0, z1), far_limit));
+        }
+
+        // Push the children hit, nearest last so that it is popped first.
+        entry hits[width];
+        int count = 0;
+        for (int i = 0; i < n.child_count; ++i)
+        {
+            if (t_near[i] > t_far[i] * far_scale)
+            {
+                continue;
+            }
+
+            const std::uint32_t item =
+                i < n.inner_count
+                    ? n.child_base + i
+                    : (n.primitive_base + (i - n.inner_count)) | leaf_flag;
+            int j = count++;
+            for (; j > 0 && hits[j - 1].t < t_near[i]; --j)
+            {
+                hits[j] = hits[j - 1];
+            }
+            hits[j] = {t_near[i], item};
+        }
+
+        for (int i = 0; i < count; ++i)
+        {
+            stack[top++] = hits[i];
+        }
+    }
+
+    return hit_anything;
+}
+
+inline aabb wide_bvh::child_box(const node& n, int i) const
+{
+    point3 lo, hi;
+    for (int a = 0; a < 3; ++a)
+    {
+        const float scale = power_of_two(n.exponent[a]);
+        lo[a] = n.origin[a] + n.lo[a][i] * scale;
+        hi[a] = n.origin[a] + n.hi[a][i] * scale;
+    }
+
+    return aabb(lo, hi);
+}
+
+inline double wide_bvh::sah_cost() const
+{
+    const auto area = bounds.surface_area();
+
+    return area > 0.0 ? subtree_cost(0, area) / area : 0.0;
+}
+
+inline double wide_bvh::subtree_cost(std::uint32_t index, double area) const
+{
+    // Same model as bvh_node::subtree_cost: visiting a node tests all of
+    // its children's boxes, and its primitives are tested without a box of
+    // their own.
+    const node& n = nodes[index];
+    double cost = bvh_node::traversal_cost * area;
+
+    for (int i = 0; i < n.child_count; ++i)
+    {
+        cost += i < n.inner_count
+                    ? subtree_cost(n.child_base + i,
+                                   child_box(n, i).surface_area())
+                    : bvh_node::intersection_cost * area;
+    }
+
+    return cost;
+}
+
+inline std::size_t wide_bvh::memory_bytes() const
+{
+    return nodes.size() * sizeof(node) +
+           primitives.size() * sizeof(bvh_node::child) +
+           owners.size() * sizeof(std::shared_ptr<hittable>);
+}
+
+#endif
@@ -12,15 +12,13 @@
 
 #include "hittable.hpp"
 
-#include <utility>
-
 class xy_rect final : public hittable
 {
  public:
     xy_rect() = default;
     xy_rect(double _x0, double _x1, double _y0, double _y1, double _k,
-            std::shared_ptr<material> mat)
-        : mp(std::move(mat)), x0(_x0), x1(_x1), y0(_y0), y1(_y1), k(_k)
+            material_handle mat)
+        : mp(mat), x0(_x0), x1(_x1), y0(_y0), y1(_y1), k(_k)
     {
         // Do nothing
     }
@@ -37,8 +35,10 @@ class xy_rect final : public hittable
         return true;
     }
 
-    std::shared_ptr<material> mp;
+    material_handle mp{0};
     double x0 = 0.0, x1 = 0.0, y0 = 0.0, y1 = 0.0, k = 0.0;
+    // Reports hits as back faces and vice versa, like flip_face.
+    bool flipped = false;
 };
 
 inline bool xy_rect::hit(const ray& r, double t0, double t1,
@@ -61,10 +61,13 @@ inline bool xy_rect::hit(const ray& r, double t0, double t1,
     rec.u = (x - x0) / (x1 - x0);
     rec.v = (y - y0) / (y1 - y0);
     rec.t = t;
+    rec.dpdu = vec3(x1 - x0, 0, 0);
+    rec.dpdv = vec3(0, y1 - y0, 0);
 
     const auto outward_normal = vec3(0, 0, 1);
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mp;
+    rec.front_face = rec.front_face != flipped;
+    rec.mat = mp;
     rec.p = r.at(t);
 
     return true;
@@ -12,15 +12,13 @@
 
 #include "hittable.hpp"
 
-#include <utility>
-
 class xz_rect final : public hittable
 {
  public:
     xz_rect() = default;
     xz_rect(double _x0, double _x1, double _z0, double _z1, double _k,
-            std::shared_ptr<material> mat)
-        : mp(std::move(mat)), x0(_x0), x1(_x1), z0(_z0), z1(_z1), k(_k)
+            material_handle mat)
+        : mp(mat), x0(_x0), x1(_x1), z0(_z0), z1(_z1), k(_k)
     {
         // Do nothing
     }
@@ -59,8 +57,10 @@ class xz_rect final : public hittable
         return random_point - origin;
     }
 
-    std::shared_ptr<material> mp;
+    material_handle mp{0};
     double x0 = 0.0, x1 = 0.0, z0 = 0.0, z1 = 0.0, k = 0.0;
+    // Reports hits as back faces and vice versa, like flip_face.
+    bool flipped = false;
 };
 
 inline bool xz_rect::hit(const ray& r, double t0, double t1,
@@ -83,10 +83,13 @@ inline bool xz_rect::hit(const ray& r, double t0, double t1,
     rec.u = (x - x0) / (x1 - x0);
     rec.v = (z - z0) / (z1 - z0);
     rec.t = t;
+    rec.dpdu = vec3(x1 - x0, 0, 0);
+    rec.dpdv = vec3(0, 0, z1 - z0);
 
     const auto outward_normal = vec3(0, 1, 0);
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mp;
+    rec.front_face = rec.front_face != flipped;
+    rec.mat = mp;
     rec.p = r.at(t);
 
     return true;
@@ -12,15 +12,13 @@
 
 #include "hittable.hpp"
 
-#include <utility>
-
 class yz_rect final : public hittable
 {
  public:
     yz_rect() = default;
     yz_rect(double _y0, double _y1, double _z0, double _z1, double _k,
-            std::shared_ptr<material> mat)
-        : mp(std::move(mat)), y0(_y0), y1(_y1), z0(_z0), z1(_z1), k(_k)
+            material_handle mat)
+        : mp(mat), y0(_y0), y1(_y1), z0(_z0), z1(_z1), k(_k)
     {
         // Do nothing
     }
@@ -37,8 +35,10 @@ class yz_rect final : public hittable
         return true;
     }
 
-    std::shared_ptr<material> mp;
+    material_handle mp{0};
     double y0 = 0.0, y1 = 0.0, z0 = 0.0, z1 = 0.0, k = 0.0;
+    // Reports hits as back faces and vice versa, like flip_face.
+    bool flipped = false;
 };
 
 inline bool yz_rect::hit(const ray& r, double t0, double t1,
@@ -61,10 +61,13 @@ inline bool yz_rect::hit(const ray& r, double t0, double t1,
     rec.u = (y - y0) / (y1 - y0);
     rec.v = (z - z0) / (z1 - z0);
     rec.t = t;
+    rec.dpdu = vec3(0, y1 - y0, 0);
+    rec.dpdv = vec3(0, 0, z1 - z0);
 
     const auto outward_normal = vec3(1, 0, 0);
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mp;
+    rec.front_face = rec.front_face != flipped;
+    rec.mat = mp;
     rec.p = r.at(t);
 
     return true;